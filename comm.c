@@ -25,6 +25,8 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <errno.h>
 
 #include "dvblast.h"
@@ -35,6 +37,33 @@
  * Local declarations
  *****************************************************************************/
 int i_comm_fd = -1;
+int i_comm_stream_fd = -1;
+
+/* Connections to the stream endpoint. Requests are read and answered one at
+ * a time; the answer is written as the socket accepts it. */
+typedef struct comm_client_t
+{
+    int i_fd;
+    uint8_t p_request[COMM_BUFFER_SIZE];
+    size_t i_request_size;
+    uint8_t *p_answer;
+    size_t i_answer_size, i_answer_sent;
+
+    /* Event subscription */
+    struct cmd_subscribe filter;
+    uint64_t i_event_read;
+    uint32_t i_events_dropped;
+} comm_client_t;
+
+static comm_client_t **pp_clients = NULL;
+static int i_nb_clients = 0;
+
+/* Events are written to the ring from the data path, and only copied to
+ * subscribers from comm_Poll(). A subscriber which is more than
+ * COMM_EVENT_RING events late loses the oldest ones. */
+static dvblast_event_t p_events[COMM_EVENT_RING];
+static uint64_t i_event_next = 0;
+static int i_nb_subscribers = 0;
 
 /*****************************************************************************
  * comm_Open
@@ -69,41 +98,37 @@ void comm_Open( void )
     }
 }
 
+/* Makes room for answers which do not fit in COMM_BUFFER_SIZE, which only
+ * the stream endpoint accepts. */
+static uint8_t *comm_GrowAnswer( uint8_t *p_answer, size_t i_answer_size )
+{
+    if ( i_answer_size > COMM_BUFFER_SIZE - COMM_HEADER_SIZE )
+        p_answer = realloc( p_answer, COMM_HEADER_SIZE + i_answer_size );
+    return p_answer;
+}
+
 /*****************************************************************************
- * comm_Read
+ * comm_Process : execute a request and return the answer, with its header,
+ * or NULL if the request must be ignored
  *****************************************************************************/
-void comm_Read( void )
+static uint8_t *comm_Process( comm_client_t *p_client,
+                              uint8_t *p_buffer, ssize_t i_size,
+                              size_t i_max_answer, size_t *pi_answer_size )
 {
-    struct sockaddr_un sun_client;
-    socklen_t sun_length = sizeof(sun_client);
-    ssize_t i_size, i_answer_size = 0;
-    uint8_t p_buffer[COMM_BUFFER_SIZE], p_answer[COMM_BUFFER_SIZE];
+    ssize_t i_answer_size = 0;
+    uint8_t *p_answer = malloc( COMM_BUFFER_SIZE );
     uint8_t i_command, i_answer;
     uint8_t *p_packed_section;
     unsigned int i_packed_section_size;
     uint8_t *p_input = p_buffer + COMM_HEADER_SIZE;
     uint8_t *p_output = p_answer + COMM_HEADER_SIZE;
 
-    i_size = recvfrom( i_comm_fd, p_buffer, COMM_BUFFER_SIZE, 0,
-                       (struct sockaddr *)&sun_client, &sun_length );
-    if ( i_size < COMM_HEADER_SIZE )
-    {
-        msg_Err( NULL, "cannot read comm socket (%zd:%s)\n", i_size,
-                 strerror(errno) );
-        return;
-    }
-    if ( sun_length == 0 || sun_length > sizeof(sun_client) )
-    {
-        msg_Err( NULL, "anonymous packet from comm socket\n" );
-        return;
-    }
-
     if ( p_buffer[0] != COMM_HEADER_MAGIC )
     {
         msg_Err( NULL, "wrong protocol version 0x%x", p_buffer[0] );
-        return;
+        free( p_answer );
+        return NULL;
     }
-
     i_command = p_buffer[1];
 
     if ( i_frequency == 0 ) /* ASI or UDP, disable DVB only commands */
@@ -198,9 +223,10 @@ void comm_Read( void )
 
         if ( p_packed_section && i_packed_section_size )
         {
-            if ( i_packed_section_size <= COMM_BUFFER_SIZE - COMM_HEADER_SIZE )
+            if ( i_packed_section_size <= i_max_answer - COMM_HEADER_SIZE )
             {
                 i_answer_size = i_packed_section_size;
+                p_answer = comm_GrowAnswer( p_answer, i_answer_size );
                 memcpy( p_answer + COMM_HEADER_SIZE, p_packed_section, i_packed_section_size );
             } else {
                 msg_Err( NULL, "section size is too big (%u)\n", i_packed_section_size );
@@ -219,21 +245,24 @@ void comm_Read( void )
         if ( i_size < COMM_HEADER_SIZE + 2 )
         {
             msg_Err( NULL, "command packet is too short (%zd)\n", i_size );
-            return;
+            free( p_answer );
+            return NULL;
         }
 
         uint16_t i_sid = (uint16_t)((p_input[0] << 8) | p_input[1]);
         p_packed_section = demux_get_packed_PMT(i_sid, &i_packed_section_size);
 
-        if ( p_packed_section && i_packed_section_size )
+        if ( p_packed_section && i_packed_section_size &&
+             i_packed_section_size <= i_max_answer - COMM_HEADER_SIZE )
         {
             i_answer = RET_PMT;
             i_answer_size = i_packed_section_size;
+            p_answer = comm_GrowAnswer( p_answer, i_answer_size );
             memcpy( p_answer + COMM_HEADER_SIZE, p_packed_section, i_packed_section_size );
-            free( p_packed_section );
         } else {
             i_answer = RET_NODATA;
         }
+        free( p_packed_section );
 
         break;
     }
@@ -251,7 +280,8 @@ void comm_Read( void )
         if ( i_size < COMM_HEADER_SIZE + 2 )
         {
             msg_Err( NULL, "command packet is too short (%zd)\n", i_size );
-            return;
+            free( p_answer );
+            return NULL;
         }
 
         uint16_t i_pid = (uint16_t)((p_input[0] << 8) | p_input[1]);
@@ -265,6 +295,88 @@ void comm_Read( void )
         break;
     }
 
+    case CMD_GET_PIDS_SPARSE:
+    {
+        struct cmd_pids_query query;
+
+        if ( i_size < COMM_HEADER_SIZE + sizeof(struct cmd_pids_query) )
+        {
+            msg_Err( NULL, "command packet is too short (%zd)\n", i_size );
+            free( p_answer );
+            return NULL;
+        }
+
+        memcpy( &query, p_input, sizeof(struct cmd_pids_query) );
+        i_answer = RET_PIDS_SPARSE;
+        i_answer_size = demux_get_PIDS_sparse( query.i_flags, query.i_sid,
+                                               query.i_generation, p_output,
+                                               COMM_BUFFER_SIZE
+                                                - COMM_HEADER_SIZE );
+        break;
+    }
+
+    case CMD_GET_SECTION_POOLS:
+    {
+        i_answer = RET_SECTION_POOLS;
+        i_answer_size = sizeof(struct cmd_section_pools_info);
+        demux_get_section_pools_info( p_output );
+        break;
+    }
+
+    case CMD_GET_OUTPUTS:
+    {
+        i_answer = RET_OUTPUTS;
+        i_answer_size = outputs_GetInfo( p_output,
+                                         COMM_BUFFER_SIZE - COMM_HEADER_SIZE );
+        break;
+    }
+
+    case CMD_ADD_OUTPUT:
+    case CMD_CHANGE_OUTPUT:
+    case CMD_DELETE_OUTPUT:
+    {
+        char *psz_line = strndup( (char *)p_input, i_size - COMM_HEADER_SIZE );
+        bool b_ok;
+
+        if ( i_command == CMD_DELETE_OUTPUT )
+            b_ok = config_DeleteOutput( psz_line );
+        else
+            b_ok = config_SetOutput( psz_line, i_command == CMD_ADD_OUTPUT,
+                                     i_command == CMD_CHANGE_OUTPUT );
+        free( psz_line );
+        i_answer = b_ok ? RET_OK : RET_ERR;
+        i_answer_size = 0;
+        break;
+    }
+
+    case CMD_SUBSCRIBE_EVENTS:
+    {
+        if ( i_size < COMM_HEADER_SIZE + sizeof(struct cmd_subscribe) )
+        {
+            msg_Err( NULL, "command packet is too short (%zd)\n", i_size );
+            free( p_answer );
+            return NULL;
+        }
+
+        i_answer_size = 0;
+        if ( p_client == NULL )
+        {
+            msg_Warn( NULL, "events are only sent on the stream socket" );
+            i_answer = RET_ERR;
+            break;
+        }
+
+        if ( p_client->filter.i_kinds )
+            i_nb_subscribers--;
+        memcpy( &p_client->filter, p_input, sizeof(struct cmd_subscribe) );
+        if ( p_client->filter.i_kinds )
+            i_nb_subscribers++;
+        p_client->i_event_read = i_event_next;
+        p_client->i_events_dropped = 0;
+        i_answer = RET_OK;
+        break;
+    }
+
     default:
         msg_Err( NULL, "wrong command %u", i_command );
         i_answer = RET_HUH;
@@ -283,9 +395,43 @@ void comm_Read( void )
 /*    msg_Dbg( NULL, "answering %d to %d with size %zd", i_answer, i_command,
              i_answer_size ); */
 
+    *pi_answer_size = i_answer_size + COMM_HEADER_SIZE;
+    return p_answer;
+}
+
+/*****************************************************************************
+ * comm_Read : answer a request on the datagram socket
+ *****************************************************************************/
+void comm_Read( void )
+{
+    struct sockaddr_un sun_client;
+    socklen_t sun_length = sizeof(sun_client);
+    ssize_t i_size;
+    size_t i_answer_size;
+    uint8_t p_buffer[COMM_BUFFER_SIZE], *p_answer;
+
+    i_size = recvfrom( i_comm_fd, p_buffer, COMM_BUFFER_SIZE, 0,
+                       (struct sockaddr *)&sun_client, &sun_length );
+    if ( i_size < COMM_HEADER_SIZE )
+    {
+        msg_Err( NULL, "cannot read comm socket (%zd:%s)\n", i_size,
+                 strerror(errno) );
+        return;
+    }
+    if ( sun_length == 0 || sun_length > sizeof(sun_client) )
+    {
+        msg_Err( NULL, "anonymous packet from comm socket\n" );
+        return;
+    }
+
+    p_answer = comm_Process( NULL, p_buffer, i_size, COMM_BUFFER_SIZE,
+                             &i_answer_size );
+    if ( p_answer == NULL )
+        return;
+
 #define min(a, b) (a < b ? a : b)
     ssize_t i_sended = 0;
-    ssize_t i_to_send = i_answer_size + COMM_HEADER_SIZE;
+    ssize_t i_to_send = i_answer_size;
     do {
         ssize_t i_sent = sendto( i_comm_fd, p_answer + i_sended,
                      min(i_to_send, COMM_MAX_MSG_CHUNK), 0,
@@ -300,4 +446,308 @@ void comm_Read( void )
         i_to_send -= i_sent;
     } while ( i_to_send > 0 );
 #undef min
+    free( p_answer );
+}
+
+/*****************************************************************************
+ * comm_OpenStream : open the stream endpoint, for answers of any size
+ *****************************************************************************/
+void comm_OpenStream( void )
+{
+    struct sockaddr_un sun_server;
+
+    unlink( psz_srv_stream_socket );
+
+    if ( (i_comm_stream_fd = socket( AF_UNIX, SOCK_STREAM, 0 )) == -1 )
+    {
+        msg_Err( NULL, "cannot create comm stream socket (%s)",
+                 strerror(errno) );
+        return;
+    }
+
+    memset( &sun_server, 0, sizeof(sun_server) );
+    sun_server.sun_family = AF_UNIX;
+    strncpy( sun_server.sun_path, psz_srv_stream_socket,
+             sizeof(sun_server.sun_path) );
+    sun_server.sun_path[sizeof(sun_server.sun_path) - 1] = '\0';
+
+    if ( bind( i_comm_stream_fd, (struct sockaddr *)&sun_server,
+               SUN_LEN(&sun_server) ) < 0
+          || listen( i_comm_stream_fd, 8 ) < 0
+          || fcntl( i_comm_stream_fd, F_SETFL, O_NONBLOCK ) < 0 )
+    {
+        msg_Err( NULL, "cannot bind comm stream socket (%s)",
+                 strerror(errno) );
+        close( i_comm_stream_fd );
+        i_comm_stream_fd = -1;
+        return;
+    }
+}
+
+static void comm_CloseClient( int i )
+{
+    comm_client_t *p_client = pp_clients[i];
+
+    if ( p_client->filter.i_kinds )
+        i_nb_subscribers--;
+    close( p_client->i_fd );
+    free( p_client->p_answer );
+    free( p_client );
+    pp_clients[i] = pp_clients[--i_nb_clients];
+}
+
+/* Reads what the client sent, and answers the first complete request once
+ * the previous answer is out. Returns false if the client must be closed. */
+static bool comm_ReadClient( comm_client_t *p_client )
+{
+    ssize_t i_size;
+    uint32_t i_request_size;
+
+    if ( p_client->i_request_size < COMM_BUFFER_SIZE )
+    {
+        i_size = recv( p_client->i_fd,
+                       p_client->p_request + p_client->i_request_size,
+                       COMM_BUFFER_SIZE - p_client->i_request_size,
+                       MSG_DONTWAIT );
+        if ( i_size == 0 ||
+             (i_size < 0 && errno != EAGAIN && errno != EINTR) )
+            return false;
+        if ( i_size > 0 )
+            p_client->i_request_size += i_size;
+    }
+
+    if ( p_client->p_answer != NULL
+          || p_client->i_request_size < COMM_HEADER_SIZE )
+        return true;
+
+    /* The size field of the header frames requests on the stream. */
+    memcpy( &i_request_size, &p_client->p_request[4], sizeof(uint32_t) );
+    if ( i_request_size < COMM_HEADER_SIZE
+          || i_request_size > COMM_BUFFER_SIZE )
+    {
+        msg_Err( NULL, "invalid request size on comm stream (%u)",
+                 i_request_size );
+        return false;
+    }
+    if ( p_client->i_request_size < i_request_size )
+        return true;
+
+    p_client->p_answer = comm_Process( p_client,
+                                       p_client->p_request, i_request_size,
+                                       COMM_STREAM_MAX_ANSWER,
+                                       &p_client->i_answer_size );
+    if ( p_client->p_answer == NULL )
+        return false;
+    p_client->i_answer_sent = 0;
+    p_client->i_request_size -= i_request_size;
+    memmove( p_client->p_request, p_client->p_request + i_request_size,
+             p_client->i_request_size );
+    return true;
+}
+
+/* Writes as much of the pending answer as the socket accepts. */
+static bool comm_WriteClient( comm_client_t *p_client )
+{
+    ssize_t i_sent = send( p_client->i_fd,
+                           p_client->p_answer + p_client->i_answer_sent,
+                           p_client->i_answer_size - p_client->i_answer_sent,
+                           MSG_DONTWAIT | MSG_NOSIGNAL );
+
+    if ( i_sent < 0 )
+        return errno == EAGAIN || errno == EINTR;
+
+    p_client->i_answer_sent += i_sent;
+    if ( p_client->i_answer_sent == p_client->i_answer_size )
+    {
+        free( p_client->p_answer );
+        p_client->p_answer = NULL;
+        /* A pipelined request may already be complete. */
+        if ( p_client->i_request_size )
+            return comm_ReadClient( p_client );
+    }
+    return true;
+}
+
+/* Queues the events matching the filter of a subscriber, once its previous
+ * message is out. */
+static void comm_SendEvents( comm_client_t *p_client )
+{
+    const struct cmd_subscribe *p_filter = &p_client->filter;
+    dvblast_events_t *p_header;
+    dvblast_event_t *p_event;
+    uint8_t *p_answer;
+    uint32_t *p_size;
+    uint32_t i_nb_events = 0;
+
+    if ( !p_filter->i_kinds || p_client->p_answer != NULL
+          || p_client->i_event_read == i_event_next )
+        return;
+
+    if ( i_event_next - p_client->i_event_read > COMM_EVENT_RING )
+    {
+        p_client->i_events_dropped += i_event_next - p_client->i_event_read
+                                       - COMM_EVENT_RING;
+        p_client->i_event_read = i_event_next - COMM_EVENT_RING;
+    }
+
+    p_answer = malloc( COMM_HEADER_SIZE + sizeof(dvblast_events_t)
+                        + (i_event_next - p_client->i_event_read)
+                           * sizeof(dvblast_event_t) );
+    p_header = (dvblast_events_t *)(p_answer + COMM_HEADER_SIZE);
+    p_event = (dvblast_event_t *)(p_header + 1);
+
+    for ( ; p_client->i_event_read < i_event_next; p_client->i_event_read++ )
+    {
+        const dvblast_event_t *p_ring =
+            &p_events[p_client->i_event_read % COMM_EVENT_RING];
+
+        if ( !(p_filter->i_kinds & (1 << p_ring->i_kind)) )
+            continue;
+        if ( p_filter->i_pid != EVENT_ANY_PID
+              && p_ring->i_pid != EVENT_ANY_PID
+              && p_ring->i_pid != p_filter->i_pid )
+            continue;
+        if ( p_filter->i_sid && p_ring->i_sid
+              && p_ring->i_sid != p_filter->i_sid )
+            continue;
+        p_event[i_nb_events++] = *p_ring;
+    }
+
+    if ( !i_nb_events && !p_client->i_events_dropped )
+    {
+        free( p_answer );
+        return;
+    }
+
+    p_header->i_dropped = p_client->i_events_dropped;
+    p_header->i_nb_events = i_nb_events;
+    p_client->i_events_dropped = 0;
+
+    p_answer[0] = COMM_HEADER_MAGIC;
+    p_answer[1] = RET_EVENTS;
+    p_answer[2] = 0;
+    p_answer[3] = 0;
+    p_size = (uint32_t *)&p_answer[4];
+    *p_size = COMM_HEADER_SIZE + sizeof(dvblast_events_t)
+               + i_nb_events * sizeof(dvblast_event_t);
+
+    p_client->p_answer = p_answer;
+    p_client->i_answer_size = *p_size;
+    p_client->i_answer_sent = 0;
+}
+
+/*****************************************************************************
+ * comm_Event : record an event for the subscribers, from the data path
+ *****************************************************************************/
+void comm_Event( uint8_t i_kind, uint16_t i_pid, uint16_t i_sid,
+                 uint32_t i_value1, uint32_t i_value2 )
+{
+    dvblast_event_t *p_event;
+
+    if ( !i_nb_subscribers )
+        return;
+
+    p_event = &p_events[i_event_next++ % COMM_EVENT_RING];
+    memset( p_event, 0, sizeof(dvblast_event_t) );
+    p_event->i_date = i_wallclock;
+    p_event->i_kind = i_kind;
+    p_event->i_pid = i_pid;
+    p_event->i_sid = i_sid;
+    p_event->i_value1 = i_value1;
+    p_event->i_value2 = i_value2;
+}
+
+/*****************************************************************************
+ * comm_Poll : serve the stream endpoint without blocking, from the main loop
+ *****************************************************************************/
+void comm_Poll( void )
+{
+    struct pollfd pfd[COMM_STREAM_MAX_CLIENTS + 1];
+    int i, i_fd;
+
+    if ( i_comm_stream_fd == -1 )
+        return;
+
+    if ( i_nb_subscribers )
+        for ( i = 0; i < i_nb_clients; i++ )
+            comm_SendEvents( pp_clients[i] );
+
+    pfd[0].fd = i_comm_stream_fd;
+    pfd[0].events = POLLIN;
+    for ( i = 0; i < i_nb_clients; i++ )
+    {
+        pfd[i + 1].fd = pp_clients[i]->i_fd;
+        pfd[i + 1].events = POLLIN
+                             | (pp_clients[i]->p_answer != NULL ? POLLOUT : 0);
+    }
+
+    if ( poll( pfd, i_nb_clients + 1, 0 ) <= 0 )
+        return;
+
+    /* Backwards, as comm_CloseClient() moves the last client. */
+    for ( i = i_nb_clients - 1; i >= 0; i-- )
+    {
+        comm_client_t *p_client = pp_clients[i];
+        bool b_ok = true;
+
+        if ( pfd[i + 1].revents & (POLLIN | POLLHUP | POLLERR) )
+            b_ok = comm_ReadClient( p_client );
+        if ( b_ok && (pfd[i + 1].revents & POLLOUT) )
+            b_ok = comm_WriteClient( p_client );
+        if ( !b_ok )
+            comm_CloseClient( i );
+    }
+
+    if ( (pfd[0].revents & POLLIN)
+          && (i_fd = accept( i_comm_stream_fd, NULL, NULL )) >= 0 )
+    {
+        if ( i_nb_clients == COMM_STREAM_MAX_CLIENTS )
+        {
+            msg_Warn( NULL, "too many comm stream clients" );
+            close( i_fd );
+            return;
+        }
+        comm_client_t *p_client = malloc( sizeof(comm_client_t) );
+        p_client->i_fd = i_fd;
+        p_client->i_request_size = 0;
+        p_client->p_answer = NULL;
+        memset( &p_client->filter, 0, sizeof(p_client->filter) );
+        p_client->i_event_read = 0;
+        p_client->i_events_dropped = 0;
+        pp_clients = realloc( pp_clients,
+                              (i_nb_clients + 1) * sizeof(comm_client_t *) );
+        pp_clients[i_nb_clients++] = p_client;
+    }
+}
+
+/*****************************************************************************
+ * comm_Pending : whether an answer or events are still to be written
+ *****************************************************************************/
+bool comm_Pending( void )
+{
+    int i;
+
+    for ( i = 0; i < i_nb_clients; i++ )
+        if ( pp_clients[i]->p_answer != NULL
+              || (pp_clients[i]->filter.i_kinds
+                   && pp_clients[i]->i_event_read != i_event_next) )
+            return true;
+    return false;
+}
+
+/*****************************************************************************
+ * comm_CloseStream
+ *****************************************************************************/
+void comm_CloseStream( void )
+{
+    if ( i_comm_stream_fd == -1 )
+        return;
+
+    while ( i_nb_clients )
+        comm_CloseClient( i_nb_clients - 1 );
+    free( pp_clients );
+    pp_clients = NULL;
+    close( i_comm_stream_fd );
+    i_comm_stream_fd = -1;
+    unlink( psz_srv_stream_socket );
 }
@@ -28,6 +28,12 @@
 
 #define COMM_MAX_MSG_CHUNK 4096
 
+/* Stream endpoint: requests are framed by the size field of their header */
+#define COMM_STREAM_MAX_ANSWER (16 * 1024 * 1024)
+#define COMM_STREAM_MAX_CLIENTS 16
+/* Events kept for subscribers which are late reading them */
+#define COMM_EVENT_RING 4096
+
 typedef enum {
     CMD_INVALID             = 0,
     CMD_RELOAD              = 1,
@@ -47,6 +53,13 @@ typedef enum {
     CMD_GET_PID             = 16, /* arg: pid (uint16_t) */
     CMD_MMI_SEND_TEXT       = 17, /* arg: slot, en50221_mmi_object_t */
     CMD_MMI_SEND_CHOICE     = 18, /* arg: slot, en50221_mmi_object_t */
+    CMD_GET_SECTION_POOLS   = 19,
+    CMD_GET_OUTPUTS         = 20,
+    CMD_ADD_OUTPUT          = 21, /* arg: configuration line */
+    CMD_CHANGE_OUTPUT       = 22, /* arg: configuration line */
+    CMD_DELETE_OUTPUT       = 23, /* arg: configuration line */
+    CMD_GET_PIDS_SPARSE     = 24, /* arg: cmd_pids_query */
+    CMD_SUBSCRIBE_EVENTS    = 25, /* arg: cmd_subscribe, stream only */
 } ctl_cmd_t;
 
 typedef enum {
@@ -65,6 +78,10 @@ typedef enum {
     RET_PMT                 = 12,
     RET_PIDS                = 13,
     RET_PID                 = 14,
+    RET_SECTION_POOLS       = 15,
+    RET_OUTPUTS             = 16,
+    RET_PIDS_SPARSE         = 17,
+    RET_EVENTS              = 18, /* unsolicited, after CMD_SUBSCRIBE_EVENTS */
     RET_HUH                 = 255,
 } ctl_cmd_answer_t;
 
@@ -103,3 +120,22 @@ struct cmd_pid_info
 {
     ts_pid_info_t pids[MAX_PIDS];
 };
+
+struct cmd_pids_query
+{
+    uint8_t i_flags;                    /* PIDS_ACTIVE, PIDS_CHANGED, PIDS_SID */
+    uint16_t i_sid;
+    uint32_t i_generation;
+};
+
+struct cmd_subscribe
+{
+    uint32_t i_kinds;                   /* 1 << EVENT_*, 0 to unsubscribe */
+    uint16_t i_pid;                     /* or EVENT_ANY_PID */
+    uint16_t i_sid;                     /* or 0 for any */
+};
+
+struct cmd_section_pools_info
+{
+    section_pool_info_t pools[SECTION_POOLS];
+};
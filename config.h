@@ -34,6 +34,7 @@
 #define HAVE_ICONV
 
 #define DEFAULT_PORT 3001
+#define DEFAULT_METRICS_PORT 9305
 #define TS_SIZE 188
 #define MAX_PIDS 8192
 #define DEFAULT_IPV4_MTU 1500
@@ -46,7 +47,20 @@
 #define MAX_POLL_TIMEOUT 100000 /* 100 ms */
 #define DEFAULT_OUTPUT_LATENCY 200000 /* 200 ms */
 #define DEFAULT_MAX_RETENTION 40000 /* 40 ms */
+#define MAX_CBR_RATE 1000000000 /* 1 Gbi/s */
+#define INPUT_FAILBACK_DELAY 5000000 /* 5 s */
+#define INPUT_STARTUP_DELAY 5000000 /* 5 s, for the input to start before
+                                     * switching to the backup input */
+#define INPUT_POLL_TIMEOUT 5000 /* 5 ms, when reading several inputs */
 #define MAX_EIT_RETENTION 500000 /* 500 ms */
+#define EIT_CAROUSEL_PERIOD 100000 /* 100 ms */
+#define ERROR_REPORT_PERIOD 1000000 /* 1 s, per PID and type of error */
+#define OUTPUT_STATS_PERIOD 1000000 /* 1 s, for fill ratio and latency */
+#define STATS_PERIOD 100000 /* 100 ms, between updates of the stats file */
+#define PSI_CACHE_PERIOD 5000000 /* 5 s, between writes of the PSI cache */
+#define HANDOFF_PERIOD 100000 /* 100 ms, between checks for a new instance */
+#define HANDOFF_TIMEOUT 5000000 /* 5 s, to hand over or to wait for the exit */
+#define MAX_MPTS_SERVICES 128 /* keeps the output PAT in one section */
 #define DEFAULT_FRONTEND_TIMEOUT 30000000 /* 30 s */
 #define EXIT_STATUS_FRONTEND_TIMEOUT 100
 
@@ -24,18 +24,23 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <string.h>
 #include <stdarg.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <errno.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 #include "dvblast.h"
 #include "en50221.h"
+#include "stats.h"
+#include "handoff.h"
 
 #ifdef HAVE_ICONV
 #include <iconv.h>
@@ -56,6 +61,12 @@ extern bool b_enable_ecm;
  * Local declarations
  *****************************************************************************/
 #define MIN_SECTION_FRAGMENT    PSI_HEADER_SIZE_SYNTAX1
+#define EIT_SCHEDULE_TABLES     (EIT_TABLE_ID_SCHED_ACTUAL_LAST \
+                                  - EIT_TABLE_ID_SCHED_ACTUAL_FIRST + 1)
+/* An EIT schedule table spans 32 segments of 3 hours, 8 sections each. */
+#define EIT_SEGMENTS_PER_TABLE  32
+#define EIT_SEGMENTS_PER_DAY    8
+#define EIT_SECTIONS_PER_SEGMENT 8
 
 typedef struct ts_pid_t
 {
@@ -72,38 +83,131 @@ typedef struct ts_pid_t
     mtime_t i_bytes_ts;
     unsigned long i_packets_passed;
     ts_pid_info_t info;
+    uint32_t i_info_generation; /* i_pids_generation of the last change */
+
+    /* get_pid_desc() result, valid while i_desc_generation is current */
+    const char *psz_desc;
+    uint16_t i_desc_sid;
+    unsigned int i_desc_generation;
+
+    /* Rate limiting of error reports */
+    mtime_t i_last_cc_report, i_last_te_report;
+    unsigned int i_cc_suppressed, i_te_suppressed;
 
     /* biTStream PSI section gathering */
     uint8_t *p_psi_buffer;
     uint16_t i_psi_buffer_used;
 
+    /* Live outputs only, compacted on removal */
     output_t **pp_outputs;
-    int i_nb_outputs;
+    int i_nb_outputs, i_max_outputs;
+    /* Membership of the first PID_MASK_OUTPUTS outputs, by output index */
+    uint64_t i_outputs_mask;
 } ts_pid_t;
 
 typedef struct sid_t
 {
     uint16_t i_sid, i_pmt_pid;
     uint8_t *p_current_pmt;
+
+    /* EIT schedule store, indexed by table_id and section_number */
+    uint8_t **ppp_eit_schedule[EIT_SCHEDULE_TABLES];
+    unsigned int i_eit_schedule_version;
 } sid_t;
 
-ts_pid_t p_pids[MAX_PIDS];
-static sid_t **pp_sids = NULL;
-static int i_nb_sids = 0;
-
-static PSI_TABLE_DECLARE(pp_current_pat_sections);
-static PSI_TABLE_DECLARE(pp_next_pat_sections);
-static PSI_TABLE_DECLARE(pp_current_cat_sections);
-static PSI_TABLE_DECLARE(pp_next_cat_sections);
-static PSI_TABLE_DECLARE(pp_current_nit_sections);
-static PSI_TABLE_DECLARE(pp_next_nit_sections);
-static PSI_TABLE_DECLARE(pp_current_sdt_sections);
-static PSI_TABLE_DECLARE(pp_next_sdt_sections);
-static mtime_t i_last_dts = -1;
-static int i_demux_fd;
-static int i_nb_errors = 0;
-static mtime_t i_last_error = 0;
+/* Index of the outputs carrying a given SID (only valid outputs) */
+#define SID_INDEX_SIZE 256
+#define PID_MASK_OUTPUTS 64
+typedef struct sid_outputs_t
+{
+    uint16_t i_sid;
+    output_t **pp_outputs;
+    int i_nb_outputs;
+    struct sid_outputs_t *p_next;
+} sid_outputs_t;
+
+/* Fixed-size slots for PSI sections, recycled per table type so that the
+ * steady-state PSI path doesn't allocate. The section follows the header. */
+#define SECTION_SLOT_SIZE (PSI_PRIVATE_MAX_SIZE + PSI_HEADER_SIZE)
+typedef struct section_slot_t
+{
+    struct section_slot_t *p_next;
+    unsigned int i_pool;
+    uint8_t p_section[SECTION_SLOT_SIZE];
+} section_slot_t;
+
+typedef struct section_pool_t
+{
+    section_slot_t *p_free;
+    section_pool_info_t info;
+} section_pool_t;
+
+/* Demux context of an input, see input_t */
+typedef struct demux_t
+{
+    int i_input;
+    int (*pf_SetFilter)( uint16_t i_pid );
+    void (*pf_UnsetFilter)( int i_fd, uint16_t i_pid );
+    void (*pf_Reset)( void );
+
+    ts_pid_t p_pids[MAX_PIDS];
+    sid_t **pp_sids;
+    int i_nb_sids;
+    sid_outputs_t *pp_sid_index[SID_INDEX_SIZE];
+
+    PSI_TABLE_DECLARE(pp_current_pat_sections);
+    PSI_TABLE_DECLARE(pp_next_pat_sections);
+    PSI_TABLE_DECLARE(pp_current_cat_sections);
+    PSI_TABLE_DECLARE(pp_next_cat_sections);
+    PSI_TABLE_DECLARE(pp_current_nit_sections);
+    PSI_TABLE_DECLARE(pp_next_nit_sections);
+    PSI_TABLE_DECLARE(pp_current_sdt_sections);
+    PSI_TABLE_DECLARE(pp_next_sdt_sections);
+    mtime_t i_last_dts;
+    int i_demux_fd;
+    int i_nb_errors;
+    bool b_backup_input;
+    bool b_main_tsid; /* outputs have the TSID of the main input */
+    mtime_t i_last_error;
+    mtime_t i_last_eit_carousel;
+    /* Bumped whenever PAT, CAT or a PMT changes, invalidating PID
+     * descriptions */
+    unsigned int i_psi_generation;
+    /* Bumped whenever NIT or SDT changes */
+    unsigned int i_si_generation;
+    /* Generations written to the PSI cache */
+    unsigned int i_saved_psi_generation, i_saved_si_generation;
+} demux_t;
+
+/* One context per input, and the one being handled */
+static demux_t **pp_demuxes = NULL;
+static demux_t *p_demux = NULL;
 static mtime_t i_last_reset = 0;
+static unsigned int i_eit_schedule_generation = 0;
+/* Stamped on PIDs when their statistics change, bumped by each sparse query */
+static uint32_t i_pids_generation = 1;
+static section_pool_t p_section_pools[SECTION_POOLS];
+
+/* PSI cache: a header, then records each followed by the packed sections of
+ * a table, in the order they must be handled (PAT first) */
+#define PSI_CACHE_MAGIC 0x50425644 /* "DVBP" */
+#define PSI_CACHE_VERSION 1
+typedef struct psi_cache_header_t
+{
+    uint32_t i_magic;
+    uint32_t i_version;
+    char psz_key[64];           /* Source the tables were received from */
+} psi_cache_header_t;
+
+typedef struct psi_cache_record_t
+{
+    uint16_t i_pid;
+    uint16_t i_reserved;
+    uint32_t i_size;
+} psi_cache_record_t;
+
+static const char *psz_psi_cache = NULL;
+static mtime_t i_last_psi_save = 0;
 
 #ifdef HAVE_ICONV
 static iconv_t iconv_handle = (iconv_t)-1;
@@ -126,10 +230,16 @@ static void UnselectPMT( uint16_t i_sid, uint16_t i_pid );
 static void GetPIDS( uint16_t **ppi_wanted_pids, int *pi_nb_wanted_pids,
                      uint16_t i_sid,
                      const uint16_t *pi_pids, int i_nb_pids );
+static void GetOutputPIDS( uint16_t **ppi_wanted_pids, int *pi_nb_wanted_pids,
+                           const uint16_t *pi_sids, int i_nb_sids,
+                           const uint16_t *pi_pids, int i_nb_pids );
+static int IsIn( const uint16_t *pi_pids, int i_nb_pids, uint16_t i_pid );
 static bool SIDIsSelected( uint16_t i_sid );
 static bool PIDWouldBeSelected( uint8_t *p_es );
 static bool PMTNeedsDescrambling( uint8_t *p_pmt );
 static void FlushEIT( output_t *p_output, mtime_t i_dts );
+static void SendEITCarousel( output_t *p_output, mtime_t i_elapsed );
+static void FreeEITSchedule( sid_t *p_sid );
 static void SendTDT( block_t *p_ts );
 static void SendEMM( block_t *p_ts );
 static void NewPAT( output_t *p_output );
@@ -138,6 +248,9 @@ static void NewNIT( output_t *p_output );
 static void NewSDT( output_t *p_output );
 static void HandlePSIPacket( uint8_t *p_ts, mtime_t i_dts );
 static const char *get_pid_desc(uint16_t i_pid, uint16_t *i_sid);
+static const char *GetPIDDesc( uint16_t i_pid, uint16_t *pi_sid );
+static bool ReportError( mtime_t *pi_last_report, unsigned int *pi_suppressed,
+                         unsigned int *pi_report_suppressed );
 
 /*
  * Remap an ES pid to a fixed value.
@@ -152,6 +265,10 @@ static uint16_t map_es_pid(output_t * p_output, uint8_t *p_es, uint16_t i_pid)
     if ( !b_do_remap && !p_output->config.b_do_remap )
         return i_pid;
 
+    /* MPTS outputs keep the original PIDs of all their services. */
+    if ( p_output->config.i_nb_sids )
+        return i_pid;
+
     msg_Dbg(NULL, "REMAP: Found elementary stream type 0x%02x with original PID 0x%x (%u):", i_stream_type, i_pid, i_pid);
 
     switch ( i_stream_type )
@@ -219,16 +336,316 @@ static uint16_t map_es_pid(output_t * p_output, uint8_t *p_es, uint16_t i_pid)
 
     /* Got the new base for the mapped pid. Find the next free one
        we do this to ensure that multiple audios get unique pids */
-    while (p_output->pi_freepids[i_newpid] != UNUSED_PID)
+    while (output_IsMappedPIDUsed(p_output, i_newpid))
         i_newpid++;
-    p_output->pi_freepids[i_newpid] = i_pid;  /* Mark as in use */
-    p_output->pi_newpids[i_pid] = i_newpid;   /* Save the new pid */
+    output_MapPID(p_output, i_pid, i_newpid);  /* Save the new pid */
 
     msg_Dbg(NULL, "REMAP: => Elementary stream is remapped to PID 0x%x (%u)", i_newpid, i_newpid);
 
     return i_newpid;
 }
 
+/*****************************************************************************
+ * Section pools
+ *****************************************************************************/
+static unsigned int SectionPool( uint16_t i_pid )
+{
+    switch ( i_pid )
+    {
+    case PAT_PID: return SECTION_POOL_PAT;
+    case CAT_PID: return SECTION_POOL_CAT;
+    case NIT_PID: return SECTION_POOL_NIT;
+    case SDT_PID: return SECTION_POOL_SDT;
+    case EIT_PID: return SECTION_POOL_EIT;
+    default:      return SECTION_POOL_PMT;
+    }
+}
+
+static uint8_t *SectionGet( unsigned int i_pool )
+{
+    section_pool_t *p_pool = &p_section_pools[i_pool];
+    section_slot_t *p_slot = p_pool->p_free;
+
+    if ( p_slot != NULL )
+    {
+        p_pool->p_free = p_slot->p_next;
+        p_pool->info.i_free--;
+        p_pool->info.i_recycled++;
+    }
+    else
+    {
+        p_slot = malloc( sizeof(section_slot_t) );
+        p_slot->i_pool = i_pool;
+        p_pool->info.i_allocs++;
+    }
+
+    p_pool->info.i_in_use++;
+    return p_slot->p_section;
+}
+
+static void SectionRelease( uint8_t *p_section )
+{
+    section_slot_t *p_slot;
+    section_pool_t *p_pool;
+
+    if ( p_section == NULL )
+        return;
+
+    p_slot = (section_slot_t *)(p_section
+                                 - offsetof(section_slot_t, p_section));
+    p_pool = &p_section_pools[p_slot->i_pool];
+    p_slot->p_next = p_pool->p_free;
+    p_pool->p_free = p_slot;
+    p_pool->info.i_in_use--;
+    p_pool->info.i_free++;
+    p_pool->info.i_released++;
+}
+
+static void SectionTableFree( uint8_t **pp_sections )
+{
+    int i;
+
+    for ( i = 0; i < PSI_TABLE_MAX_SECTIONS; i++ )
+    {
+        SectionRelease( pp_sections[i] );
+        pp_sections[i] = NULL;
+    }
+}
+
+/* Same as biTStream's table insertion, with pooled sections */
+static bool SectionTableAdd( uint8_t **pp_sections, uint8_t *p_section )
+{
+    uint8_t i_section = psi_get_section( p_section );
+    uint8_t i_last_section = psi_get_lastsection( p_section );
+    uint8_t i_version = psi_get_version( p_section );
+    uint16_t i_tableidext = psi_get_tableidext( p_section );
+    int i;
+
+    SectionRelease( pp_sections[i_section] );
+    pp_sections[i_section] = p_section;
+
+    for ( i = 0; i <= i_last_section; i++ )
+    {
+        uint8_t *p = pp_sections[i];
+        if ( p == NULL
+              || psi_get_lastsection( p ) != i_last_section
+              || psi_get_version( p ) != i_version
+              || psi_get_tableidext( p ) != i_tableidext )
+            return false;
+    }
+
+    /* Free spurious, invalid sections. */
+    for ( ; i < PSI_TABLE_MAX_SECTIONS; i++ )
+    {
+        SectionRelease( pp_sections[i] );
+        pp_sections[i] = NULL;
+    }
+    return true;
+}
+
+static void SectionAssembleReset( ts_pid_t *p_pid )
+{
+    SectionRelease( p_pid->p_psi_buffer );
+    p_pid->p_psi_buffer = NULL;
+    p_pid->i_psi_buffer_used = 0;
+}
+
+/* Same as biTStream's section assembly, with pooled sections */
+static uint8_t *SectionAssemble( uint16_t i_pid, const uint8_t **pp_payload,
+                                 uint8_t *pi_length )
+{
+    ts_pid_t *p_pid = &p_demux->p_pids[i_pid];
+    uint16_t i_remaining_size = SECTION_SLOT_SIZE - p_pid->i_psi_buffer_used;
+    uint16_t i_copy_size = *pi_length < i_remaining_size ?
+                           *pi_length : i_remaining_size;
+    uint8_t *p_section = NULL;
+
+    if ( p_pid->p_psi_buffer == NULL )
+    {
+        if ( **pp_payload == 0xff )
+        {
+            /* Padding table to the end of buffer */
+            *pi_length = 0;
+            return NULL;
+        }
+        p_pid->p_psi_buffer = SectionGet( SectionPool( i_pid ) );
+    }
+
+    memcpy( p_pid->p_psi_buffer + p_pid->i_psi_buffer_used, *pp_payload,
+            i_copy_size );
+    p_pid->i_psi_buffer_used += i_copy_size;
+
+    if ( p_pid->i_psi_buffer_used >= PSI_HEADER_SIZE )
+    {
+        uint16_t i_section_size = psi_get_length( p_pid->p_psi_buffer )
+                                   + PSI_HEADER_SIZE;
+
+        if ( i_section_size > SECTION_SLOT_SIZE )
+        {
+            /* Invalid section */
+            SectionAssembleReset( p_pid );
+            *pi_length = 0;
+            return NULL;
+        }
+        if ( i_section_size <= p_pid->i_psi_buffer_used )
+        {
+            p_section = p_pid->p_psi_buffer;
+            i_copy_size -= p_pid->i_psi_buffer_used - i_section_size;
+            p_pid->p_psi_buffer = NULL;
+            p_pid->i_psi_buffer_used = 0;
+        }
+    }
+
+    *pp_payload += i_copy_size;
+    *pi_length -= i_copy_size;
+    return p_section;
+}
+
+/*****************************************************************************
+ * SID index
+ *****************************************************************************/
+static sid_outputs_t *FindSIDOutputs( uint16_t i_sid )
+{
+    sid_outputs_t *p_entry = p_demux->pp_sid_index[i_sid % SID_INDEX_SIZE];
+
+    while ( p_entry != NULL && p_entry->i_sid != i_sid )
+        p_entry = p_entry->p_next;
+    return p_entry;
+}
+
+static void AddSIDOutput( uint16_t i_sid, output_t *p_output )
+{
+    sid_outputs_t *p_entry = FindSIDOutputs( i_sid );
+
+    if ( p_entry == NULL )
+    {
+        p_entry = malloc( sizeof(sid_outputs_t) );
+        p_entry->i_sid = i_sid;
+        p_entry->pp_outputs = NULL;
+        p_entry->i_nb_outputs = 0;
+        p_entry->p_next = p_demux->pp_sid_index[i_sid % SID_INDEX_SIZE];
+        p_demux->pp_sid_index[i_sid % SID_INDEX_SIZE] = p_entry;
+    }
+
+    p_entry->pp_outputs = realloc( p_entry->pp_outputs,
+                          (p_entry->i_nb_outputs + 1) * sizeof(output_t *) );
+    p_entry->pp_outputs[p_entry->i_nb_outputs++] = p_output;
+}
+
+static void DelSIDOutput( uint16_t i_sid, output_t *p_output )
+{
+    sid_outputs_t **pp_entry = &p_demux->pp_sid_index[i_sid % SID_INDEX_SIZE];
+    sid_outputs_t *p_entry;
+    int i;
+
+    while ( *pp_entry != NULL && (*pp_entry)->i_sid != i_sid )
+        pp_entry = &(*pp_entry)->p_next;
+    if ( (p_entry = *pp_entry) == NULL )
+        return;
+
+    for ( i = 0; i < p_entry->i_nb_outputs; i++ )
+        if ( p_entry->pp_outputs[i] == p_output )
+            break;
+    if ( i == p_entry->i_nb_outputs )
+        return;
+
+    /* Keep the order of the outputs, as if they were scanned linearly. */
+    memmove( &p_entry->pp_outputs[i], &p_entry->pp_outputs[i + 1],
+             (p_entry->i_nb_outputs - i - 1) * sizeof(output_t *) );
+    if ( !--p_entry->i_nb_outputs )
+    {
+        *pp_entry = p_entry->p_next;
+        free( p_entry->pp_outputs );
+        free( p_entry );
+    }
+}
+
+/* Returns the outputs carrying i_sid, or NULL */
+static output_t **GetSIDOutputs( uint16_t i_sid, int *pi_nb_outputs )
+{
+    sid_outputs_t *p_entry = FindSIDOutputs( i_sid );
+
+    if ( p_entry == NULL )
+    {
+        *pi_nb_outputs = 0;
+        return NULL;
+    }
+    *pi_nb_outputs = p_entry->i_nb_outputs;
+    return p_entry->pp_outputs;
+}
+
+/* Returns the services carried by an output: the SID list of an MPTS
+ * output, or its single SID */
+static const uint16_t *OutputSIDs( const output_config_t *p_config,
+                                   int *pi_nb_sids )
+{
+    if ( p_config->i_nb_sids )
+    {
+        *pi_nb_sids = p_config->i_nb_sids;
+        return p_config->pi_sids;
+    }
+    *pi_nb_sids = p_config->i_sid ? 1 : 0;
+    return &p_config->i_sid;
+}
+
+/*****************************************************************************
+ * MPTS services
+ *****************************************************************************/
+static output_service_t *FindOutputService( output_t *p_output,
+                                            uint16_t i_sid )
+{
+    int i;
+
+    for ( i = 0; i < p_output->config.i_nb_sids; i++ )
+        if ( p_output->p_services[i].i_sid == i_sid )
+            return &p_output->p_services[i];
+    return NULL;
+}
+
+/* Called when the SID list changes, keeps the state of remaining services */
+static void SetOutputServices( output_t *p_output, const uint16_t *pi_sids,
+                               int i_nb_sids )
+{
+    output_service_t *p_services = NULL;
+    int i;
+
+    if ( i_nb_sids )
+        p_services = malloc( i_nb_sids * sizeof(output_service_t) );
+
+    for ( i = 0; i < i_nb_sids; i++ )
+    {
+        output_service_t *p_service = FindOutputService( p_output,
+                                                         pi_sids[i] );
+        if ( p_service != NULL )
+        {
+            p_services[i] = *p_service;
+            p_service->p_pmt_section = NULL;
+            continue;
+        }
+
+        p_services[i].i_sid = pi_sids[i];
+        p_services[i].i_pmt_pid = 0;
+        p_services[i].p_pmt_section = NULL;
+        p_services[i].i_pmt_version = rand() & 0xff;
+        p_services[i].i_pmt_cc = rand() & 0xf;
+    }
+
+    for ( i = 0; i < p_output->config.i_nb_sids; i++ )
+        free( p_output->p_services[i].p_pmt_section );
+    free( p_output->p_services );
+    p_output->p_services = p_services;
+
+    free( p_output->config.pi_sids );
+    p_output->config.pi_sids = NULL;
+    if ( i_nb_sids )
+    {
+        p_output->config.pi_sids = malloc( i_nb_sids * sizeof(uint16_t) );
+        memcpy( p_output->config.pi_sids, pi_sids,
+                i_nb_sids * sizeof(uint16_t) );
+    }
+    p_output->config.i_nb_sids = i_nb_sids;
+}
+
 /*****************************************************************************
  * FindSID
  *****************************************************************************/
@@ -236,9 +653,9 @@ static inline sid_t *FindSID( uint16_t i_sid )
 {
     int i;
 
-    for ( i = 0; i < i_nb_sids; i++ )
+    for ( i = 0; i < p_demux->i_nb_sids; i++ )
     {
-        sid_t *p_sid = pp_sids[i];
+        sid_t *p_sid = p_demux->pp_sids[i];
         if ( p_sid->i_sid == i_sid )
             return p_sid;
     }
@@ -246,50 +663,70 @@ static inline sid_t *FindSID( uint16_t i_sid )
 }
 
 /*****************************************************************************
- * demux_Open
+ * OpenInput : open an input and set up its demux context
  *****************************************************************************/
-void demux_Open( void )
+static void OpenInput( int i_input )
 {
     int i;
 
-    memset( p_pids, 0, sizeof(p_pids) );
+    p_demux = malloc( sizeof(demux_t) );
+    memset( p_demux, 0, sizeof(demux_t) );
+    pp_demuxes[i_input] = p_demux;
+    p_demux->i_input = i_input;
+    p_demux->i_last_dts = -1;
+    p_demux->i_psi_generation = 1;
 
-    pf_Open();
+    if ( i_input == 0 )
+    {
+        pf_Open();
+        if ( psz_backup_src != NULL )
+            udp_Open();
+        p_demux->pf_SetFilter = pf_SetFilter;
+        p_demux->pf_UnsetFilter = pf_UnsetFilter;
+        p_demux->pf_Reset = pf_Reset;
+    }
+    else
+    {
+        p_inputs[i_input].p_udp = udp_OpenInput( p_inputs[i_input].psz_src );
+        p_demux->pf_SetFilter = udp_SetFilter;
+        p_demux->pf_UnsetFilter = udp_UnsetFilter;
+        p_demux->pf_Reset = udp_Reset;
+    }
 
     for ( i = 0; i < MAX_PIDS; i++ )
     {
-        p_pids[i].i_last_cc = -1;
-        p_pids[i].i_demux_fd = -1;
-        psi_assemble_init( &p_pids[i].p_psi_buffer,
-                           &p_pids[i].i_psi_buffer_used );
+        p_demux->p_pids[i].i_last_cc = -1;
+        p_demux->p_pids[i].i_demux_fd = -1;
+        psi_assemble_init( &p_demux->p_pids[i].p_psi_buffer,
+                           &p_demux->p_pids[i].i_psi_buffer_used );
     }
 
     if ( b_budget_mode )
-        i_demux_fd = pf_SetFilter(8192);
+        p_demux->i_demux_fd = p_demux->pf_SetFilter(8192);
 
-    psi_table_init( pp_current_pat_sections );
-    psi_table_init( pp_next_pat_sections );
+    psi_table_init( p_demux->pp_current_pat_sections );
+    psi_table_init( p_demux->pp_next_pat_sections );
     SetPID(PAT_PID);
-    p_pids[PAT_PID].i_psi_refcount++;
+    p_demux->p_pids[PAT_PID].i_psi_refcount++;
 
     if ( b_enable_emm )
     {
-        psi_table_init( pp_current_cat_sections );
-        psi_table_init( pp_next_cat_sections );
+        psi_table_init( p_demux->pp_current_cat_sections );
+        psi_table_init( p_demux->pp_next_cat_sections );
         SetPID_EMM(CAT_PID);
-        p_pids[CAT_PID].i_psi_refcount++;
+        p_demux->p_pids[CAT_PID].i_psi_refcount++;
     }
 
     SetPID(NIT_PID);
-    p_pids[NIT_PID].i_psi_refcount++;
+    p_demux->p_pids[NIT_PID].i_psi_refcount++;
 
-    psi_table_init( pp_current_sdt_sections );
-    psi_table_init( pp_next_sdt_sections );
+    psi_table_init( p_demux->pp_current_sdt_sections );
+    psi_table_init( p_demux->pp_next_sdt_sections );
     SetPID(SDT_PID);
-    p_pids[SDT_PID].i_psi_refcount++;
+    p_demux->p_pids[SDT_PID].i_psi_refcount++;
 
     SetPID(EIT_PID);
-    p_pids[EIT_PID].i_psi_refcount++;
+    p_demux->p_pids[EIT_PID].i_psi_refcount++;
 
     SetPID(RST_PID);
 
@@ -297,34 +734,112 @@ void demux_Open( void )
 }
 
 /*****************************************************************************
- * demux_Close
+ * CAAddPMT, CAUpdatePMT, CADeletePMT : the CAM only descrambles the main
+ * input
  *****************************************************************************/
-void demux_Close( void )
+static void CAAddPMT( uint8_t *p_pmt )
+{
+    if ( p_demux->i_input == 0 )
+        en50221_AddPMT( p_pmt );
+}
+
+static void CAUpdatePMT( uint8_t *p_pmt )
+{
+    if ( p_demux->i_input == 0 )
+        en50221_UpdatePMT( p_pmt );
+}
+
+static void CADeletePMT( uint8_t *p_pmt )
+{
+    if ( p_demux->i_input == 0 )
+        en50221_DeletePMT( p_pmt );
+}
+
+/*****************************************************************************
+ * demux_Open
+ *****************************************************************************/
+void demux_Open( void )
+{
+    int i;
+
+    pp_demuxes = malloc( i_nb_inputs * sizeof(demux_t *) );
+    for ( i = 0; i < i_nb_inputs; i++ )
+        OpenInput( i );
+}
+
+/*****************************************************************************
+ * CloseInput : free the demux context of an input
+ *****************************************************************************/
+static void CloseInput( demux_t *p_input )
 {
     int i;
 
-    psi_table_free( pp_current_pat_sections );
-    psi_table_free( pp_next_pat_sections );
-    psi_table_free( pp_current_cat_sections );
-    psi_table_free( pp_next_cat_sections );
-    psi_table_free( pp_current_nit_sections );
-    psi_table_free( pp_next_nit_sections );
-    psi_table_free( pp_current_sdt_sections );
-    psi_table_free( pp_next_sdt_sections );
+    p_demux = p_input;
+    SectionTableFree( p_demux->pp_current_pat_sections );
+    SectionTableFree( p_demux->pp_next_pat_sections );
+    SectionTableFree( p_demux->pp_current_cat_sections );
+    SectionTableFree( p_demux->pp_next_cat_sections );
+    SectionTableFree( p_demux->pp_current_nit_sections );
+    SectionTableFree( p_demux->pp_next_nit_sections );
+    SectionTableFree( p_demux->pp_current_sdt_sections );
+    SectionTableFree( p_demux->pp_next_sdt_sections );
 
     for ( i = 0; i < MAX_PIDS; i++ )
     {
-        free( p_pids[i].p_psi_buffer );
-        free( p_pids[i].pp_outputs );
+        SectionAssembleReset( &p_demux->p_pids[i] );
+        free( p_demux->p_pids[i].pp_outputs );
     }
 
-    for ( i = 0; i < i_nb_sids; i++ )
+    for ( i = 0; i < p_demux->i_nb_sids; i++ )
     {
-        sid_t *p_sid = pp_sids[i];
-        free( p_sid->p_current_pmt );
+        sid_t *p_sid = p_demux->pp_sids[i];
+        SectionRelease( p_sid->p_current_pmt );
+        FreeEITSchedule( p_sid );
         free( p_sid );
     }
-    free( pp_sids );
+    free( p_demux->pp_sids );
+
+    for ( i = 0; i < SID_INDEX_SIZE; i++ )
+    {
+        while ( p_demux->pp_sid_index[i] != NULL )
+        {
+            sid_outputs_t *p_entry = p_demux->pp_sid_index[i];
+            p_demux->pp_sid_index[i] = p_entry->p_next;
+            free( p_entry->pp_outputs );
+            free( p_entry );
+        }
+    }
+    free( p_demux );
+}
+
+/*****************************************************************************
+ * demux_Close
+ *****************************************************************************/
+void demux_Close( void )
+{
+    int i;
+
+    for ( i = 0; i < i_nb_inputs; i++ )
+        CloseInput( pp_demuxes[i] );
+    free( pp_demuxes );
+    pp_demuxes = NULL;
+    p_demux = NULL;
+
+    for ( i = 0; i < SECTION_POOLS; i++ )
+    {
+        section_pool_t *p_pool = &p_section_pools[i];
+
+        msg_Dbg( NULL, "section pool %d: %"PRIu64" allocations, %"PRIu64
+                 " recycled", i, p_pool->info.i_allocs,
+                 p_pool->info.i_recycled );
+        while ( p_pool->p_free != NULL )
+        {
+            section_slot_t *p_slot = p_pool->p_free;
+            p_pool->p_free = p_slot->p_next;
+            free( p_slot );
+        }
+        p_pool->info.i_free = 0;
+    }
 
 #ifdef HAVE_ICONV
     if (iconv_handle != (iconv_t)-1) {
@@ -337,8 +852,9 @@ void demux_Close( void )
 /*****************************************************************************
  * demux_Run
  *****************************************************************************/
-void demux_Run( block_t *p_ts )
+void demux_Run( int i_input, block_t *p_ts )
 {
+    p_demux = pp_demuxes[i_input];
     SetDTS( p_ts );
 
     while ( p_ts != NULL )
@@ -348,6 +864,59 @@ void demux_Run( block_t *p_ts )
         demux_Handle( p_ts );
         p_ts = p_next;
     }
+
+    if ( i_wallclock >= p_demux->i_last_eit_carousel + EIT_CAROUSEL_PERIOD )
+    {
+        mtime_t i_elapsed = p_demux->i_last_eit_carousel ?
+                            i_wallclock - p_demux->i_last_eit_carousel : 0;
+        int i;
+
+        for ( i = 0; i < i_nb_outputs; i++ )
+        {
+            output_t *p_output = pp_outputs[i];
+
+            if ( (p_output->config.i_config & OUTPUT_VALID)
+                  && p_output->config.i_input == p_demux->i_input
+                  && (p_output->config.i_config & OUTPUT_EPG)
+                  && p_output->config.i_epg_rate )
+                SendEITCarousel( p_output, i_elapsed );
+        }
+        p_demux->i_last_eit_carousel = i_wallclock;
+    }
+}
+
+/*****************************************************************************
+ * RemuxAdmit : statistical remux of i_nb_packets of i_pid for an output
+ *****************************************************************************/
+static bool RemuxAdmit( output_t *p_output, uint16_t i_pid, int i_class,
+                        int i_nb_packets, mtime_t i_dts )
+{
+    if ( output_Admit( p_output, i_class, i_nb_packets, i_dts ) )
+        return true;
+
+    p_demux->p_pids[i_pid].info.i_dropped += i_nb_packets;
+    p_demux->p_pids[i_pid].i_info_generation = i_pids_generation;
+    p_output->i_packets_dropped += i_nb_packets;
+    return false;
+}
+
+static int RemuxClass( output_t *p_output, uint16_t i_pid )
+{
+    uint16_t i_sid = 0;
+
+    if ( IsIn( p_output->config.pi_low_pids, p_output->config.i_nb_low_pids,
+               i_pid ) )
+        return REMUX_LOW;
+
+    if ( p_output->config.i_nb_low_sids )
+    {
+        GetPIDDesc( i_pid, &i_sid );
+        if ( i_sid && IsIn( p_output->config.pi_low_sids,
+                            p_output->config.i_nb_low_sids, i_sid ) )
+            return REMUX_LOW;
+    }
+
+    return REMUX_ESSENTIAL;
 }
 
 /*****************************************************************************
@@ -362,6 +931,7 @@ static void demux_Handle( block_t *p_ts )
     if ( !ts_validate( p_ts->p_ts ) )
     {
         msg_Warn( NULL, "lost TS sync" );
+        comm_Event( EVENT_TS_SYNC, i_pid, 0, 0, 0 );
         switch ( i_print_type )
         {
         case PRINT_XML:
@@ -379,86 +949,107 @@ static void demux_Handle( block_t *p_ts )
     }
 
     if ( i_pid != PADDING_PID )
-        p_pids[i_pid].info.i_scrambling = ts_get_scrambling( p_ts->p_ts );
+        p_demux->p_pids[i_pid].info.i_scrambling = ts_get_scrambling( p_ts->p_ts );
 
-    p_pids[i_pid].info.i_last_packet_ts = i_wallclock;
-    p_pids[i_pid].info.i_packets++;
+    p_demux->p_pids[i_pid].info.i_last_packet_ts = i_wallclock;
+    p_demux->p_pids[i_pid].info.i_packets++;
+    p_demux->p_pids[i_pid].i_info_generation = i_pids_generation;
 
-    p_pids[i_pid].i_packets_passed++;
+    p_demux->p_pids[i_pid].i_packets_passed++;
 
     /* Calculate bytes_per_sec */
-    if ( i_wallclock > p_pids[i_pid].i_bytes_ts + 1000000 ) {
-        p_pids[i_pid].info.i_bytes_per_sec = p_pids[i_pid].i_packets_passed * TS_SIZE;
-        p_pids[i_pid].i_packets_passed = 0;
-        p_pids[i_pid].i_bytes_ts = i_wallclock;
+    if ( i_wallclock > p_demux->p_pids[i_pid].i_bytes_ts + 1000000 ) {
+        p_demux->p_pids[i_pid].info.i_bytes_per_sec = p_demux->p_pids[i_pid].i_packets_passed * TS_SIZE;
+        p_demux->p_pids[i_pid].i_packets_passed = 0;
+        p_demux->p_pids[i_pid].i_bytes_ts = i_wallclock;
     }
 
-    if ( p_pids[i_pid].info.i_first_packet_ts == 0 )
-        p_pids[i_pid].info.i_first_packet_ts = i_wallclock;
+    if ( p_demux->p_pids[i_pid].info.i_first_packet_ts == 0 )
+        p_demux->p_pids[i_pid].info.i_first_packet_ts = i_wallclock;
 
-    if ( i_pid != PADDING_PID && p_pids[i_pid].i_last_cc != -1
-          && !ts_check_duplicate( i_cc, p_pids[i_pid].i_last_cc )
-          && ts_check_discontinuity( i_cc, p_pids[i_pid].i_last_cc ) )
+    if ( i_pid != PADDING_PID && p_demux->p_pids[i_pid].i_last_cc != -1
+          && !ts_check_duplicate( i_cc, p_demux->p_pids[i_pid].i_last_cc )
+          && ts_check_discontinuity( i_cc, p_demux->p_pids[i_pid].i_last_cc ) )
     {
-        unsigned int expected_cc = (p_pids[i_pid].i_last_cc + 1) & 0x0f;
+        unsigned int expected_cc = (p_demux->p_pids[i_pid].i_last_cc + 1) & 0x0f;
+        unsigned int i_suppressed;
         uint16_t i_sid = 0;
-        const char *pid_desc = get_pid_desc(i_pid, &i_sid);
-
-        p_pids[i_pid].info.i_cc_errors++;
+        const char *pid_desc = GetPIDDesc( i_pid, &i_sid );
 
-        msg_Warn( NULL, "TS discontinuity on pid %4hu expected_cc %2u got %2u (%s, sid %d)",
-                i_pid, expected_cc, i_cc, pid_desc, i_sid );
+        p_demux->p_pids[i_pid].info.i_cc_errors++;
+        p_ts->b_discontinuity = true;
+        comm_Event( EVENT_CC, i_pid, i_sid, expected_cc, i_cc );
 
-        switch ( i_print_type )
+        if ( ReportError( &p_demux->p_pids[i_pid].i_last_cc_report,
+                          &p_demux->p_pids[i_pid].i_cc_suppressed, &i_suppressed ) )
         {
-        case PRINT_XML:
-            printf("<ERROR type=\"invalid_discontinuity\" pid=\"%hu\" expected_cc=\"%u\" got_cc=\"%u\" pid_carries=\"%s\" sid=\"%u\" />\n",
-                   i_pid, expected_cc, i_cc, pid_desc, i_sid );
-            break;
-        case PRINT_TEXT:
-            printf("TS discontinuity (PID=%hu) (expected_cc=%u) (got_cc=%u) (PID_carries=%s) (sid=%d)\n",
-                   i_pid, expected_cc, i_cc, pid_desc, i_sid );
-            break;
-        default:
-            break;
+            msg_Warn( NULL, "TS discontinuity on pid %4hu expected_cc %2u got %2u (%s, sid %d)",
+                    i_pid, expected_cc, i_cc, pid_desc, i_sid );
+            if ( i_suppressed )
+                msg_Warn( NULL, "%u more discontinuities on pid %hu were not reported",
+                          i_suppressed, i_pid );
+
+            switch ( i_print_type )
+            {
+            case PRINT_XML:
+                printf("<ERROR type=\"invalid_discontinuity\" pid=\"%hu\" expected_cc=\"%u\" got_cc=\"%u\" pid_carries=\"%s\" sid=\"%u\" suppressed=\"%u\" />\n",
+                       i_pid, expected_cc, i_cc, pid_desc, i_sid, i_suppressed );
+                break;
+            case PRINT_TEXT:
+                printf("TS discontinuity (PID=%hu) (expected_cc=%u) (got_cc=%u) (PID_carries=%s) (sid=%d) (suppressed=%u)\n",
+                       i_pid, expected_cc, i_cc, pid_desc, i_sid, i_suppressed );
+                break;
+            default:
+                break;
+            }
         }
     }
 
     if ( ts_get_transporterror( p_ts->p_ts ) )
     {
+        unsigned int i_suppressed;
         uint16_t i_sid = 0;
-        const char *pid_desc = get_pid_desc(i_pid, &i_sid);
+        const char *pid_desc = GetPIDDesc( i_pid, &i_sid );
 
-        p_pids[i_pid].info.i_transport_errors++;
+        p_demux->p_pids[i_pid].info.i_transport_errors++;
+        comm_Event( EVENT_TRANSPORT_ERROR, i_pid, i_sid, 0, 0 );
 
-        msg_Warn( NULL, "transport_error_indicator on pid %hu (%s, sid %u)",
-                   i_pid, pid_desc, i_sid );
-        switch ( i_print_type )
+        if ( ReportError( &p_demux->p_pids[i_pid].i_last_te_report,
+                          &p_demux->p_pids[i_pid].i_te_suppressed, &i_suppressed ) )
         {
-        case PRINT_XML:
-            printf("<ERROR type=\"transport_error\" pid=\"%hu\" pid_carries=\"%s\" sid=\"%u\" />\n",
-                   i_pid, pid_desc, i_sid );
-            break;
-        case PRINT_TEXT:
-            printf("transport_error_indicator (PID=%hu) (PID_carries=%s) (sid=%u)\n",
-                   i_pid, pid_desc, i_sid );
-            break;
-        default:
-            break;
+            msg_Warn( NULL, "transport_error_indicator on pid %hu (%s, sid %u)",
+                       i_pid, pid_desc, i_sid );
+            if ( i_suppressed )
+                msg_Warn( NULL, "%u more transport errors on pid %hu were not reported",
+                          i_suppressed, i_pid );
+
+            switch ( i_print_type )
+            {
+            case PRINT_XML:
+                printf("<ERROR type=\"transport_error\" pid=\"%hu\" pid_carries=\"%s\" sid=\"%u\" suppressed=\"%u\" />\n",
+                       i_pid, pid_desc, i_sid, i_suppressed );
+                break;
+            case PRINT_TEXT:
+                printf("transport_error_indicator (PID=%hu) (PID_carries=%s) (sid=%u) (suppressed=%u)\n",
+                       i_pid, pid_desc, i_sid, i_suppressed );
+                break;
+            default:
+                break;
+            }
         }
 
-        i_nb_errors++;
-        i_last_error = i_wallclock;
+        p_demux->i_nb_errors++;
+        p_demux->i_last_error = i_wallclock;
     }
-    else if ( i_wallclock > i_last_error + WATCHDOG_WAIT )
-        i_nb_errors = 0;
+    else if ( i_wallclock > p_demux->i_last_error + WATCHDOG_WAIT )
+        p_demux->i_nb_errors = 0;
 
-    if ( i_nb_errors > MAX_ERRORS )
+    if ( p_demux->i_nb_errors > MAX_ERRORS )
     {
-        i_nb_errors = 0;
+        p_demux->i_nb_errors = 0;
         msg_Warn( NULL,
                  "too many transport errors, tuning again" );
-        pf_Reset();
+        p_demux->pf_Reset();
     }
 
     if ( !ts_get_transporterror( p_ts->p_ts ) )
@@ -466,10 +1057,10 @@ static void demux_Handle( block_t *p_ts )
         /* PSI parsing */
         if ( i_pid == TDT_PID || i_pid == RST_PID )
             SendTDT( p_ts );
-        else if ( p_pids[i_pid].i_psi_refcount )
+        else if ( p_demux->p_pids[i_pid].i_psi_refcount )
             HandlePSIPacket( p_ts->p_ts, p_ts->i_dts );
 
-        if ( b_enable_emm && p_pids[i_pid].b_emm )
+        if ( b_enable_emm && p_demux->p_pids[i_pid].b_emm )
             SendEMM( p_ts );
 
         /* PCR handling */
@@ -480,79 +1071,96 @@ static void demux_Handle( block_t *p_ts )
             mtime_t i_timestamp = tsaf_get_pcr( p_ts->p_ts );
             int j;
 
-            for ( j = 0; j < i_nb_sids; j++ )
+            for ( j = 0; j < p_demux->i_nb_sids; j++ )
             {
-                sid_t *p_sid = pp_sids[j];
+                sid_t *p_sid = p_demux->pp_sids[j];
                 if ( p_sid->i_sid && p_sid->p_current_pmt != NULL
                       && pmt_get_pcrpid( p_sid->p_current_pmt ) == i_pid )
                 {
-                    for ( i = 0; i < i_nb_outputs; i++ )
+                    int i_nb_sid_outputs;
+                    output_t **pp_sid_outputs =
+                        GetSIDOutputs( p_sid->i_sid, &i_nb_sid_outputs );
+
+                    for ( i = 0; i < i_nb_sid_outputs; i++ )
                     {
-                        output_t *p_output = pp_outputs[i];
-                        if ( p_output->config.i_sid == p_sid->i_sid )
-                        {
-                            p_output->i_ref_timestamp = i_timestamp;
-                            p_output->i_ref_wallclock = p_ts->i_dts;
-                        }
+                        output_t *p_output = pp_sid_outputs[i];
+
+                        /* An MPTS output follows the clock of its first
+                         * service only. */
+                        if ( p_output->config.i_sid != p_sid->i_sid )
+                            continue;
+                        p_output->i_ref_timestamp = i_timestamp;
+                        p_output->i_ref_wallclock = p_ts->i_dts;
                     }
                 }
             }
         }
     }
 
-    p_pids[i_pid].i_last_cc = i_cc;
+    p_demux->p_pids[i_pid].i_last_cc = i_cc;
 
     /* Output */
-    for ( i = 0; i < p_pids[i_pid].i_nb_outputs; i++ )
+    for ( i = 0; i < p_demux->p_pids[i_pid].i_nb_outputs; i++ )
     {
-        output_t *p_output = p_pids[i_pid].pp_outputs[i];
-        if ( p_output != NULL )
+        output_t *p_output = p_demux->p_pids[i_pid].pp_outputs[i];
+
+        if ( i_pid == PADDING_PID
+              && (p_output->config.i_config & OUTPUT_NONULL) )
         {
-            if ( i_ca_handle && (p_output->config.i_config & OUTPUT_WATCH) &&
-                 ts_get_unitstart( p_ts->p_ts ) )
-            {
-                uint8_t *p_payload;
+            p_output->i_null_saved += TS_SIZE;
+            continue;
+        }
 
-                if ( ts_get_scrambling( p_ts->p_ts ) ||
-                     ( p_pids[i_pid].b_pes
-                        && (p_payload = ts_payload( p_ts->p_ts )) + 3
-                             < p_ts->p_ts + TS_SIZE
-                          && !pes_validate(p_payload) ) )
-                {
-                    if ( i_wallclock >
-                            i_last_reset + WATCHDOG_REFRACTORY_PERIOD )
-                    {
-                        p_output->i_nb_errors++;
-                        p_output->i_last_error = i_wallclock;
-                    }
-                }
-                else if ( i_wallclock > p_output->i_last_error + WATCHDOG_WAIT )
-                    p_output->i_nb_errors = 0;
+        if ( i_ca_handle && p_demux->i_input == 0
+              && (p_output->config.i_config & OUTPUT_WATCH) &&
+             ts_get_unitstart( p_ts->p_ts ) )
+        {
+            uint8_t *p_payload;
 
-                if ( p_output->i_nb_errors > MAX_ERRORS )
+            if ( ts_get_scrambling( p_ts->p_ts ) ||
+                 ( p_demux->p_pids[i_pid].b_pes
+                    && (p_payload = ts_payload( p_ts->p_ts )) + 3
+                         < p_ts->p_ts + TS_SIZE
+                      && !pes_validate(p_payload) ) )
+            {
+                if ( i_wallclock >
+                        i_last_reset + WATCHDOG_REFRACTORY_PERIOD )
                 {
-                    int j;
-                    for ( j = 0; j < i_nb_outputs; j++ )
-                        pp_outputs[j]->i_nb_errors = 0;
-
-                    msg_Warn( NULL,
-                             "too many errors for stream %s, resetting",
-                             p_output->config.psz_displayname );
-                    i_last_reset = i_wallclock;
-                    en50221_Reset();
+                    p_output->i_nb_errors++;
+                    p_output->i_last_error = i_wallclock;
                 }
             }
+            else if ( i_wallclock > p_output->i_last_error + WATCHDOG_WAIT )
+                p_output->i_nb_errors = 0;
 
+            if ( p_output->i_nb_errors > MAX_ERRORS )
+            {
+                int j;
+                for ( j = 0; j < i_nb_outputs; j++ )
+                    pp_outputs[j]->i_nb_errors = 0;
+
+                msg_Warn( NULL,
+                         "too many errors for stream %s, resetting",
+                         p_output->config.psz_displayname );
+                i_last_reset = i_wallclock;
+                en50221_Reset();
+            }
+        }
+
+        if ( !(p_output->config.i_config & OUTPUT_STATMUX)
+              || RemuxAdmit( p_output, i_pid, RemuxClass( p_output, i_pid ),
+                             1, p_ts->i_dts ) )
             output_Put( p_output, p_ts );
 
-            if ( p_output->p_eit_ts_buffer != NULL
-                  && p_ts->i_dts > p_output->p_eit_ts_buffer->i_dts
-                                    + MAX_EIT_RETENTION )
-                FlushEIT( p_output, p_ts->i_dts );
-        }
+        if ( p_output->p_eit_ts_buffer != NULL
+              && p_ts->i_dts > p_output->p_eit_ts_buffer->i_dts
+                                + MAX_EIT_RETENTION )
+            FlushEIT( p_output, p_ts->i_dts );
     }
 
-    if ( output_dup.config.i_config & OUTPUT_VALID )
+    /* The duplicate is a copy of the main input only. */
+    if ( p_demux->i_input == 0
+          && (output_dup.config.i_config & OUTPUT_VALID) )
         output_Put( &output_dup, p_ts );
 
     p_ts->i_refcount--;
@@ -563,7 +1171,7 @@ static void demux_Handle( block_t *p_ts )
 /*****************************************************************************
  * demux_Change : called from main thread
  *****************************************************************************/
-static int IsIn( uint16_t *pi_pids, int i_nb_pids, uint16_t i_pid )
+static int IsIn( const uint16_t *pi_pids, int i_nb_pids, uint16_t i_pid )
 {
     int i;
     for ( i = 0; i < i_nb_pids; i++ )
@@ -576,20 +1184,26 @@ void demux_Change( output_t *p_output, const output_config_t *p_config )
     uint16_t *pi_wanted_pids, *pi_current_pids;
     int i_nb_wanted_pids, i_nb_current_pids;
 
-    uint16_t i_old_sid = p_output->config.i_sid;
-    uint16_t i_sid = p_config->i_sid;
+    int i_old_nb_sids, i_nb_sids;
+    const uint16_t *pi_old_sids = OutputSIDs( &p_output->config,
+                                              &i_old_nb_sids );
+    const uint16_t *pi_sids = OutputSIDs( p_config, &i_nb_sids );
     uint16_t *pi_old_pids = p_output->config.pi_pids;
     uint16_t *pi_pids = p_config->pi_pids;
     int i_old_nb_pids = p_output->config.i_nb_pids;
     int i_nb_pids = p_config->i_nb_pids;
 
-    bool b_sid_change = i_sid != i_old_sid;
+    bool b_sid_change = i_nb_sids != i_old_nb_sids ||
+        memcmp( pi_sids, pi_old_sids, i_nb_sids * sizeof(uint16_t) );
     bool b_pid_change = false, b_tsid_change = false;
     bool b_dvb_change = !!((p_output->config.i_config ^ p_config->i_config)
                              & OUTPUT_DVB);
     bool b_service_name_change =
         (!streq(p_output->config.psz_service_name, p_config->psz_service_name) ||
          !streq(p_output->config.psz_service_provider, p_config->psz_service_provider));
+    bool b_epg_change = p_output->config.i_epg_rate != p_config->i_epg_rate ||
+        p_output->config.i_epg_days != p_config->i_epg_days ||
+        ((p_output->config.i_config ^ p_config->i_config) & OUTPUT_EPG);
     bool b_remap_change = p_output->config.i_new_sid != p_config->i_new_sid ||
         p_output->config.b_do_remap != p_config->b_do_remap ||
         p_output->config.pi_confpids[I_PMTPID] != p_config->pi_confpids[I_PMTPID] ||
@@ -598,7 +1212,12 @@ void demux_Change( output_t *p_output, const output_config_t *p_config )
         p_output->config.pi_confpids[I_SPUPID] != p_config->pi_confpids[I_SPUPID];
     int i;
 
+    /* Outputs are closed and opened again when they change input. */
+    p_demux = pp_demuxes[p_config->i_input];
+    p_output->config.i_input = p_config->i_input;
     p_output->config.i_config = p_config->i_config;
+    p_output->config.i_epg_rate = p_config->i_epg_rate;
+    p_output->config.i_epg_days = p_config->i_epg_days;
     p_output->config.i_new_sid = p_config->i_new_sid;
     p_output->config.b_do_remap = p_config->b_do_remap;
     memcpy(p_output->config.pi_confpids, p_config->pi_confpids,
@@ -617,9 +1236,9 @@ void demux_Change( output_t *p_output, const output_config_t *p_config )
     }
     if ( p_config->i_tsid == -1 && p_output->config.i_tsid != -1 )
     {
-        if ( psi_table_validate(pp_current_pat_sections) && !b_random_tsid )
+        if ( psi_table_validate(p_demux->pp_current_pat_sections) && !b_random_tsid )
             p_output->i_tsid =
-                psi_table_get_tableidext(pp_current_pat_sections);
+                psi_table_get_tableidext(p_demux->pp_current_pat_sections);
         else
             p_output->i_tsid = rand() & 0xffff;
         b_tsid_change = true;
@@ -631,24 +1250,30 @@ void demux_Change( output_t *p_output, const output_config_t *p_config )
                    p_config->i_nb_pids * sizeof(uint16_t) )) )
         goto out_change;
 
-    GetPIDS( &pi_wanted_pids, &i_nb_wanted_pids, i_sid, pi_pids, i_nb_pids );
-    GetPIDS( &pi_current_pids, &i_nb_current_pids, i_old_sid, pi_old_pids,
-             i_old_nb_pids );
+    GetOutputPIDS( &pi_wanted_pids, &i_nb_wanted_pids, pi_sids, i_nb_sids,
+                   pi_pids, i_nb_pids );
+    GetOutputPIDS( &pi_current_pids, &i_nb_current_pids, pi_old_sids,
+                   i_old_nb_sids, pi_old_pids, i_old_nb_pids );
 
-    if ( b_sid_change && i_old_sid )
+    /* Services leaving the output */
+    for ( i = 0; i < i_old_nb_sids; i++ )
     {
-        sid_t *p_old_sid = FindSID( i_old_sid );
-        p_output->config.i_sid = p_config->i_sid;
+        uint16_t i_old_sid = pi_old_sids[i];
+        sid_t *p_old_sid;
+
+        if ( IsIn( pi_sids, i_nb_sids, i_old_sid ) )
+            continue;
 
+        DelSIDOutput( i_old_sid, p_output );
+        p_old_sid = FindSID( i_old_sid );
         if ( p_old_sid != NULL )
         {
-            if ( i_sid != i_old_sid )
-                UnselectPMT( i_old_sid, p_old_sid->i_pmt_pid );
+            UnselectPMT( i_old_sid, p_old_sid->i_pmt_pid );
 
             if ( i_ca_handle && !SIDIsSelected( i_old_sid )
                   && p_old_sid->p_current_pmt != NULL
                   && PMTNeedsDescrambling( p_old_sid->p_current_pmt ) )
-                en50221_DeletePMT( p_old_sid->p_current_pmt );
+                CADeletePMT( p_old_sid->p_current_pmt );
         }
     }
 
@@ -661,13 +1286,18 @@ void demux_Change( output_t *p_output, const output_config_t *p_config )
         }
     }
 
-    if ( b_sid_change && i_ca_handle && i_old_sid &&
-         SIDIsSelected( i_old_sid ) )
+    for ( i = 0; i < i_old_nb_sids && i_ca_handle; i++ )
     {
-        sid_t *p_old_sid = FindSID( i_old_sid );
+        sid_t *p_old_sid;
+
+        if ( IsIn( pi_sids, i_nb_sids, pi_old_sids[i] )
+              || !SIDIsSelected( pi_old_sids[i] ) )
+            continue;
+
+        p_old_sid = FindSID( pi_old_sids[i] );
         if ( p_old_sid != NULL && p_old_sid->p_current_pmt != NULL
               && PMTNeedsDescrambling( p_old_sid->p_current_pmt ) )
-            en50221_UpdatePMT( p_old_sid->p_current_pmt );
+            CAUpdatePMT( p_old_sid->p_current_pmt );
     }
 
     for ( i = 0; i < i_nb_wanted_pids; i++ )
@@ -682,38 +1312,61 @@ void demux_Change( output_t *p_output, const output_config_t *p_config )
     free( pi_wanted_pids );
     free( pi_current_pids );
 
-    if ( b_sid_change && i_sid )
+    /* Services joining the output, which is not indexed under them yet */
+    for ( i = 0; i < i_nb_sids; i++ )
     {
-        sid_t *p_sid = FindSID( i_sid );
-        p_output->config.i_sid = i_old_sid;
+        uint16_t i_sid = pi_sids[i];
+        sid_t *p_sid;
 
+        if ( IsIn( pi_old_sids, i_old_nb_sids, i_sid ) )
+            continue;
+
+        p_sid = FindSID( i_sid );
         if ( p_sid != NULL )
         {
-            if ( i_sid != i_old_sid )
-                SelectPMT( i_sid, p_sid->i_pmt_pid );
+            SelectPMT( i_sid, p_sid->i_pmt_pid );
 
             if ( i_ca_handle && !SIDIsSelected( i_sid )
                   && p_sid->p_current_pmt != NULL
                   && PMTNeedsDescrambling( p_sid->p_current_pmt ) )
-                en50221_AddPMT( p_sid->p_current_pmt );
+                CAAddPMT( p_sid->p_current_pmt );
         }
     }
 
-    if ( i_ca_handle && i_sid && SIDIsSelected( i_sid ) )
+    for ( i = 0; i < i_nb_sids && i_ca_handle; i++ )
     {
-        sid_t *p_sid = FindSID( i_sid );
+        sid_t *p_sid;
+
+        if ( !SIDIsSelected( pi_sids[i] ) )
+            continue;
+
+        p_sid = FindSID( pi_sids[i] );
         if ( p_sid != NULL && p_sid->p_current_pmt != NULL
               && PMTNeedsDescrambling( p_sid->p_current_pmt ) )
-            en50221_UpdatePMT( p_sid->p_current_pmt );
+            CAUpdatePMT( p_sid->p_current_pmt );
     }
 
-    p_output->config.i_sid = i_sid;
+    for ( i = 0; i < i_nb_sids; i++ )
+        if ( !IsIn( pi_old_sids, i_old_nb_sids, pi_sids[i] ) )
+            AddSIDOutput( pi_sids[i], p_output );
+
+    p_output->config.i_sid = p_config->i_sid;
+    SetOutputServices( p_output, p_config->pi_sids, p_config->i_nb_sids );
     free( p_output->config.pi_pids );
     p_output->config.pi_pids = malloc( sizeof(uint16_t) * i_nb_pids );
     memcpy( p_output->config.pi_pids, pi_pids, sizeof(uint16_t) * i_nb_pids );
     p_output->config.i_nb_pids = i_nb_pids;
 
 out_change:
+    if ( b_sid_change || b_remap_change || b_epg_change || b_tsid_change )
+    {
+        /* The carousel will be rebuilt from the store on the next tick. */
+        block_DeleteChain( p_output->p_eit_carousel );
+        p_output->p_eit_carousel = p_output->p_eit_carousel_next = NULL;
+        p_output->i_eit_carousel_version = 0;
+        p_output->i_eit_carousel_credit = 0;
+    }
+
     if ( b_sid_change || b_remap_change )
     {
         NewSDT( p_output );
@@ -743,6 +1396,40 @@ out_change:
     }
 }
 
+/*****************************************************************************
+ * demux_Detach : called from output_Close to drop the output from the index
+ *****************************************************************************/
+void demux_Detach( output_t *p_output )
+{
+    int i, i_nb_sids;
+    const uint16_t *pi_sids = OutputSIDs( &p_output->config, &i_nb_sids );
+
+    p_demux = pp_demuxes[p_output->config.i_input];
+    for ( i = 0; i < i_nb_sids; i++ )
+        DelSIDOutput( pi_sids[i], p_output );
+    p_output->config.i_sid = 0;
+    SetOutputServices( p_output, NULL, 0 );
+}
+
+/*****************************************************************************
+ * demux_SwitchInput : called from the main thread when the input is switched
+ * to or from the backup input
+ *****************************************************************************/
+void demux_SwitchInput( bool b_backup )
+{
+    int i;
+
+    p_demux = pp_demuxes[0];
+    /* The inputs have unrelated continuity counters, and sections cut in
+     * the middle. Outputs with /cc will hide the jump. */
+    for ( i = 0; i < MAX_PIDS; i++ )
+    {
+        p_demux->p_pids[i].i_last_cc = -1;
+        SectionAssembleReset( &p_demux->p_pids[i] );
+    }
+    p_demux->b_backup_input = b_backup;
+}
+
 /*****************************************************************************
  * SetDTS
  *****************************************************************************/
@@ -760,10 +1447,10 @@ static void SetDTS( block_t *p_list )
 
     /* We suppose the stream is CBR, at least between two consecutive read().
      * This is especially true in budget mode */
-    if ( i_last_dts == -1 )
+    if ( p_demux->i_last_dts == -1 )
         i_duration = 0;
     else
-        i_duration = i_wallclock - i_last_dts;
+        i_duration = i_wallclock - p_demux->i_last_dts;
 
     p_ts = p_list;
     i = i_nb_ts - 1;
@@ -774,7 +1461,7 @@ static void SetDTS( block_t *p_list )
         p_ts = p_ts->p_next;
     }
 
-    i_last_dts = i_wallclock;
+    p_demux->i_last_dts = i_wallclock;
 }
 
 /*****************************************************************************
@@ -782,105 +1469,138 @@ static void SetDTS( block_t *p_list )
  *****************************************************************************/
 static void SetPID( uint16_t i_pid )
 {
-    p_pids[i_pid].i_refcount++;
+    p_demux->p_pids[i_pid].i_refcount++;
 
-    if ( !b_budget_mode && p_pids[i_pid].i_refcount
-          && p_pids[i_pid].i_demux_fd == -1 )
-        p_pids[i_pid].i_demux_fd = pf_SetFilter( i_pid );
+    if ( !b_budget_mode && p_demux->p_pids[i_pid].i_refcount
+          && p_demux->p_pids[i_pid].i_demux_fd == -1 )
+        p_demux->p_pids[i_pid].i_demux_fd = p_demux->pf_SetFilter( i_pid );
 }
 
 static void SetPID_EMM( uint16_t i_pid )
 {
     SetPID( i_pid );
-    p_pids[i_pid].b_emm = true;
+    p_demux->p_pids[i_pid].b_emm = true;
 }
 
 static void UnsetPID( uint16_t i_pid )
 {
-    p_pids[i_pid].i_refcount--;
+    p_demux->p_pids[i_pid].i_refcount--;
 
-    if ( !b_budget_mode && !p_pids[i_pid].i_refcount
-          && p_pids[i_pid].i_demux_fd != -1 )
+    if ( !b_budget_mode && !p_demux->p_pids[i_pid].i_refcount
+          && p_demux->p_pids[i_pid].i_demux_fd != -1 )
     {
-        pf_UnsetFilter( p_pids[i_pid].i_demux_fd, i_pid );
-        p_pids[i_pid].i_demux_fd = -1;
-        p_pids[i_pid].b_emm = false;
+        p_demux->pf_UnsetFilter( p_demux->p_pids[i_pid].i_demux_fd, i_pid );
+        p_demux->p_pids[i_pid].i_demux_fd = -1;
+        p_demux->p_pids[i_pid].b_emm = false;
     }
 }
 
 /*****************************************************************************
  * StartPID/StopPID
  *****************************************************************************/
-static void StartPID( output_t *p_output, uint16_t i_pid )
+static int FindPIDOutput( output_t *p_output, uint16_t i_pid )
 {
+    ts_pid_t *p_pid = &p_demux->p_pids[i_pid];
     int j;
 
-    for ( j = 0; j < p_pids[i_pid].i_nb_outputs; j++ )
-        if ( p_pids[i_pid].pp_outputs[j] == p_output )
-            break;
+    if ( p_output->i_index < PID_MASK_OUTPUTS
+          && !(p_pid->i_outputs_mask & (UINT64_C(1) << p_output->i_index)) )
+        return -1;
 
-    if ( j == p_pids[i_pid].i_nb_outputs )
-    {
-        for ( j = 0; j < p_pids[i_pid].i_nb_outputs; j++ )
-            if ( p_pids[i_pid].pp_outputs[j] == NULL )
-                break;
+    for ( j = 0; j < p_pid->i_nb_outputs; j++ )
+        if ( p_pid->pp_outputs[j] == p_output )
+            return j;
+    return -1;
+}
 
-        if ( j == p_pids[i_pid].i_nb_outputs )
-        {
-            p_pids[i_pid].i_nb_outputs++;
-            p_pids[i_pid].pp_outputs = realloc( p_pids[i_pid].pp_outputs,
-                                                sizeof(output_t *)
-                                                * p_pids[i_pid].i_nb_outputs );
-        }
+static void StartPID( output_t *p_output, uint16_t i_pid )
+{
+    ts_pid_t *p_pid = &p_demux->p_pids[i_pid];
 
-        p_pids[i_pid].pp_outputs[j] = p_output;
-        SetPID( i_pid );
+    if ( FindPIDOutput( p_output, i_pid ) != -1 )
+        return;
+
+    if ( p_pid->i_nb_outputs == p_pid->i_max_outputs )
+    {
+        p_pid->i_max_outputs = p_pid->i_max_outputs ?
+                               p_pid->i_max_outputs * 2 : 4;
+        p_pid->pp_outputs = realloc( p_pid->pp_outputs,
+                                     sizeof(output_t *) * p_pid->i_max_outputs );
     }
+
+    p_pid->pp_outputs[p_pid->i_nb_outputs++] = p_output;
+    if ( p_output->i_index < PID_MASK_OUTPUTS )
+        p_pid->i_outputs_mask |= UINT64_C(1) << p_output->i_index;
+    SetPID( i_pid );
 }
 
 static void StopPID( output_t *p_output, uint16_t i_pid )
 {
-    int j;
+    ts_pid_t *p_pid = &p_demux->p_pids[i_pid];
+    int j = FindPIDOutput( p_output, i_pid );
 
-    for ( j = 0; j < p_pids[i_pid].i_nb_outputs; j++ )
-    {
-        if ( p_pids[i_pid].pp_outputs[j] != NULL )
-        {
-            if ( p_pids[i_pid].pp_outputs[j] == p_output )
-                break;
-        }
-    }
+    if ( j == -1 )
+        return;
 
-    if ( j != p_pids[i_pid].i_nb_outputs )
-    {
-        p_pids[i_pid].pp_outputs[j] = NULL;
-        UnsetPID( i_pid );
-    }
+    /* Swap with the last entry so that the fan-out list has no holes. */
+    p_pid->pp_outputs[j] = p_pid->pp_outputs[--p_pid->i_nb_outputs];
+    if ( p_output->i_index < PID_MASK_OUTPUTS )
+        p_pid->i_outputs_mask &= ~(UINT64_C(1) << p_output->i_index);
+    UnsetPID( i_pid );
 }
 
 /*****************************************************************************
  * SelectPID/UnselectPID
  *****************************************************************************/
-static void SelectPID( uint16_t i_sid, uint16_t i_pid )
+/* Several services of an MPTS output may share a PID, such as the PCR. */
+static bool OutputServiceWantsPID( output_t *p_output, uint16_t i_sid,
+                                   uint16_t i_pid )
 {
     int i;
 
-    for ( i = 0; i < i_nb_outputs; i++ )
-        if ( (pp_outputs[i]->config.i_config & OUTPUT_VALID)
-              && pp_outputs[i]->config.i_sid == i_sid
-              && !pp_outputs[i]->config.i_nb_pids )
-            StartPID( pp_outputs[i], i_pid );
+    for ( i = 0; i < p_output->config.i_nb_sids; i++ )
+    {
+        sid_t *p_sid;
+        uint8_t *p_es;
+        uint8_t j = 0;
+
+        if ( p_output->config.pi_sids[i] == i_sid )
+            continue;
+        p_sid = FindSID( p_output->config.pi_sids[i] );
+        if ( p_sid == NULL || p_sid->p_current_pmt == NULL )
+            continue;
+
+        if ( pmt_get_pcrpid( p_sid->p_current_pmt ) == i_pid )
+            return true;
+        while ( (p_es = pmt_get_es( p_sid->p_current_pmt, j )) != NULL )
+        {
+            j++;
+            if ( pmtn_get_pid( p_es ) == i_pid && PIDWouldBeSelected( p_es ) )
+                return true;
+        }
+    }
+    return false;
+}
+
+static void SelectPID( uint16_t i_sid, uint16_t i_pid )
+{
+    int i, i_nb_sid_outputs;
+    output_t **pp_sid_outputs = GetSIDOutputs( i_sid, &i_nb_sid_outputs );
+
+    for ( i = 0; i < i_nb_sid_outputs; i++ )
+        if ( !pp_sid_outputs[i]->config.i_nb_pids )
+            StartPID( pp_sid_outputs[i], i_pid );
 }
 
 static void UnselectPID( uint16_t i_sid, uint16_t i_pid )
 {
-    int i;
+    int i, i_nb_sid_outputs;
+    output_t **pp_sid_outputs = GetSIDOutputs( i_sid, &i_nb_sid_outputs );
 
-    for ( i = 0; i < i_nb_outputs; i++ )
-        if ( (pp_outputs[i]->config.i_config & OUTPUT_VALID)
-              && pp_outputs[i]->config.i_sid == i_sid
-              && !pp_outputs[i]->config.i_nb_pids )
-            StopPID( pp_outputs[i], i_pid );
+    for ( i = 0; i < i_nb_sid_outputs; i++ )
+        if ( !pp_sid_outputs[i]->config.i_nb_pids
+              && !OutputServiceWantsPID( pp_sid_outputs[i], i_sid, i_pid ) )
+            StopPID( pp_sid_outputs[i], i_pid );
 }
 
 /*****************************************************************************
@@ -888,34 +1608,37 @@ static void UnselectPID( uint16_t i_sid, uint16_t i_pid )
  *****************************************************************************/
 static void SelectPMT( uint16_t i_sid, uint16_t i_pid )
 {
-    int i;
+    int i, i_nb_sid_outputs;
 
-    p_pids[i_pid].i_psi_refcount++;
-    p_pids[i_pid].b_pes = false;
+    p_demux->p_pids[i_pid].i_psi_refcount++;
+    p_demux->p_pids[i_pid].b_pes = false;
 
     if ( b_select_pmts )
         SetPID( i_pid );
-    else for ( i = 0; i < i_nb_outputs; i++ )
-        if ( (pp_outputs[i]->config.i_config & OUTPUT_VALID)
-              && pp_outputs[i]->config.i_sid == i_sid )
+    else
+    {
+        GetSIDOutputs( i_sid, &i_nb_sid_outputs );
+        for ( i = 0; i < i_nb_sid_outputs; i++ )
             SetPID( i_pid );
+    }
 }
 
 static void UnselectPMT( uint16_t i_sid, uint16_t i_pid )
 {
-    int i;
+    int i, i_nb_sid_outputs;
 
-    p_pids[i_pid].i_psi_refcount--;
-    if ( !p_pids[i_pid].i_psi_refcount )
-        psi_assemble_reset( &p_pids[i_pid].p_psi_buffer,
-                            &p_pids[i_pid].i_psi_buffer_used );
+    p_demux->p_pids[i_pid].i_psi_refcount--;
+    if ( !p_demux->p_pids[i_pid].i_psi_refcount )
+        SectionAssembleReset( &p_demux->p_pids[i_pid] );
 
     if ( b_select_pmts )
         UnsetPID( i_pid );
-    else for ( i = 0; i < i_nb_outputs; i++ )
-        if ( (pp_outputs[i]->config.i_config & OUTPUT_VALID)
-              && pp_outputs[i]->config.i_sid == i_sid )
+    else
+    {
+        GetSIDOutputs( i_sid, &i_nb_sid_outputs );
+        for ( i = 0; i < i_nb_sid_outputs; i++ )
             UnsetPID( i_pid );
+    }
 }
 
 /*****************************************************************************
@@ -975,6 +1698,41 @@ static void GetPIDS( uint16_t **ppi_wanted_pids, int *pi_nb_wanted_pids,
     }
 }
 
+/* Union of the PIDs of all the services carried by an output */
+static void GetOutputPIDS( uint16_t **ppi_wanted_pids, int *pi_nb_wanted_pids,
+                           const uint16_t *pi_sids, int i_nb_sids,
+                           const uint16_t *pi_pids, int i_nb_pids )
+{
+    int i, j;
+
+    if ( i_nb_sids <= 1 )
+    {
+        GetPIDS( ppi_wanted_pids, pi_nb_wanted_pids,
+                 i_nb_sids ? pi_sids[0] : 0, pi_pids, i_nb_pids );
+        return;
+    }
+
+    *pi_nb_wanted_pids = 0;
+    *ppi_wanted_pids = NULL;
+
+    for ( i = 0; i < i_nb_sids; i++ )
+    {
+        uint16_t *pi_sid_pids;
+        int i_nb_sid_pids;
+
+        GetPIDS( &pi_sid_pids, &i_nb_sid_pids, pi_sids[i], NULL, 0 );
+        for ( j = 0; j < i_nb_sid_pids; j++ )
+        {
+            if ( IsIn( *ppi_wanted_pids, *pi_nb_wanted_pids, pi_sid_pids[j] ) )
+                continue;
+            *ppi_wanted_pids = realloc( *ppi_wanted_pids,
+                                  (*pi_nb_wanted_pids + 1) * sizeof(uint16_t) );
+            (*ppi_wanted_pids)[(*pi_nb_wanted_pids)++] = pi_sid_pids[j];
+        }
+        free( pi_sid_pids );
+    }
+}
+
 /*****************************************************************************
  * OutputPSISection
  *****************************************************************************/
@@ -986,6 +1744,28 @@ static void OutputPSISection( output_t *p_output, uint8_t *p_section,
     uint16_t i_section_length = psi_get_length(p_section) + PSI_HEADER_SIZE;
     uint16_t i_section_offset = 0;
 
+    if ( p_output->config.i_config & OUTPUT_STATMUX )
+    {
+        /* Whole sections are dropped, so that the others stay valid.
+         * Without PAT, CAT and PMT the services can't be decoded. */
+        uint8_t i_table_id = psi_get_tableid( p_section );
+        int i_class;
+
+        if ( i_table_id == PAT_TABLE_ID || i_table_id == CAT_TABLE_ID
+              || i_table_id == PMT_TABLE_ID )
+            i_class = REMUX_ESSENTIAL;
+        else if ( i_table_id >= EIT_TABLE_ID_SCHED_ACTUAL_FIRST
+                   && i_table_id <= EIT_TABLE_ID_SCHED_ACTUAL_LAST )
+            i_class = REMUX_EIT_SCHEDULE;
+        else
+            i_class = REMUX_SI;
+
+        if ( !RemuxAdmit( p_output, i_pid, i_class,
+                          i_section_length / (TS_SIZE - TS_HEADER_SIZE) + 1,
+                          i_dts ) )
+            return;
+    }
+
     do
     {
         block_t *p_block;
@@ -1052,11 +1832,12 @@ static void SendPAT( mtime_t i_dts )
     {
         output_t *p_output = pp_outputs[i];
 
-        if ( !(p_output->config.i_config & OUTPUT_VALID) )
+        if ( !(p_output->config.i_config & OUTPUT_VALID)
+              || p_output->config.i_input != p_demux->i_input )
             continue;
 
         if ( p_output->p_pat_section == NULL &&
-             psi_table_validate(pp_current_pat_sections) )
+             psi_table_validate(p_demux->pp_current_pat_sections) )
         {
             /* SID doesn't exist - build an empty PAT. */
             uint8_t *p;
@@ -1083,21 +1864,49 @@ static void SendPAT( mtime_t i_dts )
 /*****************************************************************************
  * SendPMT
  *****************************************************************************/
-static void SendPMT( sid_t *p_sid, mtime_t i_dts )
+static void SendServicePMT( output_t *p_output, sid_t *p_sid, mtime_t i_dts )
 {
+    output_service_t *p_service = FindOutputService( p_output, p_sid->i_sid );
+    uint8_t *pi_cc;
     int i;
+
+    if ( p_service == NULL || p_service->p_pmt_section == NULL )
+        return;
+
+    /* Services sharing a PMT PID must share its continuity counter. */
+    pi_cc = &p_service->i_pmt_cc;
+    for ( i = 0; i < p_output->config.i_nb_sids; i++ )
+        if ( p_output->p_services[i].i_pmt_pid == p_service->i_pmt_pid )
+        {
+            pi_cc = &p_output->p_services[i].i_pmt_cc;
+            break;
+        }
+
+    OutputPSISection( p_output, p_service->p_pmt_section,
+                      p_service->i_pmt_pid, pi_cc, i_dts, NULL, NULL );
+}
+
+static void SendPMT( sid_t *p_sid, mtime_t i_dts )
+{
+    int i, i_nb_sid_outputs;
     int i_pmt_pid = p_sid->i_pmt_pid;
+    output_t **pp_sid_outputs = GetSIDOutputs( p_sid->i_sid,
+                                               &i_nb_sid_outputs );
 
     if ( b_do_remap )
         i_pmt_pid = pi_newpids[ I_PMTPID ];
 
-    for ( i = 0; i < i_nb_outputs; i++ )
+    for ( i = 0; i < i_nb_sid_outputs; i++ )
     {
-        output_t *p_output = pp_outputs[i];
+        output_t *p_output = pp_sid_outputs[i];
 
-        if ( (p_output->config.i_config & OUTPUT_VALID)
-               && p_output->config.i_sid == p_sid->i_sid
-               && p_output->p_pmt_section != NULL )
+        if ( p_output->config.i_nb_sids )
+        {
+            SendServicePMT( p_output, p_sid, i_dts );
+            continue;
+        }
+
+        if ( p_output->p_pmt_section != NULL )
         {
             if ( p_output->config.b_do_remap && p_output->config.pi_confpids[I_PMTPID] )
                 i_pmt_pid = p_output->config.pi_confpids[I_PMTPID];
@@ -1121,6 +1930,7 @@ static void SendNIT( mtime_t i_dts )
         output_t *p_output = pp_outputs[i];
 
         if ( (p_output->config.i_config & OUTPUT_VALID)
+               && p_output->config.i_input == p_demux->i_input
                && (p_output->config.i_config & OUTPUT_DVB)
                && p_output->p_nit_section != NULL )
             OutputPSISection( p_output, p_output->p_nit_section, NIT_PID,
@@ -1133,16 +1943,19 @@ static void SendNIT( mtime_t i_dts )
  *****************************************************************************/
 static void SendSDT( mtime_t i_dts )
 {
-    int i;
+    int i, j;
 
     for ( i = 0; i < i_nb_outputs; i++ )
     {
         output_t *p_output = pp_outputs[i];
 
-        if ( (p_output->config.i_config & OUTPUT_VALID)
-               && (p_output->config.i_config & OUTPUT_DVB)
-               && p_output->p_sdt_section != NULL )
-            OutputPSISection( p_output, p_output->p_sdt_section, SDT_PID,
+        if ( !(p_output->config.i_config & OUTPUT_VALID)
+               || p_output->config.i_input != p_demux->i_input
+               || !(p_output->config.i_config & OUTPUT_DVB) )
+            continue;
+
+        for ( j = 0; j < p_output->i_nb_sdt_sections; j++ )
+            OutputPSISection( p_output, p_output->pp_sdt_sections[j], SDT_PID,
                               &p_output->i_sdt_cc, i_dts, NULL, NULL );
     }
 }
@@ -1155,23 +1968,24 @@ static void SendEIT( sid_t *p_sid, mtime_t i_dts, uint8_t *p_eit )
     uint8_t i_table_id = psi_get_tableid( p_eit );
     bool b_epg = i_table_id >= EIT_TABLE_ID_SCHED_ACTUAL_FIRST &&
                  i_table_id <= EIT_TABLE_ID_SCHED_ACTUAL_LAST;
-    int i;
+    int i, i_nb_sid_outputs;
+    output_t **pp_sid_outputs = GetSIDOutputs( p_sid->i_sid,
+                                               &i_nb_sid_outputs );
 
-    for ( i = 0; i < i_nb_outputs; i++ )
+    for ( i = 0; i < i_nb_sid_outputs; i++ )
     {
-        output_t *p_output = pp_outputs[i];
+        output_t *p_output = pp_sid_outputs[i];
 
-        if ( (p_output->config.i_config & OUTPUT_VALID)
-               && (p_output->config.i_config & OUTPUT_DVB)
-               && (!b_epg || (p_output->config.i_config & OUTPUT_EPG))
-               && p_output->config.i_sid == p_sid->i_sid )
+        if ( (p_output->config.i_config & OUTPUT_DVB)
+               && (!b_epg || ((p_output->config.i_config & OUTPUT_EPG)
+                               && !p_output->config.i_epg_rate)) )
         {
             eit_set_tsid( p_eit, p_output->i_tsid );
 
             if ( p_output->config.i_new_sid )
                 eit_set_sid( p_eit, p_output->config.i_new_sid );
             else
-                eit_set_sid( p_eit, p_output->config.i_sid );
+                eit_set_sid( p_eit, p_sid->i_sid );
 
             psi_set_crc( p_eit );
 
@@ -1210,6 +2024,168 @@ static void FlushEIT( output_t *p_output, mtime_t i_dts )
     p_output->i_eit_ts_buffer_offset = 0;
 }
 
+/*****************************************************************************
+ * BuildEITCarousel : packetize the stored schedule for a given output
+ *****************************************************************************/
+static block_t **PacketizeSection( block_t **pp_last, uint8_t *p_section,
+                                   uint16_t i_pid )
+{
+    uint16_t i_section_length = psi_get_length(p_section) + PSI_HEADER_SIZE;
+    uint16_t i_section_offset = 0;
+
+    do
+    {
+        block_t *p_block = block_New();
+        uint8_t i_ts_offset = 0;
+
+        psi_split_section( p_block->p_ts, &i_ts_offset, p_section,
+                           &i_section_offset );
+        ts_set_pid( p_block->p_ts, i_pid );
+        if ( i_section_offset == i_section_length )
+            psi_split_end( p_block->p_ts, &i_ts_offset );
+
+        *pp_last = p_block;
+        pp_last = &p_block->p_next;
+    }
+    while ( i_section_offset < i_section_length );
+
+    return pp_last;
+}
+
+static void BuildEITCarousel( output_t *p_output, sid_t *p_sid )
+{
+    int i_max_segments = p_output->config.i_epg_days ?
+            p_output->config.i_epg_days * EIT_SEGMENTS_PER_DAY :
+            EIT_SCHEDULE_TABLES * EIT_SEGMENTS_PER_TABLE;
+    uint8_t i_last_table_id = EIT_TABLE_ID_SCHED_ACTUAL_FIRST
+            + (i_max_segments - 1) / EIT_SEGMENTS_PER_TABLE;
+    block_t *p_first = NULL, **pp_last = &p_first;
+    uint8_t *p_eit = NULL;
+    int i, j, i_nb_packets = 0;
+
+    block_DeleteChain( p_output->p_eit_carousel );
+
+    for ( i = 0; i < EIT_SCHEDULE_TABLES; i++ )
+    {
+        uint8_t **pp_sections = p_sid->ppp_eit_schedule[i];
+        if ( pp_sections == NULL )
+            continue;
+
+        for ( j = 0; j < PSI_TABLE_MAX_SECTIONS; j++ )
+        {
+            if ( i * EIT_SEGMENTS_PER_TABLE + j / EIT_SECTIONS_PER_SEGMENT
+                   >= i_max_segments )
+                break;
+            if ( pp_sections[j] == NULL )
+                continue;
+
+            if ( p_eit == NULL )
+                p_eit = psi_allocate();
+            psi_copy( p_eit, pp_sections[j] );
+
+            eit_set_tsid( p_eit, p_output->i_tsid );
+            if ( p_output->config.i_new_sid )
+                eit_set_sid( p_eit, p_output->config.i_new_sid );
+            else
+                eit_set_sid( p_eit, p_output->config.i_sid );
+            if ( eit_get_last_table_id( p_eit ) > i_last_table_id )
+                eit_set_last_table_id( p_eit, i_last_table_id );
+            psi_set_crc( p_eit );
+
+            pp_last = PacketizeSection( pp_last, p_eit, EIT_PID );
+        }
+    }
+    free( p_eit );
+
+    p_output->p_eit_carousel = p_output->p_eit_carousel_next = p_first;
+    p_output->i_eit_carousel_version = p_sid->i_eit_schedule_version;
+
+    for ( ; p_first != NULL; p_first = p_first->p_next )
+        i_nb_packets++;
+    msg_Dbg( NULL, "EIT carousel for %s: %d packets (%"PRId64" s cycle)",
+             p_output->config.psz_displayname, i_nb_packets,
+             (int64_t)i_nb_packets * TS_SIZE * 8
+                / p_output->config.i_epg_rate );
+}
+
+/*****************************************************************************
+ * SendEITCarousel : output as many carousel packets as the rate allows
+ *****************************************************************************/
+static void SendEITCarousel( output_t *p_output, mtime_t i_elapsed )
+{
+    sid_t *p_sid = FindSID( p_output->config.i_sid );
+    int64_t i_max_credit;
+
+    if ( p_sid == NULL )
+    {
+        /* The service has left the PAT. */
+        block_DeleteChain( p_output->p_eit_carousel );
+        p_output->p_eit_carousel = p_output->p_eit_carousel_next = NULL;
+        p_output->i_eit_carousel_version = 0;
+    }
+    else if ( p_output->p_eit_carousel == NULL
+               && p_sid->i_eit_schedule_version
+               && p_sid->i_eit_schedule_version
+                   != p_output->i_eit_carousel_version )
+        BuildEITCarousel( p_output, p_sid );
+
+    if ( p_output->p_eit_carousel == NULL )
+    {
+        p_output->i_eit_carousel_credit = 0;
+        return;
+    }
+
+    /* Do not accumulate more than two periods, to avoid bursts. */
+    i_max_credit = (int64_t)p_output->config.i_epg_rate
+                     * EIT_CAROUSEL_PERIOD * 2 / 1000000;
+    if ( i_max_credit < TS_SIZE * 8 )
+        i_max_credit = TS_SIZE * 8;
+
+    p_output->i_eit_carousel_credit +=
+        (int64_t)p_output->config.i_epg_rate * i_elapsed / 1000000;
+    if ( p_output->i_eit_carousel_credit > i_max_credit )
+        p_output->i_eit_carousel_credit = i_max_credit;
+
+    if ( p_output->i_eit_carousel_credit < TS_SIZE * 8 )
+        return;
+
+    /* The pending present/following packet already has its CC. */
+    if ( p_output->p_eit_ts_buffer != NULL )
+        FlushEIT( p_output, i_wallclock );
+
+    while ( p_output->i_eit_carousel_credit >= TS_SIZE * 8 )
+    {
+        block_t *p_packet = p_output->p_eit_carousel_next;
+        block_t *p_block;
+
+        if ( p_packet == NULL )
+        {
+            /* A new schedule is only taken at the end of a cycle, so that
+             * frequent updates don't keep restarting the carousel. */
+            if ( p_sid->i_eit_schedule_version
+                   != p_output->i_eit_carousel_version )
+                BuildEITCarousel( p_output, p_sid );
+            if ( (p_packet = p_output->p_eit_carousel) == NULL )
+                break;
+        }
+
+        /* Over capacity, the carousel is only delayed. */
+        if ( !output_Admit( p_output, REMUX_EIT_SCHEDULE, 1, i_wallclock ) )
+            break;
+
+        p_block = block_New();
+        memcpy( p_block->p_ts, p_packet->p_ts, TS_SIZE );
+        ts_set_cc( p_block->p_ts, p_output->i_eit_cc );
+        p_output->i_eit_cc = (p_output->i_eit_cc + 1) & 0xf;
+        p_block->i_dts = i_wallclock;
+        p_block->i_refcount--;
+        output_Put( p_output, p_block );
+
+        p_output->p_eit_carousel_next = p_packet->p_next;
+        p_output->i_eit_carousel_credit -= TS_SIZE * 8;
+    }
+}
+
 /*****************************************************************************
  * SendTDT
  *****************************************************************************/
@@ -1222,8 +2198,12 @@ static void SendTDT( block_t *p_ts )
         output_t *p_output = pp_outputs[i];
 
         if ( (p_output->config.i_config & OUTPUT_VALID)
+               && p_output->config.i_input == p_demux->i_input
                && (p_output->config.i_config & OUTPUT_DVB)
-               && p_output->p_sdt_section != NULL )
+               && p_output->i_nb_sdt_sections
+               && (!(p_output->config.i_config & OUTPUT_STATMUX)
+                    || RemuxAdmit( p_output, ts_get_pid( p_ts->p_ts ),
+                                   REMUX_SI, 1, p_ts->i_dts )) )
             output_Put( p_output, p_ts );
     }
 }
@@ -1238,7 +2218,8 @@ static void SendEMM( block_t *p_ts )
     {
         output_t *p_output = pp_outputs[i];
 
-        if ( (p_output->config.i_config & OUTPUT_VALID) )
+        if ( (p_output->config.i_config & OUTPUT_VALID)
+              && p_output->config.i_input == p_demux->i_input )
             output_Put( p_output, p_ts );
     }
 }
@@ -1246,6 +2227,57 @@ static void SendEMM( block_t *p_ts )
 /*****************************************************************************
  * NewPAT
  *****************************************************************************/
+static void NewMPTSPAT( output_t *p_output )
+{
+    const uint8_t *p_program;
+    uint8_t *p, *p_section;
+    uint8_t k = 0;
+    int i, i_nb_programs = 0;
+
+    p_section = psi_allocate();
+    pat_init( p_section );
+    psi_set_length( p_section, PSI_MAX_SIZE );
+    pat_set_tsid( p_section, p_output->i_tsid );
+    psi_set_version( p_section, p_output->i_pat_version );
+    psi_set_current( p_section );
+    psi_set_section( p_section, 0 );
+    psi_set_lastsection( p_section, 0 );
+
+    if ( p_output->config.i_config & OUTPUT_DVB )
+    {
+        /* NIT */
+        p = pat_get_program( p_section, k++ );
+        patn_init( p );
+        patn_set_program( p, 0 );
+        patn_set_pid( p, NIT_PID );
+    }
+
+    /* MAX_MPTS_SERVICES keeps all the programs in a single section. */
+    for ( i = 0; i < p_output->config.i_nb_sids; i++ )
+    {
+        p_program = pat_table_find_program( p_demux->pp_current_pat_sections,
+                                            p_output->config.pi_sids[i] );
+        if ( p_program == NULL ) continue;
+
+        p = pat_get_program( p_section, k++ );
+        patn_init( p );
+        patn_set_program( p, p_output->config.pi_sids[i] );
+        patn_set_pid( p, patn_get_pid( p_program ) );
+        i_nb_programs++;
+    }
+
+    if ( !i_nb_programs )
+    {
+        free( p_section );
+        return;
+    }
+
+    p = pat_get_program( p_section, k );
+    pat_set_length( p_section, p - p_section - PAT_HEADER_SIZE );
+    psi_set_crc( p_section );
+    p_output->p_pat_section = p_section;
+}
+
 static void NewPAT( output_t *p_output )
 {
     const uint8_t *p_program;
@@ -1257,9 +2289,15 @@ static void NewPAT( output_t *p_output )
     p_output->i_pat_version++;
 
     if ( !p_output->config.i_sid ) return;
-    if ( !psi_table_validate(pp_current_pat_sections) ) return;
+    if ( !psi_table_validate(p_demux->pp_current_pat_sections) ) return;
+
+    if ( p_output->config.i_nb_sids )
+    {
+        NewMPTSPAT( p_output );
+        return;
+    }
 
-    p_program = pat_table_find_program( pp_current_pat_sections,
+    p_program = pat_table_find_program( p_demux->pp_current_pat_sections,
                                         p_output->config.i_sid );
     if ( p_program == NULL ) return;
 
@@ -1342,43 +2380,29 @@ static void CopyDescriptors( uint8_t *p_descs, uint8_t *p_current_descs )
         descs_set_length( p_descs, p_desc - p_descs - DESCS_HEADER_SIZE );
 }
 
-static void NewPMT( output_t *p_output )
+static uint8_t *BuildPMT( output_t *p_output, sid_t *p_sid,
+                          uint8_t i_version )
 {
-    sid_t *p_sid;
-    uint8_t *p_current_pmt;
+    uint8_t *p_current_pmt = p_sid->p_current_pmt;
     uint8_t *p_es, *p_current_es;
     uint8_t *p;
     uint16_t j, k;
-    uint16_t i_pcrpid;
-
-    free( p_output->p_pmt_section );
-    p_output->p_pmt_section = NULL;
-    p_output->i_pmt_version++;
-
-    if ( !p_output->config.i_sid ) return;
-
-    p_sid = FindSID( p_output->config.i_sid );
-    if ( p_sid == NULL ) return;
-
-    if ( p_sid->p_current_pmt == NULL ) return;
-    p_current_pmt = p_sid->p_current_pmt;
+    uint16_t i_pcrpid, i_newpcrpid;
 
-    p = p_output->p_pmt_section = psi_allocate();
+    p = psi_allocate();
     pmt_init( p );
     psi_set_length( p, PSI_MAX_SIZE );
     if ( p_output->config.i_new_sid )
     {
-        msg_Dbg( NULL, "Mapping PMT SID %d to %d", p_output->config.i_sid,
+        msg_Dbg( NULL, "Mapping PMT SID %d to %d", p_sid->i_sid,
                  p_output->config.i_new_sid );
         pmt_set_program( p, p_output->config.i_new_sid );
     }
     else
-        pmt_set_program( p, p_output->config.i_sid );
-    psi_set_version( p, p_output->i_pmt_version );
+        pmt_set_program( p, p_sid->i_sid );
+    psi_set_version( p, i_version );
     psi_set_current( p );
     pmt_set_desclength( p, 0 );
-    init_pid_mapping( p_output );
-
 
     CopyDescriptors( pmt_get_descs( p ), pmt_get_descs( p_current_pmt ) );
 
@@ -1407,10 +2431,11 @@ static void NewPMT( output_t *p_output )
 
     /* Do the pcr pid after everything else as it may have been remapped */
     i_pcrpid = pmt_get_pcrpid( p_current_pmt );
-    if ( p_output->pi_newpids[i_pcrpid] != UNUSED_PID ) {
+    i_newpcrpid = output_GetMappedPID( p_output, i_pcrpid );
+    if ( i_newpcrpid != UNUSED_PID ) {
         msg_Dbg( NULL, "REMAP: The PCR PID was changed from 0x%x (%u) to 0x%x (%u)",
-                 i_pcrpid, i_pcrpid, p_output->pi_newpids[i_pcrpid], p_output->pi_newpids[i_pcrpid] );
-        i_pcrpid = p_output->pi_newpids[i_pcrpid];
+                 i_pcrpid, i_pcrpid, i_newpcrpid, i_newpcrpid );
+        i_pcrpid = i_newpcrpid;
     } else {
         msg_Dbg( NULL, "The PCR PID has kept its original value of 0x%x (%u)", i_pcrpid, i_pcrpid);
     }
@@ -1422,8 +2447,55 @@ static void NewPMT( output_t *p_output )
     else
         pmt_set_length( p, p_es - p - PMT_HEADER_SIZE );
     psi_set_crc( p );
+    return p;
+}
+
+/* PMT of one service of an MPTS output */
+static void NewServicePMT( output_t *p_output, output_service_t *p_service )
+{
+    sid_t *p_sid;
+
+    free( p_service->p_pmt_section );
+    p_service->p_pmt_section = NULL;
+    p_service->i_pmt_version++;
+
+    p_sid = FindSID( p_service->i_sid );
+    if ( p_sid == NULL || p_sid->p_current_pmt == NULL ) return;
+
+    p_service->i_pmt_pid = p_sid->i_pmt_pid;
+    p_service->p_pmt_section = BuildPMT( p_output, p_sid,
+                                         p_service->i_pmt_version );
+}
+
+static void NewPMT( output_t *p_output )
+{
+    sid_t *p_sid;
+    int i;
+
+    free( p_output->p_pmt_section );
+    p_output->p_pmt_section = NULL;
+    p_output->i_pmt_version++;
+
+    if ( p_output->config.i_nb_sids )
+    {
+        for ( i = 0; i < p_output->config.i_nb_sids; i++ )
+            NewServicePMT( p_output, &p_output->p_services[i] );
+        return;
+    }
+
+    if ( !p_output->config.i_sid ) return;
+
+    p_sid = FindSID( p_output->config.i_sid );
+    if ( p_sid == NULL ) return;
+
+    if ( p_sid->p_current_pmt == NULL ) return;
+
+    init_pid_mapping( p_output );
+    p_output->p_pmt_section = BuildPMT( p_output, p_sid,
+                                        p_output->i_pmt_version );
 }
 
+
 /*****************************************************************************
  * NewNIT
  *****************************************************************************/
@@ -1483,19 +2555,117 @@ static void NewNIT( output_t *p_output )
 /*****************************************************************************
  * NewSDT
  *****************************************************************************/
+static uint8_t *NewSDTSection( output_t *p_output )
+{
+    uint8_t *p = psi_allocate();
+
+    sdt_init( p, true );
+    sdt_set_length( p, PSI_MAX_SIZE );
+    sdt_set_tsid( p, p_output->i_tsid );
+    psi_set_version( p, p_output->i_sdt_version );
+    psi_set_current( p );
+    psi_set_section( p, p_output->i_nb_sdt_sections );
+    psi_set_lastsection( p, 0 );
+    sdt_set_onid( p,
+        sdt_get_onid( psi_table_get_section( p_demux->pp_current_sdt_sections,
+                                             0 ) ) );
+
+    p_output->pp_sdt_sections = realloc( p_output->pp_sdt_sections,
+                    (p_output->i_nb_sdt_sections + 1) * sizeof(uint8_t *) );
+    p_output->pp_sdt_sections[p_output->i_nb_sdt_sections++] = p;
+    return p;
+}
+
+static void SetSDTServiceEIT( output_t *p_output, uint8_t *p_service,
+                              uint8_t *p_current_service )
+{
+    if ( (p_output->config.i_config & OUTPUT_EPG) == OUTPUT_EPG )
+    {
+        sdtn_set_eitschedule(p_service);
+        sdtn_set_eitpresent(p_service);
+    } else {
+        if ( sdtn_get_eitschedule(p_current_service) )
+            sdtn_set_eitschedule(p_service);
+        if ( sdtn_get_eitpresent(p_current_service) )
+            sdtn_set_eitpresent(p_service);
+    }
+}
+
+/* All the services of an MPTS output, split over as many sections as needed */
+static void NewMPTSSDT( output_t *p_output )
+{
+    uint8_t *p = NULL, *p_service = NULL;
+    int i;
+
+    for ( i = 0; i < p_output->config.i_nb_sids; i++ )
+    {
+        uint16_t i_sid = p_output->config.pi_sids[i];
+        uint8_t *p_current_service;
+        uint16_t i_size;
+
+        p_current_service = sdt_table_find_service( p_demux->pp_current_sdt_sections,
+                                                    i_sid );
+        if ( p_current_service == NULL ) continue;
+        i_size = SDT_SERVICE_SIZE + sdtn_get_desclength( p_current_service );
+
+        if ( p != NULL && p_service + i_size
+                            > p + PSI_HEADER_SIZE + PSI_MAX_SIZE - PSI_CRC_SIZE )
+        {
+            sdt_set_length( p, p_service - p - SDT_HEADER_SIZE );
+            p = NULL;
+        }
+        if ( p == NULL )
+        {
+            p = NewSDTSection( p_output );
+            p_service = sdt_get_service( p, 0 );
+        }
+
+        sdtn_init( p_service );
+        sdtn_set_sid( p_service, i_sid );
+        SetSDTServiceEIT( p_output, p_service, p_current_service );
+        sdtn_set_running( p_service, sdtn_get_running(p_current_service) );
+        /* Do not set free_ca */
+        sdtn_set_desclength( p_service, sdtn_get_desclength(p_current_service) );
+        memcpy( descs_get_desc( sdtn_get_descs(p_service), 0 ),
+                descs_get_desc( sdtn_get_descs(p_current_service), 0 ),
+                sdtn_get_desclength(p_current_service) );
+        p_service += i_size;
+    }
+
+    if ( p == NULL ) return;
+    sdt_set_length( p, p_service - p - SDT_HEADER_SIZE );
+
+    for ( i = 0; i < p_output->i_nb_sdt_sections; i++ )
+    {
+        psi_set_lastsection( p_output->pp_sdt_sections[i],
+                             p_output->i_nb_sdt_sections - 1 );
+        psi_set_crc( p_output->pp_sdt_sections[i] );
+    }
+}
+
 static void NewSDT( output_t *p_output )
 {
     uint8_t *p_service, *p_current_service;
     uint8_t *p;
+    int i;
 
-    free( p_output->p_sdt_section );
-    p_output->p_sdt_section = NULL;
+    for ( i = 0; i < p_output->i_nb_sdt_sections; i++ )
+        free( p_output->pp_sdt_sections[i] );
+    free( p_output->pp_sdt_sections );
+    p_output->pp_sdt_sections = NULL;
+    p_output->i_nb_sdt_sections = 0;
     p_output->i_sdt_version++;
 
     if ( !p_output->config.i_sid ) return;
-    if ( !psi_table_validate(pp_current_sdt_sections) ) return;
+    if ( !psi_table_validate(p_demux->pp_current_sdt_sections) ) return;
+
+    if ( p_output->config.i_nb_sids )
+    {
+        NewMPTSSDT( p_output );
+        return;
+    }
 
-    p_current_service = sdt_table_find_service( pp_current_sdt_sections,
+    p_current_service = sdt_table_find_service( p_demux->pp_current_sdt_sections,
                                                 p_output->config.i_sid );
 
     if ( p_current_service == NULL )
@@ -1511,16 +2681,7 @@ static void NewSDT( output_t *p_output )
         return;
     }
 
-    p = p_output->p_sdt_section = psi_allocate();
-    sdt_init( p, true );
-    sdt_set_length( p, PSI_MAX_SIZE );
-    sdt_set_tsid( p, p_output->i_tsid );
-    psi_set_version( p, p_output->i_sdt_version );
-    psi_set_current( p );
-    psi_set_section( p, 0 );
-    psi_set_lastsection( p, 0 );
-    sdt_set_onid( p,
-        sdt_get_onid( psi_table_get_section( pp_current_sdt_sections, 0 ) ) );
+    p = NewSDTSection( p_output );
 
     p_service = sdt_get_service( p, 0 );
     sdtn_init( p_service );
@@ -1533,16 +2694,7 @@ static void NewSDT( output_t *p_output )
     else
         sdtn_set_sid( p_service, p_output->config.i_sid );
 
-    if ( (p_output->config.i_config & OUTPUT_EPG) == OUTPUT_EPG )
-    {
-        sdtn_set_eitschedule(p_service);
-        sdtn_set_eitpresent(p_service);
-    } else {
-        if ( sdtn_get_eitschedule(p_current_service) )
-            sdtn_set_eitschedule(p_service);
-        if ( sdtn_get_eitpresent(p_current_service) )
-            sdtn_set_eitpresent(p_service);
-    }
+    SetSDTServiceEIT( p_output, p_service, p_current_service );
 
     sdtn_set_running( p_service, sdtn_get_running(p_current_service) );
     /* Do not set free_ca */
@@ -1610,7 +2762,7 @@ static void NewSDT( output_t *p_output )
         sdt_set_length( p, 0 );
     else
         sdt_set_length( p, p_service - p - SDT_HEADER_SIZE );
-    psi_set_crc( p_output->p_sdt_section );
+    psi_set_crc( p );
 }
 
 /*****************************************************************************
@@ -1619,31 +2771,54 @@ static void NewSDT( output_t *p_output )
 #define DECLARE_UPDATE_FUNC( table )                                        \
 static void Update##table( uint16_t i_sid )                                 \
 {                                                                           \
-    int i;                                                                  \
+    int i, i_nb_sid_outputs;                                                \
+    output_t **pp_sid_outputs = GetSIDOutputs( i_sid, &i_nb_sid_outputs );  \
                                                                             \
-    for ( i = 0; i < i_nb_outputs; i++ )                                    \
-        if ( ( pp_outputs[i]->config.i_config & OUTPUT_VALID )              \
-             && pp_outputs[i]->config.i_sid == i_sid )                      \
-            New##table( pp_outputs[i] );                                    \
+    for ( i = 0; i < i_nb_sid_outputs; i++ )                                \
+        New##table( pp_sid_outputs[i] );                                    \
 }
 
 DECLARE_UPDATE_FUNC(PAT)
-DECLARE_UPDATE_FUNC(PMT)
 DECLARE_UPDATE_FUNC(SDT)
 
+/* Only the PMT of the service that changed is regenerated for MPTS outputs. */
+static void UpdatePMT( uint16_t i_sid )
+{
+    int i, i_nb_sid_outputs;
+    output_t **pp_sid_outputs = GetSIDOutputs( i_sid, &i_nb_sid_outputs );
+
+    for ( i = 0; i < i_nb_sid_outputs; i++ )
+    {
+        output_service_t *p_service = FindOutputService( pp_sid_outputs[i],
+                                                         i_sid );
+        if ( p_service != NULL )
+            NewServicePMT( pp_sid_outputs[i], p_service );
+        else
+            NewPMT( pp_sid_outputs[i] );
+    }
+}
+
 /*****************************************************************************
  * UpdateTSID
  *****************************************************************************/
 static void UpdateTSID(void)
 {
-    uint16_t i_tsid = psi_table_get_tableidext(pp_current_pat_sections);
+    uint16_t i_tsid = psi_table_get_tableidext(p_demux->pp_current_pat_sections);
     int i;
 
+    /* Outputs keep the TSID of the main input, or take the one of the
+     * backup input if the main input never had a PAT. */
+    if ( p_demux->b_backup_input && p_demux->b_main_tsid )
+        return;
+    if ( !p_demux->b_backup_input )
+        p_demux->b_main_tsid = true;
+
     for ( i = 0; i < i_nb_outputs; i++ )
     {
         output_t *p_output = pp_outputs[i];
 
         if ( (p_output->config.i_config & OUTPUT_VALID)
+              && p_output->config.i_input == p_demux->i_input
               && p_output->config.i_tsid == -1 && !b_random_tsid )
         {
             p_output->i_tsid = i_tsid;
@@ -1657,14 +2832,7 @@ static void UpdateTSID(void)
  *****************************************************************************/
 static bool SIDIsSelected( uint16_t i_sid )
 {
-    int i;
-
-    for ( i = 0; i < i_nb_outputs; i++ )
-        if ( (pp_outputs[i]->config.i_config & OUTPUT_VALID)
-             && pp_outputs[i]->config.i_sid == i_sid )
-            return true;
-
-    return false;
+    return FindSIDOutputs( i_sid ) != NULL;
 }
 
 /*****************************************************************************
@@ -1672,13 +2840,8 @@ static bool SIDIsSelected( uint16_t i_sid )
  *****************************************************************************/
 bool demux_PIDIsSelected( uint16_t i_pid )
 {
-    int i;
-
-    for ( i = 0; i < p_pids[i_pid].i_nb_outputs; i++ )
-        if ( p_pids[i_pid].pp_outputs[i] != NULL )
-            return true;
-
-    return false;
+    /* Only asked about the main input, possibly while demuxing another. */
+    return pp_demuxes[0]->p_pids[i_pid].i_nb_outputs != 0;
 }
 
 /*****************************************************************************
@@ -1806,11 +2969,13 @@ static bool PMTNeedsDescrambling( uint8_t *p_pmt )
 void demux_ResendCAPMTs( void )
 {
     int i;
-    for ( i = 0; i < i_nb_sids; i++ )
-        if ( pp_sids[i]->p_current_pmt != NULL
-              && SIDIsSelected( pp_sids[i]->i_sid )
-              && PMTNeedsDescrambling( pp_sids[i]->p_current_pmt ) )
-            en50221_AddPMT( pp_sids[i]->p_current_pmt );
+
+    p_demux = pp_demuxes[0];
+    for ( i = 0; i < p_demux->i_nb_sids; i++ )
+        if ( p_demux->pp_sids[i]->p_current_pmt != NULL
+              && SIDIsSelected( p_demux->pp_sids[i]->i_sid )
+              && PMTNeedsDescrambling( p_demux->pp_sids[i]->p_current_pmt ) )
+            CAAddPMT( p_demux->pp_sids[i]->p_current_pmt );
 }
 
 /* Find CA descriptor that have PID i_ca_pid */
@@ -1843,6 +3008,7 @@ static void DeleteProgram( uint16_t i_sid, uint16_t i_pid )
 
     p_sid = FindSID( i_sid );
     if ( p_sid == NULL ) return;
+    p_demux->i_psi_generation++;
 
     p_pmt = p_sid->p_current_pmt;
 
@@ -1854,7 +3020,7 @@ static void DeleteProgram( uint16_t i_sid, uint16_t i_pid )
 
         if ( i_ca_handle && SIDIsSelected( i_sid )
              && PMTNeedsDescrambling( p_pmt ) )
-            en50221_DeletePMT( p_pmt );
+            CADeletePMT( p_pmt );
 
         if ( i_pcr_pid != PADDING_PID
               && i_pcr_pid != p_sid->i_pmt_pid )
@@ -1895,9 +3061,10 @@ static void DeleteProgram( uint16_t i_sid, uint16_t i_pid )
             }
         }
 
-        free( p_pmt );
+        SectionRelease( p_pmt );
         p_sid->p_current_pmt = NULL;
     }
+    FreeEITSchedule( p_sid );
     p_sid->i_sid = 0;
     p_sid->i_pmt_pid = 0;
 }
@@ -1981,6 +3148,44 @@ static void demux_Print(void *_unused, const char *psz_format, ...)
     va_end(args);
 }
 
+/*****************************************************************************
+ * PSISameContent : tell whether two sections only differ by their version,
+ * as when a backup input carries the same tables with other versions; the
+ * output tables then do not change
+ *****************************************************************************/
+static bool PSISameContent( const uint8_t *p_section1,
+                            const uint8_t *p_section2 )
+{
+    uint16_t i_length = psi_get_length( p_section1 );
+
+    if ( i_length != psi_get_length( p_section2 )
+          || i_length < PSI_HEADER_SIZE_SYNTAX1 - PSI_HEADER_SIZE
+                         + PSI_CRC_SIZE )
+        return false;
+
+    /* The version is in bits 1 to 5 of byte 5, the CRC at the end. */
+    return !memcmp( p_section1, p_section2, 5 )
+        && (p_section1[5] & 0xc1) == (p_section2[5] & 0xc1)
+        && !memcmp( p_section1 + 6, p_section2 + 6,
+                    PSI_HEADER_SIZE + i_length - PSI_CRC_SIZE - 6 );
+}
+
+static bool PSITableSameContent( uint8_t **pp_sections1,
+                                 uint8_t **pp_sections2 )
+{
+    uint8_t i_last_section = psi_table_get_lastsection( pp_sections1 );
+    int i;
+
+    if ( i_last_section != psi_table_get_lastsection( pp_sections2 ) )
+        return false;
+
+    for ( i = 0; i <= i_last_section; i++ )
+        if ( pp_sections1[i] == NULL || pp_sections2[i] == NULL
+              || !PSISameContent( pp_sections1[i], pp_sections2[i] ) )
+            return false;
+    return true;
+}
+
 /*****************************************************************************
  * HandlePAT
  *****************************************************************************/
@@ -1988,19 +3193,20 @@ static void HandlePAT( mtime_t i_dts )
 {
     bool b_change = false;
     PSI_TABLE_DECLARE( pp_old_pat_sections );
-    uint8_t i_last_section = psi_table_get_lastsection( pp_next_pat_sections );
+    uint8_t i_last_section = psi_table_get_lastsection( p_demux->pp_next_pat_sections );
     uint8_t i;
 
-    if ( psi_table_validate( pp_current_pat_sections ) &&
-         psi_table_compare( pp_current_pat_sections, pp_next_pat_sections ) )
+    if ( psi_table_validate( p_demux->pp_current_pat_sections ) &&
+         PSITableSameContent( p_demux->pp_current_pat_sections,
+                              p_demux->pp_next_pat_sections ) )
     {
         /* Identical PAT. Shortcut. */
-        psi_table_free( pp_next_pat_sections );
-        psi_table_init( pp_next_pat_sections );
+        SectionTableFree( p_demux->pp_next_pat_sections );
+        psi_table_init( p_demux->pp_next_pat_sections );
         goto out_pat;
     }
 
-    if ( !pat_table_validate( pp_next_pat_sections ) )
+    if ( !pat_table_validate( p_demux->pp_next_pat_sections ) )
     {
         msg_Warn( NULL, "invalid PAT received" );
         switch (i_print_type) {
@@ -2010,18 +3216,19 @@ static void HandlePAT( mtime_t i_dts )
         default:
             printf("invalid PAT received\n");
         }
-        psi_table_free( pp_next_pat_sections );
-        psi_table_init( pp_next_pat_sections );
+        SectionTableFree( p_demux->pp_next_pat_sections );
+        psi_table_init( p_demux->pp_next_pat_sections );
         goto out_pat;
     }
 
     /* Switch tables. */
-    psi_table_copy( pp_old_pat_sections, pp_current_pat_sections );
-    psi_table_copy( pp_current_pat_sections, pp_next_pat_sections );
-    psi_table_init( pp_next_pat_sections );
+    psi_table_copy( pp_old_pat_sections, p_demux->pp_current_pat_sections );
+    psi_table_copy( p_demux->pp_current_pat_sections, p_demux->pp_next_pat_sections );
+    psi_table_init( p_demux->pp_next_pat_sections );
+    p_demux->i_psi_generation++;
 
     if ( !psi_table_validate( pp_old_pat_sections )
-          || psi_table_get_tableidext( pp_current_pat_sections )
+          || psi_table_get_tableidext( p_demux->pp_current_pat_sections )
               != psi_table_get_tableidext( pp_old_pat_sections ) )
     {
         b_change = true;
@@ -2032,7 +3239,7 @@ static void HandlePAT( mtime_t i_dts )
     for ( i = 0; i <= i_last_section; i++ )
     {
         uint8_t *p_section =
-            psi_table_get_section( pp_current_pat_sections, i );
+            psi_table_get_section( p_demux->pp_current_pat_sections, i );
         const uint8_t *p_program;
         int j = 0;
 
@@ -2068,11 +3275,12 @@ static void HandlePAT( mtime_t i_dts )
                 p_sid = FindSID( 0 );
                 if ( p_sid == NULL )
                 {
-                    p_sid = malloc( sizeof(sid_t) );
+                    p_sid = calloc( 1, sizeof(sid_t) );
                     p_sid->p_current_pmt = NULL;
-                    i_nb_sids++;
-                    pp_sids = realloc( pp_sids, sizeof(sid_t *) * i_nb_sids );
-                    pp_sids[i_nb_sids - 1] = p_sid;
+                    p_demux->i_nb_sids++;
+                    p_demux->pp_sids = realloc( p_demux->pp_sids,
+                                    sizeof(sid_t *) * p_demux->i_nb_sids );
+                    p_demux->pp_sids[p_demux->i_nb_sids - 1] = p_sid;
                 }
 
                 p_sid->i_sid = i_sid;
@@ -2102,7 +3310,7 @@ static void HandlePAT( mtime_t i_dts )
                 if ( i_sid == 0 )
                     continue; /* NIT */
 
-                if ( pat_table_find_program( pp_current_pat_sections, i_sid )
+                if ( pat_table_find_program( p_demux->pp_current_pat_sections, i_sid )
                       == NULL )
                 {
                     DeleteProgram( i_sid, i_pid );
@@ -2111,13 +3319,13 @@ static void HandlePAT( mtime_t i_dts )
             }
         }
 
-        psi_table_free( pp_old_pat_sections );
+        SectionTableFree( pp_old_pat_sections );
     }
 
-    pat_table_print( pp_current_pat_sections, msg_Dbg, NULL, PRINT_TEXT );
+    pat_table_print( p_demux->pp_current_pat_sections, msg_Dbg, NULL, PRINT_TEXT );
     if ( b_print_enabled )
     {
-        pat_table_print( pp_current_pat_sections, demux_Print, NULL,
+        pat_table_print( p_demux->pp_current_pat_sections, demux_Print, NULL,
                          i_print_type );
         if ( i_print_type == PRINT_XML )
             printf("\n");
@@ -2143,11 +3351,11 @@ static void HandlePATSection( uint16_t i_pid, uint8_t *p_section,
         default:
             printf("invalid PAT section received on PID %hu\n", i_pid);
         }
-        free( p_section );
+        SectionRelease( p_section );
         return;
     }
 
-    if ( !psi_table_section( pp_next_pat_sections, p_section ) )
+    if ( !SectionTableAdd( p_demux->pp_next_pat_sections, p_section ) )
         return;
 
     HandlePAT( i_dts );
@@ -2159,22 +3367,23 @@ static void HandlePATSection( uint16_t i_pid, uint8_t *p_section,
 static void HandleCAT( mtime_t i_dts )
 {
     PSI_TABLE_DECLARE( pp_old_cat_sections );
-    uint8_t i_last_section = psi_table_get_lastsection( pp_next_cat_sections );
+    uint8_t i_last_section = psi_table_get_lastsection( p_demux->pp_next_cat_sections );
     uint8_t i_last_section2;
     uint8_t i, r;
     uint8_t *p_desc;
     int j, k;
 
-    if ( psi_table_validate( pp_current_cat_sections ) &&
-         psi_table_compare( pp_current_cat_sections, pp_next_cat_sections ) )
+    if ( psi_table_validate( p_demux->pp_current_cat_sections ) &&
+         psi_table_compare( p_demux->pp_current_cat_sections,
+                            p_demux->pp_next_cat_sections ) )
     {
         /* Identical CAT. Shortcut. */
-        psi_table_free( pp_next_cat_sections );
-        psi_table_init( pp_next_cat_sections );
+        SectionTableFree( p_demux->pp_next_cat_sections );
+        psi_table_init( p_demux->pp_next_cat_sections );
         goto out_cat;
     }
 
-    if ( !cat_table_validate( pp_next_cat_sections ) )
+    if ( !cat_table_validate( p_demux->pp_next_cat_sections ) )
     {
         msg_Warn( NULL, "invalid CAT received" );
         switch (i_print_type) {
@@ -2184,19 +3393,20 @@ static void HandleCAT( mtime_t i_dts )
         default:
             printf("invalid CAT received\n");
         }
-        psi_table_free( pp_next_cat_sections );
-        psi_table_init( pp_next_cat_sections );
+        SectionTableFree( p_demux->pp_next_cat_sections );
+        psi_table_init( p_demux->pp_next_cat_sections );
         goto out_cat;
     }
 
     /* Switch tables. */
-    psi_table_copy( pp_old_cat_sections, pp_current_cat_sections );
-    psi_table_copy( pp_current_cat_sections, pp_next_cat_sections );
-    psi_table_init( pp_next_cat_sections );
+    psi_table_copy( pp_old_cat_sections, p_demux->pp_current_cat_sections );
+    psi_table_copy( p_demux->pp_current_cat_sections, p_demux->pp_next_cat_sections );
+    psi_table_init( p_demux->pp_next_cat_sections );
+    p_demux->i_psi_generation++;
 
     for ( i = 0; i <= i_last_section; i++ )
     {
-        uint8_t *p_section = psi_table_get_section( pp_current_cat_sections, i );
+        uint8_t *p_section = psi_table_get_section( p_demux->pp_current_cat_sections, i );
 
         j = 0;
         while ( (p_desc = descl_get_desc( cat_get_descl(p_section), cat_get_desclength(p_section), j++ )) != NULL )
@@ -2226,10 +3436,10 @@ static void HandleCAT( mtime_t i_dts )
                 emm_pid = desc09_get_pid( p_desc );
 
                 // Search in current sections if the pid exists
-                i_last_section2 = psi_table_get_lastsection( pp_current_cat_sections );
+                i_last_section2 = psi_table_get_lastsection( p_demux->pp_current_cat_sections );
                 for ( r = 0; r <= i_last_section2; r++ )
                 {
-                    uint8_t *p_section = psi_table_get_section( pp_current_cat_sections, r );
+                    uint8_t *p_section = psi_table_get_section( p_demux->pp_current_cat_sections, r );
 
                     k = 0;
                     while ( (p_desc = descl_get_desc( cat_get_descl(p_section), cat_get_desclength(p_section), k++ )) != NULL )
@@ -2249,13 +3459,13 @@ static void HandleCAT( mtime_t i_dts )
             }
         }
 
-        psi_table_free( pp_old_cat_sections );
+        SectionTableFree( pp_old_cat_sections );
     }
 
-    cat_table_print( pp_current_cat_sections, msg_Dbg, NULL, PRINT_TEXT );
+    cat_table_print( p_demux->pp_current_cat_sections, msg_Dbg, NULL, PRINT_TEXT );
     if ( b_print_enabled )
     {
-        cat_table_print( pp_current_cat_sections, demux_Print, NULL,
+        cat_table_print( p_demux->pp_current_cat_sections, demux_Print, NULL,
                          i_print_type );
         if ( i_print_type == PRINT_XML )
             printf("\n");
@@ -2281,11 +3491,11 @@ static void HandleCATSection( uint16_t i_pid, uint8_t *p_section,
         default:
             printf("invalid CAT section received on PID %hu\n", i_pid);
         }
-        free( p_section );
+        SectionRelease( p_section );
         return;
     }
 
-    if ( !psi_table_section( pp_next_cat_sections, p_section ) )
+    if ( !SectionTableAdd( p_demux->pp_next_cat_sections, p_section ) )
         return;
 
     HandleCAT( i_dts );
@@ -2322,7 +3532,7 @@ static void mark_pmt_pids( uint8_t *p_pmt, uint8_t pid_map[], uint8_t marker )
         if ( PIDWouldBeSelected( p_es ) )
             pid_map[ i_pid ] |= marker;
 
-        p_pids[i_pid].b_pes = PIDCarriesPES( p_es );
+        p_demux->p_pids[i_pid].b_pes = PIDCarriesPES( p_es );
 
         if ( b_enable_ecm )
         {
@@ -2352,7 +3562,7 @@ static void HandlePMT( uint16_t i_pid, uint8_t *p_pmt, mtime_t i_dts )
     {
         /* Unwanted SID (happens when the same PMT PID is used for several
          * programs). */
-        free( p_pmt );
+        SectionRelease( p_pmt );
         return;
     }
 
@@ -2368,15 +3578,15 @@ static void HandlePMT( uint16_t i_pid, uint8_t *p_pmt, mtime_t i_dts )
             printf("ghost PMT for service %hu carried on PID %hu\n", i_sid,
                    i_pid);
         }
-        free( p_pmt );
+        SectionRelease( p_pmt );
         return;
     }
 
     if ( p_sid->p_current_pmt != NULL &&
-         psi_compare( p_sid->p_current_pmt, p_pmt ) )
+         PSISameContent( p_sid->p_current_pmt, p_pmt ) )
     {
         /* Identical PMT. Shortcut. */
-        free( p_pmt );
+        SectionRelease( p_pmt );
         goto out_pmt;
     }
 
@@ -2391,7 +3601,7 @@ static void HandlePMT( uint16_t i_pid, uint8_t *p_pmt, mtime_t i_dts )
         default:
             printf("invalid PMT section received on PID %hu\n", i_pid);
         }
-        free( p_pmt );
+        SectionRelease( p_pmt );
         goto out_pmt;
     }
 
@@ -2405,12 +3615,12 @@ static void HandlePMT( uint16_t i_pid, uint8_t *p_pmt, mtime_t i_dts )
 
     if ( i_ca_handle && b_is_selected &&
          !b_needs_descrambling && b_needed_descrambling )
-        en50221_DeletePMT( p_sid->p_current_pmt );
+        CADeletePMT( p_sid->p_current_pmt );
 
     if ( p_sid->p_current_pmt != NULL )
     {
         mark_pmt_pids( p_sid->p_current_pmt, pid_map, 0x02 );
-        free( p_sid->p_current_pmt );
+        SectionRelease( p_sid->p_current_pmt );
     }
 
     mark_pmt_pids( p_pmt, pid_map, 0x01 );
@@ -2436,13 +3646,15 @@ static void HandlePMT( uint16_t i_pid, uint8_t *p_pmt, mtime_t i_dts )
     }
 
     p_sid->p_current_pmt = p_pmt;
+    p_demux->i_psi_generation++;
+    comm_Event( EVENT_PMT, i_pid, i_sid, psi_get_version( p_pmt ), 0 );
 
     if ( i_ca_handle && b_is_selected )
     {
         if ( b_needs_descrambling && !b_needed_descrambling )
-            en50221_AddPMT( p_pmt );
+            CAAddPMT( p_pmt );
         else if ( b_needs_descrambling && b_needed_descrambling )
-            en50221_UpdatePMT( p_pmt );
+            CAUpdatePMT( p_pmt );
     }
 
     UpdatePMT( i_sid );
@@ -2465,16 +3677,17 @@ out_pmt:
  *****************************************************************************/
 static void HandleNIT( mtime_t i_dts )
 {
-    if ( psi_table_validate( pp_current_nit_sections ) &&
-         psi_table_compare( pp_current_nit_sections, pp_next_nit_sections ) )
+    if ( psi_table_validate( p_demux->pp_current_nit_sections ) &&
+         psi_table_compare( p_demux->pp_current_nit_sections,
+                            p_demux->pp_next_nit_sections ) )
     {
         /* Identical NIT. Shortcut. */
-        psi_table_free( pp_next_nit_sections );
-        psi_table_init( pp_next_nit_sections );
+        SectionTableFree( p_demux->pp_next_nit_sections );
+        psi_table_init( p_demux->pp_next_nit_sections );
         goto out_nit;
     }
 
-    if ( !nit_table_validate( pp_next_nit_sections ) )
+    if ( !nit_table_validate( p_demux->pp_next_nit_sections ) )
     {
         msg_Warn( NULL, "invalid NIT received" );
         switch (i_print_type) {
@@ -2484,21 +3697,22 @@ static void HandleNIT( mtime_t i_dts )
         default:
             printf("invalid NIT received\n");
         }
-        psi_table_free( pp_next_nit_sections );
-        psi_table_init( pp_next_nit_sections );
+        SectionTableFree( p_demux->pp_next_nit_sections );
+        psi_table_init( p_demux->pp_next_nit_sections );
         goto out_nit;
     }
 
     /* Switch tables. */
-    psi_table_free( pp_current_nit_sections );
-    psi_table_copy( pp_current_nit_sections, pp_next_nit_sections );
-    psi_table_init( pp_next_nit_sections );
+    SectionTableFree( p_demux->pp_current_nit_sections );
+    psi_table_copy( p_demux->pp_current_nit_sections, p_demux->pp_next_nit_sections );
+    psi_table_init( p_demux->pp_next_nit_sections );
+    p_demux->i_si_generation++;
 
-    nit_table_print( pp_current_nit_sections, msg_Dbg, NULL,
+    nit_table_print( p_demux->pp_current_nit_sections, msg_Dbg, NULL,
                      demux_Iconv, NULL, PRINT_TEXT );
     if ( b_print_enabled )
     {
-        nit_table_print( pp_current_nit_sections, demux_Print, NULL,
+        nit_table_print( p_demux->pp_current_nit_sections, demux_Print, NULL,
                          demux_Iconv, NULL, i_print_type );
         if ( i_print_type == PRINT_XML )
             printf("\n");
@@ -2525,11 +3739,11 @@ static void HandleNITSection( uint16_t i_pid, uint8_t *p_section,
         default:
             printf("invalid NIT section received on PID %hu\n", i_pid);
         }
-        free( p_section );
+        SectionRelease( p_section );
         return;
     }
 
-    if ( psi_table_section( pp_next_nit_sections, p_section ) )
+    if ( SectionTableAdd( p_demux->pp_next_nit_sections, p_section ) )
         HandleNIT( i_dts );
 
     /* This case is different because DVB specifies a minimum bitrate for
@@ -2545,20 +3759,21 @@ static void HandleNITSection( uint16_t i_pid, uint8_t *p_section,
 static void HandleSDT( mtime_t i_dts )
 {
     PSI_TABLE_DECLARE( pp_old_sdt_sections );
-    uint8_t i_last_section = psi_table_get_lastsection( pp_next_sdt_sections );
+    uint8_t i_last_section = psi_table_get_lastsection( p_demux->pp_next_sdt_sections );
     uint8_t i;
     int j;
 
-    if ( psi_table_validate( pp_current_sdt_sections ) &&
-         psi_table_compare( pp_current_sdt_sections, pp_next_sdt_sections ) )
+    if ( psi_table_validate( p_demux->pp_current_sdt_sections ) &&
+         PSITableSameContent( p_demux->pp_current_sdt_sections,
+                              p_demux->pp_next_sdt_sections ) )
     {
         /* Identical SDT. Shortcut. */
-        psi_table_free( pp_next_sdt_sections );
-        psi_table_init( pp_next_sdt_sections );
+        SectionTableFree( p_demux->pp_next_sdt_sections );
+        psi_table_init( p_demux->pp_next_sdt_sections );
         goto out_sdt;
     }
 
-    if ( !sdt_table_validate( pp_next_sdt_sections ) )
+    if ( !sdt_table_validate( p_demux->pp_next_sdt_sections ) )
     {
         msg_Warn( NULL, "invalid SDT received" );
         switch (i_print_type) {
@@ -2568,20 +3783,21 @@ static void HandleSDT( mtime_t i_dts )
         default:
             printf("invalid SDT received\n");
         }
-        psi_table_free( pp_next_sdt_sections );
-        psi_table_init( pp_next_sdt_sections );
+        SectionTableFree( p_demux->pp_next_sdt_sections );
+        psi_table_init( p_demux->pp_next_sdt_sections );
         goto out_sdt;
     }
 
     /* Switch tables. */
-    psi_table_copy( pp_old_sdt_sections, pp_current_sdt_sections );
-    psi_table_copy( pp_current_sdt_sections, pp_next_sdt_sections );
-    psi_table_init( pp_next_sdt_sections );
+    psi_table_copy( pp_old_sdt_sections, p_demux->pp_current_sdt_sections );
+    psi_table_copy( p_demux->pp_current_sdt_sections, p_demux->pp_next_sdt_sections );
+    psi_table_init( p_demux->pp_next_sdt_sections );
+    p_demux->i_si_generation++;
 
     for ( i = 0; i <= i_last_section; i++ )
     {
         uint8_t *p_section =
-            psi_table_get_section( pp_current_sdt_sections, i );
+            psi_table_get_section( p_demux->pp_current_sdt_sections, i );
         uint8_t *p_service;
         j = 0;
 
@@ -2609,20 +3825,20 @@ static void HandleSDT( mtime_t i_dts )
                 uint16_t i_sid = sdtn_get_sid( p_service );
                 j++;
 
-                if ( sdt_table_find_service( pp_current_sdt_sections, i_sid )
+                if ( sdt_table_find_service( p_demux->pp_current_sdt_sections, i_sid )
                       == NULL )
                     UpdateSDT( i_sid );
             }
         }
 
-        psi_table_free( pp_old_sdt_sections );
+        SectionTableFree( pp_old_sdt_sections );
     }
 
-    sdt_table_print( pp_current_sdt_sections, msg_Dbg, NULL,
+    sdt_table_print( p_demux->pp_current_sdt_sections, msg_Dbg, NULL,
                      demux_Iconv, NULL, PRINT_TEXT );
     if ( b_print_enabled )
     {
-        sdt_table_print( pp_current_sdt_sections, demux_Print, NULL,
+        sdt_table_print( p_demux->pp_current_sdt_sections, demux_Print, NULL,
                          demux_Iconv, NULL, i_print_type );
         if ( i_print_type == PRINT_XML )
             printf("\n");
@@ -2649,29 +3865,130 @@ static void HandleSDTSection( uint16_t i_pid, uint8_t *p_section,
         default:
             printf("invalid SDT section received on PID %hu\n", i_pid);
         }
-        free( p_section );
+        SectionRelease( p_section );
         return;
     }
 
-    if ( !psi_table_section( pp_next_sdt_sections, p_section ) )
+    if ( !SectionTableAdd( p_demux->pp_next_sdt_sections, p_section ) )
         return;
 
     HandleSDT( i_dts );
 }
 
+/*****************************************************************************
+ * FreeEITSchedule
+ *****************************************************************************/
+static void FreeEITSchedule( sid_t *p_sid )
+{
+    bool b_change = false;
+    int i;
+
+    for ( i = 0; i < EIT_SCHEDULE_TABLES; i++ )
+    {
+        if ( p_sid->ppp_eit_schedule[i] == NULL )
+            continue;
+
+        psi_table_free( p_sid->ppp_eit_schedule[i] );
+        free( p_sid->ppp_eit_schedule[i] );
+        p_sid->ppp_eit_schedule[i] = NULL;
+        b_change = true;
+    }
+
+    if ( b_change )
+        p_sid->i_eit_schedule_version = ++i_eit_schedule_generation;
+}
+
+/*****************************************************************************
+ * SIDWantsEITCarousel
+ *****************************************************************************/
+static bool SIDWantsEITCarousel( uint16_t i_sid )
+{
+    int i, i_nb_sid_outputs;
+    output_t **pp_sid_outputs = GetSIDOutputs( i_sid, &i_nb_sid_outputs );
+
+    for ( i = 0; i < i_nb_sid_outputs; i++ )
+        if ( (pp_sid_outputs[i]->config.i_config & OUTPUT_EPG)
+             && pp_sid_outputs[i]->config.i_epg_rate )
+            return true;
+
+    return false;
+}
+
+/*****************************************************************************
+ * StoreEITSchedule : keep a copy of a schedule section for the carousel
+ *****************************************************************************/
+static void StoreEITSchedule( sid_t *p_sid, uint8_t *p_eit )
+{
+    uint8_t i_table = psi_get_tableid( p_eit )
+                       - EIT_TABLE_ID_SCHED_ACTUAL_FIRST;
+    uint8_t i_section = psi_get_section( p_eit );
+    uint8_t i_last_section = psi_get_lastsection( p_eit );
+    uint8_t i_last_table = eit_get_last_table_id( p_eit )
+                            - EIT_TABLE_ID_SCHED_ACTUAL_FIRST;
+    uint8_t **pp_sections = p_sid->ppp_eit_schedule[i_table];
+    int i;
+
+    if ( pp_sections == NULL )
+    {
+        pp_sections = p_sid->ppp_eit_schedule[i_table] =
+            malloc( sizeof(uint8_t *) * PSI_TABLE_MAX_SECTIONS );
+        psi_table_init( pp_sections );
+    }
+    else if ( pp_sections[i_section] != NULL
+               && psi_compare( pp_sections[i_section], p_eit ) )
+        /* Identical section. Shortcut. */
+        return;
+    else
+    {
+        /* A new version replaces all the sections of the previous one,
+         * including those in the gaps of a segmented schedule. */
+        for ( i = 0; i < PSI_TABLE_MAX_SECTIONS; i++ )
+            if ( pp_sections[i] != NULL )
+                break;
+        if ( i < PSI_TABLE_MAX_SECTIONS
+              && psi_get_version( pp_sections[i] ) != psi_get_version( p_eit ) )
+        {
+            psi_table_free( pp_sections );
+            psi_table_init( pp_sections );
+        }
+    }
+
+    free( pp_sections[i_section] );
+    pp_sections[i_section] = psi_allocate();
+    psi_copy( pp_sections[i_section], p_eit );
+
+    /* Drop what a new version of the schedule no longer announces. */
+    for ( i = i_last_section + 1; i < PSI_TABLE_MAX_SECTIONS; i++ )
+    {
+        free( pp_sections[i] );
+        pp_sections[i] = NULL;
+    }
+    for ( i = i_last_table + 1; i < EIT_SCHEDULE_TABLES; i++ )
+    {
+        if ( p_sid->ppp_eit_schedule[i] == NULL )
+            continue;
+        psi_table_free( p_sid->ppp_eit_schedule[i] );
+        free( p_sid->ppp_eit_schedule[i] );
+        p_sid->ppp_eit_schedule[i] = NULL;
+    }
+
+    p_sid->i_eit_schedule_version = ++i_eit_schedule_generation;
+}
+
 /*****************************************************************************
  * HandleEITSection
  *****************************************************************************/
 static void HandleEIT( uint16_t i_pid, uint8_t *p_eit, mtime_t i_dts )
 {
     uint16_t i_sid = eit_get_sid( p_eit );
+    uint8_t i_table_id = psi_get_tableid( p_eit );
     sid_t *p_sid;
 
     p_sid = FindSID( i_sid );
     if ( p_sid == NULL )
     {
         /* Not a selected program. */
-        free( p_eit );
+        SectionRelease( p_eit );
         return;
     }
 
@@ -2686,12 +4003,17 @@ static void HandleEIT( uint16_t i_pid, uint8_t *p_eit, mtime_t i_dts )
         default:
             printf("invalid EIT section received on PID %hu\n", i_pid);
         }
-        free( p_eit );
+        SectionRelease( p_eit );
         return;
     }
 
+    if ( i_table_id >= EIT_TABLE_ID_SCHED_ACTUAL_FIRST
+          && i_table_id <= EIT_TABLE_ID_SCHED_ACTUAL_LAST
+          && SIDWantsEITCarousel( i_sid ) )
+        StoreEITSchedule( p_sid, p_eit );
+
     SendEIT( p_sid, i_dts, p_eit );
-    free( p_eit );
+    SectionRelease( p_eit );
 }
 
 /*****************************************************************************
@@ -2711,14 +4033,14 @@ static void HandleSection( uint16_t i_pid, uint8_t *p_section, mtime_t i_dts )
         default:
             printf("invalid section on PID %hu\n", i_pid);
         }
-        free( p_section );
+        SectionRelease( p_section );
         return;
     }
 
     if ( !psi_get_current( p_section ) )
     {
         /* Ignore sections which are not in use yet. */
-        free( p_section );
+        SectionRelease( p_section );
         return;
     }
 
@@ -2731,6 +4053,8 @@ static void HandleSection( uint16_t i_pid, uint8_t *p_section, mtime_t i_dts )
     case CAT_TABLE_ID:
         if ( b_enable_emm )
             HandleCATSection( i_pid, p_section, i_dts );
+        else
+            SectionRelease( p_section );
         break;
 
     case PMT_TABLE_ID:
@@ -2753,7 +4077,7 @@ static void HandleSection( uint16_t i_pid, uint8_t *p_section, mtime_t i_dts )
             HandleEIT( i_pid, p_section, i_dts );
             break;
         }
-        free( p_section );
+        SectionRelease( p_section );
         break;
     }
 }
@@ -2764,7 +4088,7 @@ static void HandleSection( uint16_t i_pid, uint8_t *p_section, mtime_t i_dts )
 static void HandlePSIPacket( uint8_t *p_ts, mtime_t i_dts )
 {
     uint16_t i_pid = ts_get_pid( p_ts );
-    ts_pid_t *p_pid = &p_pids[i_pid];
+    ts_pid_t *p_pid = &p_demux->p_pids[i_pid];
     uint8_t i_cc = ts_get_cc( p_ts );
     const uint8_t *p_payload;
     uint8_t i_length;
@@ -2775,17 +4099,14 @@ static void HandlePSIPacket( uint8_t *p_ts, mtime_t i_dts )
 
     if ( p_pid->i_last_cc != -1
           && ts_check_discontinuity( i_cc, p_pid->i_last_cc ) )
-        psi_assemble_reset( &p_pid->p_psi_buffer, &p_pid->i_psi_buffer_used );
+        SectionAssembleReset( p_pid );
 
     p_payload = ts_section( p_ts );
     i_length = p_ts + TS_SIZE - p_payload;
 
-    if ( !psi_assemble_empty( &p_pid->p_psi_buffer,
-                              &p_pid->i_psi_buffer_used ) )
+    if ( p_pid->p_psi_buffer != NULL )
     {
-        uint8_t *p_section = psi_assemble_payload( &p_pid->p_psi_buffer,
-                                                   &p_pid->i_psi_buffer_used,
-                                                   &p_payload, &i_length );
+        uint8_t *p_section = SectionAssemble( i_pid, &p_payload, &i_length );
         if ( p_section != NULL )
             HandleSection( i_pid, p_section, i_dts );
     }
@@ -2795,14 +4116,336 @@ static void HandlePSIPacket( uint8_t *p_ts, mtime_t i_dts )
 
     while ( i_length )
     {
-        uint8_t *p_section = psi_assemble_payload( &p_pid->p_psi_buffer,
-                                                   &p_pid->i_psi_buffer_used,
-                                                   &p_payload, &i_length );
+        uint8_t *p_section = SectionAssemble( i_pid, &p_payload, &i_length );
         if ( p_section != NULL )
             HandleSection( i_pid, p_section, i_dts );
     }
 }
 
+/*****************************************************************************
+ * PSICacheFile, PSICacheKey : file and source of the cache of the current
+ * input
+ *****************************************************************************/
+static void PSICacheFile( char *psz_file, size_t i_size )
+{
+    if ( p_demux->i_input == 0 )
+        snprintf( psz_file, i_size, "%s", psz_psi_cache );
+    else
+        snprintf( psz_file, i_size, "%s.%s", psz_psi_cache,
+                  p_inputs[p_demux->i_input].psz_name );
+}
+
+static void PSICacheKey( char *psz_key, size_t i_size )
+{
+    if ( p_demux->i_input != 0 )
+        snprintf( psz_key, i_size, "udp %s",
+                  p_inputs[p_demux->i_input].psz_src );
+    else if ( i_frequency )
+        snprintf( psz_key, i_size, "dvb %d %d", i_adapter, i_frequency );
+    else if ( psz_udp_src != NULL && psz_backup_src == NULL )
+        snprintf( psz_key, i_size, "udp %s", psz_udp_src );
+    else
+        snprintf( psz_key, i_size, "asi %d", i_asi_adapter );
+}
+
+/*****************************************************************************
+ * ReadPSI : handle the cached tables of the current input as if they had
+ * just been received
+ *****************************************************************************/
+static void ReadPSI( FILE *p_file, const char *psz_file )
+{
+    char psz_key[64];
+    psi_cache_header_t header;
+    psi_cache_record_t record;
+    int i_nb_sections = 0;
+
+    PSICacheKey( psz_key, sizeof(psz_key) );
+    if ( fread( &header, sizeof(header), 1, p_file ) != 1
+          || header.i_magic != PSI_CACHE_MAGIC
+          || header.i_version != PSI_CACHE_VERSION )
+    {
+        msg_Warn( NULL, "ignoring invalid PSI cache %s", psz_file );
+        return;
+    }
+    header.psz_key[sizeof(header.psz_key) - 1] = '\0';
+    if ( strcmp( header.psz_key, psz_key ) )
+    {
+        msg_Warn( NULL, "ignoring PSI cache %s of another source (%s)",
+                  psz_file, header.psz_key );
+        return;
+    }
+
+    while ( fread( &record, sizeof(record), 1, p_file ) == 1 )
+    {
+        uint8_t *p_data, *p_end, *p;
+
+        if ( record.i_pid >= MAX_PIDS
+              || record.i_size > PSI_TABLE_MAX_SECTIONS * SECTION_SLOT_SIZE )
+            break;
+        p_data = malloc( record.i_size );
+        if ( fread( p_data, record.i_size, 1, p_file ) != 1 )
+        {
+            free( p_data );
+            break;
+        }
+
+        p_end = p_data + record.i_size;
+        for ( p = p_data; p + PSI_HEADER_SIZE <= p_end;
+              p += psi_get_length( p ) + PSI_HEADER_SIZE )
+        {
+            unsigned int i_section_size = psi_get_length( p )
+                                           + PSI_HEADER_SIZE;
+            uint8_t *p_section;
+
+            if ( i_section_size > SECTION_SLOT_SIZE
+                  || p + i_section_size > p_end || !psi_check_crc( p ) )
+                break;
+            p_section = SectionGet( SectionPool( record.i_pid ) );
+            memcpy( p_section, p, i_section_size );
+            HandleSection( record.i_pid, p_section, mdate() );
+            i_nb_sections++;
+        }
+        free( p_data );
+    }
+
+    msg_Info( NULL, "preloaded %d PSI sections from %s", i_nb_sections,
+              psz_file );
+}
+
+static void LoadPSI( void )
+{
+    char psz_file[PATH_MAX];
+    FILE *p_file;
+
+    PSICacheFile( psz_file, sizeof(psz_file) );
+    if ( (p_file = fopen( psz_file, "r" )) == NULL )
+    {
+        if ( errno != ENOENT )
+            msg_Warn( NULL, "couldn't open PSI cache %s (%s)", psz_file,
+                      strerror(errno) );
+        return;
+    }
+    ReadPSI( p_file, psz_file );
+    fclose( p_file );
+}
+
+/*****************************************************************************
+ * SavePSI : write the current tables of the current input to its cache
+ *****************************************************************************/
+static void SavePSITable( FILE *p_file, uint16_t i_pid, uint8_t *p_data,
+                          unsigned int i_size )
+{
+    psi_cache_record_t record;
+
+    memset( &record, 0, sizeof(record) );
+    record.i_pid = i_pid;
+    record.i_size = i_size;
+    fwrite( &record, sizeof(record), 1, p_file );
+    fwrite( p_data, i_size, 1, p_file );
+}
+
+static void SavePSISections( FILE *p_file, uint16_t i_pid,
+                             uint8_t **pp_sections )
+{
+    unsigned int i_size;
+    uint8_t *p_packed;
+
+    if ( !psi_table_validate( pp_sections ) )
+        return;
+    p_packed = psi_pack_sections( pp_sections, &i_size );
+    if ( p_packed == NULL )
+        return;
+    SavePSITable( p_file, i_pid, p_packed, i_size );
+    free( p_packed );
+}
+
+static void WritePSI( FILE *p_file )
+{
+    psi_cache_header_t header;
+    int i;
+
+    memset( &header, 0, sizeof(header) );
+    header.i_magic = PSI_CACHE_MAGIC;
+    header.i_version = PSI_CACHE_VERSION;
+    PSICacheKey( header.psz_key, sizeof(header.psz_key) );
+    fwrite( &header, sizeof(header), 1, p_file );
+
+    SavePSISections( p_file, PAT_PID, p_demux->pp_current_pat_sections );
+    if ( b_enable_emm )
+        SavePSISections( p_file, CAT_PID, p_demux->pp_current_cat_sections );
+    SavePSISections( p_file, NIT_PID, p_demux->pp_current_nit_sections );
+    SavePSISections( p_file, SDT_PID, p_demux->pp_current_sdt_sections );
+    for ( i = 0; i < p_demux->i_nb_sids; i++ )
+    {
+        sid_t *p_sid = p_demux->pp_sids[i];
+        if ( p_sid->p_current_pmt != NULL )
+            SavePSITable( p_file, p_sid->i_pmt_pid, p_sid->p_current_pmt,
+                          psi_get_length( p_sid->p_current_pmt )
+                           + PSI_HEADER_SIZE );
+    }
+}
+
+static void SavePSI( void )
+{
+    char psz_file[PATH_MAX], psz_tmp[PATH_MAX + 4];
+    FILE *p_file;
+    bool b_error;
+
+    PSICacheFile( psz_file, sizeof(psz_file) );
+    snprintf( psz_tmp, sizeof(psz_tmp), "%s.tmp", psz_file );
+    if ( (p_file = fopen( psz_tmp, "w" )) == NULL )
+    {
+        msg_Warn( NULL, "couldn't write PSI cache %s (%s)", psz_tmp,
+                  strerror(errno) );
+        return;
+    }
+
+    WritePSI( p_file );
+
+    /* The cache is replaced at once, so a crash never leaves half of it. */
+    b_error = ferror( p_file );
+    if ( fclose( p_file ) != 0 || b_error
+          || rename( psz_tmp, psz_file ) < 0 )
+    {
+        msg_Warn( NULL, "couldn't write PSI cache %s (%s)", psz_file,
+                  strerror(errno) );
+        unlink( psz_tmp );
+    }
+}
+
+/*****************************************************************************
+ * demux_OpenPSICache : preload the cached tables of all inputs, unless
+ * they were handed over by the previous instance
+ *****************************************************************************/
+void demux_OpenPSICache( const char *psz_file, bool b_preload )
+{
+    int i;
+
+    psz_psi_cache = psz_file;
+    for ( i = 0; i < i_nb_inputs; i++ )
+    {
+        p_demux = pp_demuxes[i];
+        if ( b_preload )
+            LoadPSI();
+        p_demux->i_saved_psi_generation = p_demux->i_psi_generation;
+        p_demux->i_saved_si_generation = p_demux->i_si_generation;
+    }
+}
+
+/*****************************************************************************
+ * demux_SavePSI : update the caches of the inputs whose tables changed, at
+ * most every PSI_CACHE_PERIOD unless b_force
+ *****************************************************************************/
+void demux_SavePSI( bool b_force )
+{
+    int i;
+
+    if ( psz_psi_cache == NULL
+          || (!b_force && i_wallclock < i_last_psi_save + PSI_CACHE_PERIOD) )
+        return;
+    i_last_psi_save = i_wallclock;
+
+    for ( i = 0; i < i_nb_inputs; i++ )
+    {
+        p_demux = pp_demuxes[i];
+        if ( p_demux->i_saved_psi_generation == p_demux->i_psi_generation
+              && p_demux->i_saved_si_generation == p_demux->i_si_generation )
+            continue;
+        SavePSI();
+        p_demux->i_saved_psi_generation = p_demux->i_psi_generation;
+        p_demux->i_saved_si_generation = p_demux->i_si_generation;
+    }
+}
+
+/*****************************************************************************
+ * demux_PackPSI, demux_UnpackPSI : tables of an input, in the format of the
+ * PSI cache, for the handoff
+ *****************************************************************************/
+uint8_t *demux_PackPSI( int i_input, size_t *pi_size )
+{
+    char *p_data = NULL;
+    FILE *p_file = open_memstream( &p_data, pi_size );
+
+    if ( p_file == NULL )
+        return NULL;
+    p_demux = pp_demuxes[i_input];
+    WritePSI( p_file );
+    fclose( p_file );
+    return (uint8_t *)p_data;
+}
+
+void demux_UnpackPSI( int i_input, uint8_t *p_data, size_t i_size )
+{
+    FILE *p_file = fmemopen( p_data, i_size, "r" );
+
+    if ( p_file == NULL )
+        return;
+    p_demux = pp_demuxes[i_input];
+    ReadPSI( p_file, "handoff" );
+    fclose( p_file );
+    p_demux->i_saved_psi_generation = p_demux->i_psi_generation;
+    p_demux->i_saved_si_generation = p_demux->i_si_generation;
+}
+
+/*****************************************************************************
+ * demux_RestoreOutput : take the counters and table versions of an output
+ * of the previous instance
+ *****************************************************************************/
+void demux_RestoreOutput( output_t *p_output,
+                          const handoff_output_t *p_state,
+                          const handoff_service_t *p_services,
+                          const pid_cc_t *p_pid_cc )
+{
+    int i;
+    uint32_t j;
+
+    p_demux = pp_demuxes[p_output->config.i_input];
+
+    p_output->i_ref_timestamp = p_state->i_ref_timestamp;
+    p_output->i_ref_wallclock = p_state->i_ref_wallclock;
+    p_output->i_seqnum = p_state->i_seqnum;
+    p_output->i_tsid = p_state->i_tsid;
+    p_output->i_pat_cc = p_state->i_pat_cc;
+    p_output->i_pmt_cc = p_state->i_pmt_cc;
+    p_output->i_nit_cc = p_state->i_nit_cc;
+    p_output->i_sdt_cc = p_state->i_sdt_cc;
+    p_output->i_eit_cc = p_state->i_eit_cc;
+
+    /* New*() increment the versions as they build the tables again. */
+    p_output->i_pat_version = p_state->i_pat_version - 1;
+    p_output->i_pmt_version = p_state->i_pmt_version - 1;
+    p_output->i_nit_version = p_state->i_nit_version - 1;
+    p_output->i_sdt_version = p_state->i_sdt_version - 1;
+    for ( i = 0; i < p_output->config.i_nb_sids; i++ )
+    {
+        output_service_t *p_service = &p_output->p_services[i];
+
+        for ( j = 0; j < p_state->i_nb_services; j++ )
+            if ( p_services[j].i_sid == p_service->i_sid )
+            {
+                p_service->i_pmt_version = p_services[j].i_pmt_version - 1;
+                p_service->i_pmt_cc = p_services[j].i_pmt_cc;
+                break;
+            }
+    }
+
+    if ( p_state->i_nb_cc_pids )
+    {
+        p_output->p_pid_cc = realloc( p_output->p_pid_cc,
+                                      p_state->i_nb_cc_pids
+                                       * sizeof(pid_cc_t) );
+        memcpy( p_output->p_pid_cc, p_pid_cc,
+                p_state->i_nb_cc_pids * sizeof(pid_cc_t) );
+        p_output->i_nb_cc_pids = p_output->i_max_cc_pids =
+            p_state->i_nb_cc_pids;
+    }
+
+    NewSDT( p_output );
+    NewNIT( p_output );
+    NewPAT( p_output );
+    NewPMT( p_output );
+}
+
 /*****************************************************************************
  * PID info functions
  *****************************************************************************/
@@ -2861,12 +4504,12 @@ static const char *get_pid_desc(uint16_t i_pid, uint16_t *i_sid) {
     }
 
     /* Detect NIT pid */
-    if ( psi_table_validate( pp_current_pat_sections ) )
+    if ( psi_table_validate( p_demux->pp_current_pat_sections ) )
     {
-        i_last_section = psi_table_get_lastsection( pp_current_pat_sections );
+        i_last_section = psi_table_get_lastsection( p_demux->pp_current_pat_sections );
         for ( i = 0; i <= i_last_section; i++ )
         {
-            uint8_t *p_section = psi_table_get_section( pp_current_pat_sections, i );
+            uint8_t *p_section = psi_table_get_section( p_demux->pp_current_pat_sections, i );
             uint8_t *p_program;
 
             j = 0;
@@ -2883,12 +4526,12 @@ static const char *get_pid_desc(uint16_t i_pid, uint16_t *i_sid) {
     }
 
     /* Detect EMM pids */
-    if ( b_enable_emm && psi_table_validate( pp_current_cat_sections ) )
+    if ( b_enable_emm && psi_table_validate( p_demux->pp_current_cat_sections ) )
     {
-        i_last_section = psi_table_get_lastsection( pp_current_cat_sections );
+        i_last_section = psi_table_get_lastsection( p_demux->pp_current_cat_sections );
         for ( i = 0; i <= i_last_section; i++ )
         {
-            uint8_t *p_section = psi_table_get_section( pp_current_cat_sections, i );
+            uint8_t *p_section = psi_table_get_section( p_demux->pp_current_cat_sections, i );
 
             j = 0;
             while ( (p_desc = descl_get_desc( cat_get_descl(p_section), cat_get_desclength(p_section), j++ )) != NULL )
@@ -2904,9 +4547,9 @@ static const char *get_pid_desc(uint16_t i_pid, uint16_t *i_sid) {
     }
 
     /* Detect streams in PMT */
-    for ( k = 0; k < i_nb_sids; k++ )
+    for ( k = 0; k < p_demux->i_nb_sids; k++ )
     {
-        sid_t *p_sid = pp_sids[k];
+        sid_t *p_sid = p_demux->pp_sids[k];
         if ( p_sid->i_pmt_pid == i_pid )
         {
             if ( i_sid )
@@ -2966,27 +4609,66 @@ static const char *get_pid_desc(uint16_t i_pid, uint16_t *i_sid) {
     return "...";
 }
 
+/*****************************************************************************
+ * GetPIDDesc: get_pid_desc() cached per PID until PAT, CAT or a PMT changes
+ *****************************************************************************/
+static const char *GetPIDDesc( uint16_t i_pid, uint16_t *pi_sid )
+{
+    ts_pid_t *p_pid = &p_demux->p_pids[i_pid];
+
+    if ( p_pid->i_desc_generation != p_demux->i_psi_generation )
+    {
+        p_pid->i_desc_sid = 0;
+        p_pid->psz_desc = get_pid_desc( i_pid, &p_pid->i_desc_sid );
+        p_pid->i_desc_generation = p_demux->i_psi_generation;
+    }
+
+    *pi_sid = p_pid->i_desc_sid;
+    return p_pid->psz_desc;
+}
+
+/*****************************************************************************
+ * ReportError: allows one report per ERROR_REPORT_PERIOD, counting the others
+ *****************************************************************************/
+static bool ReportError( mtime_t *pi_last_report, unsigned int *pi_suppressed,
+                         unsigned int *pi_report_suppressed )
+{
+    if ( *pi_last_report && i_wallclock < *pi_last_report + ERROR_REPORT_PERIOD )
+    {
+        (*pi_suppressed)++;
+        return false;
+    }
+
+    *pi_last_report = i_wallclock;
+    *pi_report_suppressed = *pi_suppressed;
+    *pi_suppressed = 0;
+    return true;
+}
+
 /*****************************************************************************
  * Functions that return packed sections
  *****************************************************************************/
 uint8_t *demux_get_current_packed_PAT( unsigned int *pi_pack_size ) {
-    return psi_pack_sections( pp_current_pat_sections, pi_pack_size );
+    return psi_pack_sections( pp_demuxes[0]->pp_current_pat_sections, pi_pack_size );
 }
 
 uint8_t *demux_get_current_packed_CAT( unsigned int *pi_pack_size ) {
-    return psi_pack_sections( pp_current_cat_sections, pi_pack_size );
+    return psi_pack_sections( pp_demuxes[0]->pp_current_cat_sections, pi_pack_size );
 }
 
 uint8_t *demux_get_current_packed_NIT( unsigned int *pi_pack_size ) {
-    return psi_pack_sections( pp_current_nit_sections, pi_pack_size );
+    return psi_pack_sections( pp_demuxes[0]->pp_current_nit_sections, pi_pack_size );
 }
 
 uint8_t *demux_get_current_packed_SDT( unsigned int *pi_pack_size ) {
-    return psi_pack_sections( pp_current_sdt_sections, pi_pack_size );
+    return psi_pack_sections( pp_demuxes[0]->pp_current_sdt_sections, pi_pack_size );
 }
 
 uint8_t *demux_get_packed_PMT( uint16_t i_sid, unsigned int *pi_pack_size ) {
-    sid_t *p_sid = FindSID( i_sid );
+    sid_t *p_sid;
+
+    p_demux = pp_demuxes[0];
+    p_sid = FindSID( i_sid );
     if ( p_sid != NULL && p_sid->p_current_pmt && pmt_validate( p_sid->p_current_pmt ) )
         return psi_pack_section( p_sid->p_current_pmt, pi_pack_size );
     return NULL;
@@ -2994,7 +4676,16 @@ uint8_t *demux_get_packed_PMT( uint16_t i_sid, unsigned int *pi_pack_size ) {
 
 inline void demux_get_PID_info( uint16_t i_pid, uint8_t *p_data ) {
     ts_pid_info_t *p_info = (ts_pid_info_t *)p_data;
-    *p_info = p_pids[i_pid].info;
+    *p_info = pp_demuxes[0]->p_pids[i_pid].info;
+}
+
+void demux_get_section_pools_info( uint8_t *p_data )
+{
+    section_pool_info_t *p_info = (section_pool_info_t *)p_data;
+    int i;
+
+    for ( i = 0; i < SECTION_POOLS; i++ )
+        p_info[i] = p_section_pools[i].info;
 }
 
 inline void demux_get_PIDS_info( uint8_t *p_data ) {
@@ -3002,3 +4693,156 @@ inline void demux_get_PIDS_info( uint8_t *p_data ) {
     for (i_pid = 0; i_pid < MAX_PIDS; i_pid++ )
         demux_get_PID_info( i_pid, p_data + ( i_pid * sizeof(ts_pid_info_t) ) );
 }
+
+/* Compact statistics of a PID of the current demux */
+static void GetPIDEntry( uint16_t i_pid, ts_pid_entry_t *p_entry )
+{
+    ts_pid_t *p_pid = &p_demux->p_pids[i_pid];
+    mtime_t i_age = i_wallclock - p_pid->info.i_last_packet_ts;
+
+    p_entry->i_pid = i_pid;
+    p_entry->i_scrambling = p_pid->info.i_scrambling;
+    p_entry->i_reserved = 0;
+    p_entry->i_bytes_per_sec = p_pid->info.i_bytes_per_sec;
+    p_entry->i_packets = p_pid->info.i_packets;
+    p_entry->i_cc_errors = p_pid->info.i_cc_errors;
+    p_entry->i_transport_errors = p_pid->info.i_transport_errors;
+    p_entry->i_dropped = p_pid->info.i_dropped;
+    p_entry->i_last_seen = !p_pid->info.i_packets
+                            || i_age / 1000 > UINT32_MAX ?
+                           UINT32_MAX : i_age / 1000;
+}
+
+/*****************************************************************************
+ * demux_get_PIDS_sparse : statistics of the PIDs selected by i_flags only
+ *****************************************************************************/
+size_t demux_get_PIDS_sparse( uint8_t i_flags, uint16_t i_sid,
+                              uint32_t i_generation, uint8_t *p_data,
+                              size_t i_max_size )
+{
+    ts_pids_sparse_t *p_header = (ts_pids_sparse_t *)p_data;
+    ts_pid_entry_t *p_entry = (ts_pid_entry_t *)(p_header + 1);
+    bool pb_sid_pids[MAX_PIDS];
+    size_t i_size = sizeof(ts_pids_sparse_t);
+    int i_pid;
+
+    p_demux = pp_demuxes[0];
+
+    if ( i_flags & PIDS_SID )
+    {
+        sid_t *p_sid = FindSID( i_sid );
+        uint8_t *p_pmt = p_sid != NULL ? p_sid->p_current_pmt : NULL;
+
+        memset( pb_sid_pids, 0, sizeof(pb_sid_pids) );
+        if ( p_pmt != NULL )
+        {
+            uint8_t *p_es;
+            int j;
+
+            pb_sid_pids[p_sid->i_pmt_pid] = true;
+            pb_sid_pids[pmt_get_pcrpid( p_pmt )] = true;
+            for ( j = 0; (p_es = pmt_get_es( p_pmt, j )) != NULL; j++ )
+                pb_sid_pids[pmtn_get_pid( p_es )] = true;
+        }
+    }
+
+    p_header->i_generation = i_pids_generation++;
+    p_header->i_nb_pids = 0;
+
+    for ( i_pid = 0; i_pid < MAX_PIDS; i_pid++ )
+    {
+        ts_pid_t *p_pid = &p_demux->p_pids[i_pid];
+
+        if ( ((i_flags & PIDS_ACTIVE) && !p_pid->info.i_packets)
+              || ((i_flags & PIDS_CHANGED)
+                   && p_pid->i_info_generation <= i_generation)
+              || ((i_flags & PIDS_SID) && !pb_sid_pids[i_pid]) )
+            continue;
+        if ( i_size + sizeof(ts_pid_entry_t) > i_max_size )
+            break;
+
+        GetPIDEntry( i_pid, p_entry );
+        p_entry++;
+        p_header->i_nb_pids++;
+        i_size += sizeof(ts_pid_entry_t);
+    }
+
+    return i_size;
+}
+
+/*****************************************************************************
+ * demux_GetStats : input, PID and service counters of the stats file
+ *****************************************************************************/
+void demux_GetStats( stats_segment_t *p_stats )
+{
+    stats_input_t *p_input = &p_stats->input;
+    int i, i_pid;
+
+    p_demux = pp_demuxes[0];
+
+    memset( p_input, 0, sizeof(stats_input_t) );
+    p_input->i_last_seen = UINT32_MAX;
+    p_input->b_backup = p_demux->b_backup_input;
+    for ( i_pid = 0; i_pid < MAX_PIDS; i_pid++ )
+    {
+        ts_pid_entry_t *p_entry = &p_stats->pids[i_pid];
+
+        GetPIDEntry( i_pid, p_entry );
+        if ( !p_entry->i_packets )
+            continue;
+        p_input->i_nb_pids++;
+        p_input->i_packets += p_entry->i_packets;
+        p_input->i_cc_errors += p_entry->i_cc_errors;
+        p_input->i_transport_errors += p_entry->i_transport_errors;
+        p_input->i_bytes_per_sec += p_entry->i_bytes_per_sec;
+        if ( p_entry->i_last_seen < p_input->i_last_seen )
+            p_input->i_last_seen = p_entry->i_last_seen;
+    }
+
+    p_stats->i_nb_services = 0;
+    for ( i = 0; i < p_demux->i_nb_sids
+                  && p_stats->i_nb_services < STATS_MAX_SERVICES; i++ )
+    {
+        sid_t *p_sid = p_demux->pp_sids[i];
+        stats_service_t *p_service =
+            &p_stats->services[p_stats->i_nb_services];
+        uint8_t *p_pmt = p_sid->p_current_pmt;
+        uint16_t pi_pids[2 + PSI_MAX_SIZE / PMT_ES_SIZE];
+        int i_nb_pids = 0, j;
+
+        if ( !p_sid->i_sid )
+            continue;
+
+        memset( p_service, 0, sizeof(stats_service_t) );
+        p_service->i_sid = p_sid->i_sid;
+        p_service->i_pmt_pid = p_sid->i_pmt_pid;
+
+        pi_pids[i_nb_pids++] = p_sid->i_pmt_pid;
+        if ( p_pmt != NULL )
+        {
+            uint8_t *p_es;
+
+            if ( !IsIn( pi_pids, i_nb_pids, pmt_get_pcrpid( p_pmt ) ) )
+                pi_pids[i_nb_pids++] = pmt_get_pcrpid( p_pmt );
+            for ( j = 0; (p_es = pmt_get_es( p_pmt, j )) != NULL
+                          && i_nb_pids < 2 + PSI_MAX_SIZE / PMT_ES_SIZE;
+                  j++ )
+                if ( !IsIn( pi_pids, i_nb_pids, pmtn_get_pid( p_es ) ) )
+                    pi_pids[i_nb_pids++] = pmtn_get_pid( p_es );
+        }
+
+        for ( j = 0; j < i_nb_pids; j++ )
+        {
+            ts_pid_entry_t *p_entry = &p_stats->pids[pi_pids[j]];
+
+            p_service->i_packets += p_entry->i_packets;
+            p_service->i_bytes_per_sec += p_entry->i_bytes_per_sec;
+            p_service->i_cc_errors += p_entry->i_cc_errors;
+            p_service->i_transport_errors += p_entry->i_transport_errors;
+            if ( p_entry->i_scrambling )
+                p_service->b_scrambled = 1;
+        }
+        p_service->i_nb_pids = i_nb_pids;
+        p_stats->i_nb_services++;
+    }
+}
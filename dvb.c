@@ -55,6 +55,7 @@
 #define MAX_DELIVERY_SYSTEMS 20
 
 #include "dvblast.h"
+#include "handoff.h"
 #include "en50221.h"
 #include "comm.h"
 
@@ -98,14 +99,28 @@ void dvb_Open( void )
     if ( i_frequency )
     {
         sprintf( psz_tmp, "/dev/dvb/adapter%d/frontend%d", i_adapter, i_fenum );
-        if( (i_frontend = open(psz_tmp, O_RDWR | O_NONBLOCK)) < 0 )
+        if ( (i_frontend = handoff_TakeFd( HANDOFF_FD_DEVICE,
+                                           psz_tmp )) != -1 )
         {
-            msg_Err( NULL, "opening device %s failed (%s)", psz_tmp,
-                     strerror(errno) );
-            exit(1);
+            /* Already tuned by the previous instance */
+            if ( ioctl( i_frontend, FE_READ_STATUS, &i_last_status ) < 0 )
+                i_last_status = 0;
+            i_frontend_timeout = (i_last_status & FE_HAS_LOCK) ? 0 :
+                                 i_wallclock + i_frontend_timeout_duration;
+            msg_Dbg( NULL, "taking over device %s", psz_tmp );
         }
+        else
+        {
+            if( (i_frontend = open(psz_tmp, O_RDWR | O_NONBLOCK)) < 0 )
+            {
+                msg_Err( NULL, "opening device %s failed (%s)", psz_tmp,
+                         strerror(errno) );
+                exit(1);
+            }
 
-        FrontendSet(true);
+            FrontendSet(true);
+        }
+        handoff_AddFd( HANDOFF_FD_DEVICE, psz_tmp, i_frontend );
     }
     else
     {
@@ -114,18 +129,25 @@ void dvb_Open( void )
 
     sprintf( psz_tmp, "/dev/dvb/adapter%d/dvr%d", i_adapter, i_fenum );
 
-    if( (i_dvr = open(psz_tmp, O_RDONLY | O_NONBLOCK)) < 0 )
+    if ( (i_dvr = handoff_TakeFd( HANDOFF_FD_DEVICE, psz_tmp )) != -1 )
+        msg_Dbg( NULL, "taking over device %s", psz_tmp );
+    else
     {
-        msg_Err( NULL, "opening device %s failed (%s)", psz_tmp,
-                 strerror(errno) );
-        exit(1);
-    }
+        if( (i_dvr = open(psz_tmp, O_RDONLY | O_NONBLOCK)) < 0 )
+        {
+            msg_Err( NULL, "opening device %s failed (%s)", psz_tmp,
+                     strerror(errno) );
+            exit(1);
+        }
 
-    if ( ioctl( i_dvr, DMX_SET_BUFFER_SIZE, i_dvr_buffer_size ) < 0 )
-    {
-        msg_Warn( NULL, "couldn't set %s buffer size (%s)", psz_tmp,
-                 strerror(errno) );
+        if ( ioctl( i_dvr, DMX_SET_BUFFER_SIZE, i_dvr_buffer_size ) < 0 )
+        {
+            msg_Warn( NULL, "couldn't set %s buffer size (%s)", psz_tmp,
+                     strerror(errno) );
+        }
     }
+    /* Registered again when taken over, for the next upgrade */
+    handoff_AddFd( HANDOFF_FD_DEVICE, psz_tmp, i_dvr );
 
     en50221_Init();
     i_ca_next_event = mdate() + CA_POLL_PERIOD;
@@ -293,6 +315,14 @@ int dvb_SetFilter( uint16_t i_pid )
     char psz_tmp[128];
     int i_fd;
 
+    sprintf( psz_tmp, "pid %u", i_pid );
+    if ( (i_fd = handoff_TakeFd( HANDOFF_FD_FILTER, psz_tmp )) != -1 )
+    {
+        msg_Dbg( NULL, "taking over filter on PID %d", i_pid );
+        handoff_AddFd( HANDOFF_FD_FILTER, psz_tmp, i_fd );
+        return i_fd;
+    }
+
     sprintf( psz_tmp, "/dev/dvb/adapter%d/demux%d", i_adapter, i_fenum );
     if( (i_fd = open(psz_tmp, O_RDWR)) < 0 )
     {
@@ -316,6 +346,8 @@ int dvb_SetFilter( uint16_t i_pid )
     }
 
     msg_Dbg( NULL, "setting filter on PID %d", i_pid );
+    sprintf( psz_tmp, "pid %u", i_pid );
+    handoff_AddFd( HANDOFF_FD_FILTER, psz_tmp, i_fd );
 
     return i_fd;
 }
@@ -325,11 +357,16 @@ int dvb_SetFilter( uint16_t i_pid )
  *****************************************************************************/
 void dvb_UnsetFilter( int i_fd, uint16_t i_pid )
 {
-    if ( ioctl( i_fd, DMX_STOP ) < 0 )
-        msg_Err( NULL, "DMX_STOP failed (%s)", strerror(errno) );
-    else
-        msg_Dbg( NULL, "unsetting filter on PID %d", i_pid );
+    /* After a handoff, the filter is shared with the new instance. */
+    if ( !handoff_Done() )
+    {
+        if ( ioctl( i_fd, DMX_STOP ) < 0 )
+            msg_Err( NULL, "DMX_STOP failed (%s)", strerror(errno) );
+        else
+            msg_Dbg( NULL, "unsetting filter on PID %d", i_pid );
+    }
 
+    handoff_RemoveFd( i_fd );
     close( i_fd );
 }
 
@@ -395,6 +432,7 @@ static void FrontendPoll( void )
             {
                 int32_t i_value = 0;
                 msg_Info( NULL, "frontend has acquired lock" );
+                comm_Event( EVENT_LOCK, EVENT_ANY_PID, 0, 1, 0 );
                 switch (i_print_type) {
                 case PRINT_XML:
                     printf("<STATUS type=\"lock\" status=\"1\" />\n");
@@ -419,6 +457,7 @@ static void FrontendPoll( void )
             else
             {
                 msg_Dbg( NULL, "frontend has lost lock" );
+                comm_Event( EVENT_LOCK, EVENT_ANY_PID, 0, 0, 0 );
                 switch (i_print_type) {
                 case PRINT_XML:
                     printf("<STATUS type=\"lock\" status=\"0\"/>\n");
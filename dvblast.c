@@ -49,6 +49,9 @@
 
 #include "mrtg-cnt.h"
 #include "sap.h"
+#include "stats.h"
+#include "metrics.h"
+#include "handoff.h"
 
 /*****************************************************************************
  * Local declarations
@@ -59,6 +62,7 @@ int i_nb_outputs = 0;
 output_t output_dup;
 static char *psz_conf_file = NULL;
 char *psz_srv_socket = NULL;
+char *psz_srv_stream_socket = NULL;
 static int i_priority = -1;
 int i_adapter = 0;
 int i_fenum = 0;
@@ -92,6 +96,12 @@ uint16_t i_network_id = 0xffff;
 uint8_t *p_network_name;
 size_t i_network_name_size;
 char *psz_udp_src = NULL;
+char *psz_backup_src = NULL;
+input_t *p_inputs = NULL;
+int i_nb_inputs = 0;
+static bool b_on_backup = false;
+static mtime_t i_primary_last = 0, i_primary_since = 0, i_backup_last = 0;
+static mtime_t i_inputs_start = 0;
 int i_asi_adapter = 0;
 const char *psz_native_charset = "UTF-8";
 const char *psz_dvb_charset = "ISO-8859-1";
@@ -117,9 +127,15 @@ static bool b_epg_global = false;
 static mtime_t i_latency_global = DEFAULT_OUTPUT_LATENCY;
 static mtime_t i_retention_global = DEFAULT_MAX_RETENTION;
 static int i_ttl_global = 64;
+static int i_epg_rate_global = 0;
+static int i_epg_days_global = 0;
 
 /* TPS Input log filename */
 char * psz_mrtg_file = NULL;
+static const char *psz_stats_file = NULL;
+static const char *psz_metrics_addr = NULL;
+static const char *psz_psi_cache = NULL;
+static const char *psz_handoff_socket = NULL;
 
 /* PID mapping */
 bool b_do_remap = false;
@@ -149,6 +165,7 @@ void config_Init( output_config_t *p_config )
     p_config->i_if_index_v6 = -1;
     p_config->i_srcport = 0;
 
+    p_config->pi_sids = NULL;
     p_config->pi_pids = NULL;
     p_config->b_do_remap = false;
     unsigned int i;
@@ -162,7 +179,10 @@ void config_Free( output_config_t *p_config )
     free( p_config->psz_displayname );
     free( p_config->psz_service_name );
     free( p_config->psz_service_provider );
+    free( p_config->pi_sids );
     free( p_config->pi_pids );
+    free( p_config->pi_low_pids );
+    free( p_config->pi_low_sids );
     free( p_config->psz_srcaddr );
 }
 
@@ -177,6 +197,8 @@ static void config_Defaults( output_config_t *p_config )
     p_config->i_output_latency = i_latency_global;
     p_config->i_tsid = -1;
     p_config->i_ttl = i_ttl_global;
+    p_config->i_epg_rate = i_epg_rate_global;
+    p_config->i_epg_days = i_epg_days_global;
     memcpy( p_config->pi_ssrc, pi_ssrc_global, 4 * sizeof(uint8_t) );
 }
 
@@ -198,6 +220,43 @@ char *config_stropt( char *psz_string )
     return ret;
 }
 
+/* Comma-separated list of numbers, ended by anything else */
+static void config_ParseList( const char *psz_list, uint16_t **ppi_list,
+                              int *pi_nb )
+{
+    char *psz_end;
+
+    free( *ppi_list );
+    *ppi_list = NULL;
+    *pi_nb = 0;
+
+    for ( ; ; )
+    {
+        long i_value = strtol( psz_list, &psz_end, 0 );
+        if ( psz_end == psz_list )
+            break;
+
+        *ppi_list = realloc( *ppi_list, (*pi_nb + 1) * sizeof(uint16_t) );
+        (*ppi_list)[(*pi_nb)++] = i_value;
+        if ( *psz_end != ',' )
+            break;
+        psz_list = psz_end + 1;
+    }
+}
+
+/*****************************************************************************
+ * input_Find : index of the input with the given name, or -1
+ *****************************************************************************/
+int input_Find( const char *psz_name )
+{
+    int i;
+
+    for ( i = 0; i < i_nb_inputs; i++ )
+        if ( !strcmp( p_inputs[i].psz_name, psz_name ) )
+            return i;
+    return -1;
+}
+
 bool config_ParseHost( output_config_t *p_config, char *psz_string )
 {
     struct addrinfo *p_ai;
@@ -237,6 +296,11 @@ bool config_ParseHost( output_config_t *p_config, char *psz_string )
             p_config->i_config |= OUTPUT_UDP;
         else if ( IS_OPTION("dvb") )
             p_config->i_config |= OUTPUT_DVB;
+        else if ( IS_OPTION("epgrate=") )
+            p_config->i_epg_rate = strtol( ARG_OPTION("epgrate="),
+                                           NULL, 0 ) * 1000;
+        else if ( IS_OPTION("epgdays=") )
+            p_config->i_epg_days = strtol( ARG_OPTION("epgdays="), NULL, 0 );
         else if ( IS_OPTION("epg") )
             p_config->i_config |= OUTPUT_EPG;
         else if ( IS_OPTION("tsid=") )
@@ -247,6 +311,32 @@ bool config_ParseHost( output_config_t *p_config, char *psz_string )
         else if ( IS_OPTION("latency=") )
             p_config->i_output_latency = strtoll( ARG_OPTION("latency="),
                                                   NULL, 0 ) * 1000;
+        else if ( IS_OPTION("cbr=") )
+        {
+            long long i_cbr_rate = strtoll( ARG_OPTION("cbr="), NULL, 0 );
+            if ( i_cbr_rate <= 0 || i_cbr_rate > MAX_CBR_RATE / 1000 )
+            {
+                msg_Err( NULL, "invalid CBR rate %s", ARG_OPTION("cbr=") );
+                return false;
+            }
+            p_config->i_cbr_rate = i_cbr_rate * 1000;
+        }
+        else if ( IS_OPTION("nopad") )
+            p_config->i_config |= OUTPUT_NOPAD;
+        else if ( IS_OPTION("nonull") )
+            p_config->i_config |= OUTPUT_NONULL;
+        else if ( IS_OPTION("cc") )
+            p_config->i_config |= OUTPUT_CC;
+        else if ( IS_OPTION("adaptive") )
+            p_config->i_config |= OUTPUT_ADAPTIVE;
+        else if ( IS_OPTION("statmux") )
+            p_config->i_config |= OUTPUT_STATMUX;
+        else if ( IS_OPTION("lowpids=") )
+            config_ParseList( ARG_OPTION("lowpids="), &p_config->pi_low_pids,
+                              &p_config->i_nb_low_pids );
+        else if ( IS_OPTION("lowsids=") )
+            config_ParseList( ARG_OPTION("lowsids="), &p_config->pi_low_sids,
+                              &p_config->i_nb_low_sids );
         else if ( IS_OPTION("ttl=") )
             p_config->i_ttl = strtol( ARG_OPTION("ttl="), NULL, 0 );
         else if ( IS_OPTION("tos=") )
@@ -265,6 +355,15 @@ bool config_ParseHost( output_config_t *p_config, char *psz_string )
             free( p_config->psz_service_provider );
             p_config->psz_service_provider = config_stropt( ARG_OPTION("srvprovider=") );
         }
+        else if ( IS_OPTION("input=") )
+        {
+            p_config->i_input = input_Find( ARG_OPTION("input=") );
+            if ( p_config->i_input < 0 )
+            {
+                msg_Err( NULL, "unknown input %s", ARG_OPTION("input=") );
+                return false;
+            }
+        }
         else if ( IS_OPTION("srcaddr=") )
         {
             if ( p_config->i_family != AF_INET ) {
@@ -310,6 +409,12 @@ bool config_ParseHost( output_config_t *p_config, char *psz_string )
     if ( !p_config->psz_service_provider && psz_provider_name )
         p_config->psz_service_provider = strdup( psz_provider_name );
 
+    if ( (p_config->i_config & OUTPUT_STATMUX) && !p_config->i_cbr_rate )
+    {
+        msg_Warn( NULL, "/statmux needs a /cbr rate, ignoring" );
+        p_config->i_config &= ~OUTPUT_STATMUX;
+    }
+
 end:
     i_mtu = p_config->i_family == AF_INET6 ? DEFAULT_IPV6_MTU :
             DEFAULT_IPV4_MTU;
@@ -325,6 +430,87 @@ end:
     return true;
 }
 
+/*****************************************************************************
+ * config_ParseSIDs : comma-separated list of services for an MPTS output
+ *****************************************************************************/
+static void config_ParseSIDs( output_config_t *p_config, char *psz_sids )
+{
+    char *psz_token, *psz_parser = NULL;
+    int i;
+
+    for ( ; ; psz_sids = NULL )
+    {
+        uint16_t i_sid;
+
+        psz_token = strtok_r( psz_sids, ",", &psz_parser );
+        if ( psz_token == NULL )
+            break;
+        i_sid = strtol( psz_token, NULL, 0 );
+        if ( !i_sid )
+            continue;
+
+        for ( i = 0; i < p_config->i_nb_sids; i++ )
+            if ( p_config->pi_sids[i] == i_sid )
+                break;
+        if ( i != p_config->i_nb_sids )
+            continue;
+
+        if ( p_config->i_nb_sids == MAX_MPTS_SERVICES )
+        {
+            msg_Warn( NULL, "%s: too many services, ignoring %hu",
+                      p_config->psz_displayname, i_sid );
+            continue;
+        }
+        p_config->pi_sids = realloc( p_config->pi_sids,
+                            (p_config->i_nb_sids + 1) * sizeof(uint16_t) );
+        p_config->pi_sids[p_config->i_nb_sids++] = i_sid;
+    }
+
+    p_config->i_sid = p_config->i_nb_sids ? p_config->pi_sids[0] : 0;
+    if ( p_config->i_nb_sids < 2 )
+    {
+        /* A single service is a plain SPTS output. */
+        free( p_config->pi_sids );
+        p_config->pi_sids = NULL;
+        p_config->i_nb_sids = 0;
+    }
+}
+
+/*****************************************************************************
+ * config_CheckMPTS : drop the options that only make sense for one service
+ *****************************************************************************/
+static void config_CheckMPTS( output_config_t *p_config )
+{
+    if ( p_config->i_nb_pids )
+    {
+        msg_Warn( NULL, "%s: PID list ignored for an MPTS output",
+                  p_config->psz_displayname );
+        free( p_config->pi_pids );
+        p_config->pi_pids = NULL;
+        p_config->i_nb_pids = 0;
+    }
+    if ( p_config->i_new_sid || p_config->b_do_remap )
+    {
+        msg_Warn( NULL, "%s: newsid and pidmap ignored for an MPTS output",
+                  p_config->psz_displayname );
+        p_config->i_new_sid = 0;
+        p_config->b_do_remap = false;
+    }
+    if ( p_config->i_epg_rate )
+    {
+        msg_Warn( NULL, "%s: EIT carousel disabled for an MPTS output",
+                  p_config->psz_displayname );
+        p_config->i_epg_rate = 0;
+    }
+    if ( p_config->psz_service_name != NULL )
+    {
+        msg_Warn( NULL, "%s: service name ignored for an MPTS output",
+                  p_config->psz_displayname );
+        free( p_config->psz_service_name );
+        p_config->psz_service_name = NULL;
+    }
+}
+
 static void config_Print( output_config_t *p_config )
 {
     const char *psz_base = "conf: %s config=0x%"PRIx64" sid=%hu pids[%d]=";
@@ -339,13 +525,118 @@ static void config_Print( output_config_t *p_config )
 
     msg_Dbg( NULL, psz_format, p_config->psz_displayname, p_config->i_config,
              p_config->i_sid, p_config->i_nb_pids );
+    if ( p_config->i_nb_sids )
+        msg_Dbg( NULL, "conf: %s carries %d services", p_config->psz_displayname,
+                 p_config->i_nb_sids );
+}
+
+/*****************************************************************************
+ * config_CloseOutput : close an output removed from the configuration
+ *****************************************************************************/
+static void config_CloseOutput( output_t *p_output )
+{
+    output_config_t config;
+
+    config_Init( &config );
+    config.i_input = p_output->config.i_input;
+    msg_Dbg( NULL, "closing %s", p_output->config.psz_displayname );
+    demux_Change( p_output, &config );
+    output_Close( p_output );
+    config_Free( &config );
+}
+
+/*****************************************************************************
+ * config_ParseLine : parse a configuration line, without comments
+ *****************************************************************************/
+static bool config_ParseLine( output_config_t *p_config, char *psz_line )
+{
+    char *psz_token, *psz_parser;
+
+    config_Defaults( p_config );
+
+    psz_token = strtok_r( psz_line, "\t\n ", &psz_parser );
+    if ( psz_token == NULL || !config_ParseHost( p_config, psz_token ))
+        return false;
+
+    psz_token = strtok_r( NULL, "\t\n ", &psz_parser );
+    if ( psz_token == NULL )
+        return false;
+    if( atoi( psz_token ) == 1 )
+        p_config->i_config |= OUTPUT_WATCH;
+    else
+        p_config->i_config &= ~OUTPUT_WATCH;
+
+    psz_token = strtok_r( NULL, "\t\n ", &psz_parser );
+    if ( psz_token == NULL )
+        return false;
+    if ( strchr( psz_token, ',' ) != NULL )
+        config_ParseSIDs( p_config, psz_token );
+    else
+        p_config->i_sid = strtol(psz_token, NULL, 0);
+
+    psz_token = strtok_r( NULL, "\t\n ", &psz_parser );
+    if ( psz_token != NULL )
+    {
+        psz_parser = NULL;
+        for ( ; ; )
+        {
+            psz_token = strtok_r( psz_token, ",", &psz_parser );
+            if ( psz_token == NULL )
+                break;
+            p_config->pi_pids = realloc( p_config->pi_pids,
+                             (p_config->i_nb_pids + 1) * sizeof(uint16_t) );
+            p_config->pi_pids[p_config->i_nb_pids++] =
+                strtol(psz_token, NULL, 0);
+            psz_token = NULL;
+        }
+    }
+
+    if ( p_config->i_nb_sids )
+        config_CheckMPTS( p_config );
+
+    config_Print( p_config );
+    return true;
+}
+
+/*****************************************************************************
+ * config_ApplyLine : create or change the output of a parsed line
+ *****************************************************************************/
+static output_t *config_ApplyLine( output_config_t *p_config,
+                                   const char *psz_line )
+{
+    output_t *p_output = output_Find( p_config );
+
+    /* An output cannot move to another demux context. */
+    if ( p_output != NULL
+          && p_output->config.i_input != p_config->i_input )
+    {
+        config_CloseOutput( p_output );
+        p_output = NULL;
+    }
+
+    if ( p_output == NULL )
+        p_output = output_Create( p_config );
+
+    if ( p_output != NULL )
+    {
+        free( p_output->config.psz_displayname );
+        p_output->config.psz_displayname = strdup( p_config->psz_displayname );
+
+        p_config->i_config |= OUTPUT_VALID | OUTPUT_STILL_PRESENT;
+        output_Change( p_output, p_config );
+        demux_Change( p_output, p_config );
+        output_SetConfigLine( p_output, psz_line );
+    }
+
+    return p_output;
 }
 
 static void config_ReadFile( char *psz_file )
 {
     FILE *p_file;
     char psz_line[2048];
-    int i;
+    mtime_t i_start = mdate();
+    int i, i_nb_lines = 0, i_nb_unchanged = 0, i_nb_closed = 0;
 
     if ( psz_file == NULL )
     {
@@ -363,7 +654,7 @@ static void config_ReadFile( char *psz_file )
     {
         output_config_t config;
         output_t *p_output;
-        char *psz_token, *psz_parser;
+        char *psz_parser, *psz_raw;
 
         psz_parser = strchr( psz_line, '#' );
         if ( psz_parser != NULL )
@@ -372,69 +663,22 @@ static void config_ReadFile( char *psz_file )
             *psz_parser-- = '\0';
         if ( psz_line[0] == '\0' )
             continue;
+        i_nb_lines++;
 
-        config_Defaults( &config );
-
-        psz_token = strtok_r( psz_line, "\t\n ", &psz_parser );
-        if ( psz_token == NULL || !config_ParseHost( &config, psz_token ))
-        {
-            config_Free( &config );
-            continue;
-        }
-
-        psz_token = strtok_r( NULL, "\t\n ", &psz_parser );
-        if ( psz_token == NULL )
-        {
-            config_Free( &config );
-            continue;
-        }
-        if( atoi( psz_token ) == 1 )
-            config.i_config |= OUTPUT_WATCH;
-        else
-            config.i_config &= ~OUTPUT_WATCH;
-
-        psz_token = strtok_r( NULL, "\t\n ", &psz_parser );
-        if ( psz_token == NULL )
+        /* Same line as last time: nothing to parse nor to change. */
+        p_output = output_FindLine( psz_line );
+        if ( p_output != NULL && (p_output->config.i_config & OUTPUT_VALID) )
         {
-            config_Free( &config );
+            p_output->config.i_config |= OUTPUT_STILL_PRESENT;
+            i_nb_unchanged++;
             continue;
         }
-        config.i_sid = strtol(psz_token, NULL, 0);
-
-        psz_token = strtok_r( NULL, "\t\n ", &psz_parser );
-        if ( psz_token != NULL )
-        {
-            psz_parser = NULL;
-            for ( ; ; )
-            {
-                psz_token = strtok_r( psz_token, ",", &psz_parser );
-                if ( psz_token == NULL )
-                    break;
-                config.pi_pids = realloc( config.pi_pids,
-                                 (config.i_nb_pids + 1) * sizeof(uint16_t) );
-                config.pi_pids[config.i_nb_pids++] = strtol(psz_token, NULL, 0);
-                psz_token = NULL;
-            }
-        }
-
-        config_Print( &config );
-
-        p_output = output_Find( &config );
-
-        if ( p_output == NULL )
-            p_output = output_Create( &config );
-
-        if ( p_output != NULL )
-        {
-            free( p_output->config.psz_displayname );
-            p_output->config.psz_displayname = strdup( config.psz_displayname );
-
-            config.i_config |= OUTPUT_VALID | OUTPUT_STILL_PRESENT;
-            output_Change( p_output, &config );
-            demux_Change( p_output, &config );
-        }
 
+        psz_raw = strdup( psz_line );
+        if ( config_ParseLine( &config, psz_line ) )
+            config_ApplyLine( &config, psz_raw );
         config_Free( &config );
+        free( psz_raw );
     }
 
     fclose( p_file );
@@ -442,21 +686,83 @@ static void config_ReadFile( char *psz_file )
     for ( i = 0; i < i_nb_outputs; i++ )
     {
         output_t *p_output = pp_outputs[i];
-        output_config_t config;
-
-        config_Init( &config );
 
         if ( (p_output->config.i_config & OUTPUT_VALID) &&
              !(p_output->config.i_config & OUTPUT_STILL_PRESENT) )
         {
-            msg_Dbg( NULL, "closing %s", p_output->config.psz_displayname );
-            demux_Change( p_output, &config );
-            output_Close( p_output );
+            config_CloseOutput( p_output );
+            i_nb_closed++;
         }
 
         p_output->config.i_config &= ~OUTPUT_STILL_PRESENT;
-        config_Free( &config );
     }
+
+    msg_Info( NULL, "configuration read in %"PRId64" ms: %d outputs, "
+              "%d unchanged, %d closed", (mdate() - i_start) / 1000,
+              i_nb_lines, i_nb_unchanged, i_nb_closed );
+}
+
+/*****************************************************************************
+ * config_SetOutput : add (b_add) or change (b_change) a single output from
+ * a configuration line received on the comm socket
+ *****************************************************************************/
+bool config_SetOutput( const char *psz_line, bool b_add, bool b_change )
+{
+    output_config_t config;
+    output_t *p_output;
+    char *psz_parse = strdup( psz_line );
+    bool b_ok = false;
+
+    if ( !config_ParseLine( &config, psz_parse ) )
+    {
+        msg_Warn( NULL, "invalid output line \"%s\"", psz_line );
+        goto out;
+    }
+
+    p_output = output_Find( &config );
+    if ( p_output != NULL ? !b_change : !b_add )
+    {
+        msg_Warn( NULL, "%s: output %s", config.psz_displayname,
+                  p_output != NULL ? "already exists" : "not found" );
+        goto out;
+    }
+
+    p_output = config_ApplyLine( &config, psz_line );
+    if ( p_output != NULL )
+    {
+        p_output->config.i_config &= ~OUTPUT_STILL_PRESENT;
+        b_ok = true;
+    }
+
+out:
+    config_Free( &config );
+    free( psz_parse );
+    return b_ok;
+}
+
+/*****************************************************************************
+ * config_DeleteOutput : close the output of a configuration line received
+ * on the comm socket (only the destination is taken into account)
+ *****************************************************************************/
+bool config_DeleteOutput( const char *psz_line )
+{
+    output_config_t config;
+    output_t *p_output = NULL;
+    char *psz_parse = strdup( psz_line ), *psz_parser;
+    char *psz_token = strtok_r( psz_parse, "\t\n ", &psz_parser );
+
+    config_Defaults( &config );
+    if ( psz_token != NULL && config_ParseHost( &config, psz_token ) )
+        p_output = output_Find( &config );
+
+    if ( p_output != NULL )
+        config_CloseOutput( p_output );
+    else
+        msg_Warn( NULL, "no output to delete for \"%s\"", psz_line );
+
+    config_Free( &config );
+    free( psz_parse );
+    return p_output != NULL;
 }
 
 /*****************************************************************************
@@ -512,6 +818,8 @@ void usage()
     msg_Raw( NULL, "  -b --bandwidth        frontend bandwith" );
 #endif
     msg_Raw( NULL, "  -D --rtp-input        read packets from a multicast address instead of a DVB card" );
+    msg_Raw( NULL, "     --backup-input <address>  switch to this multicast address when the input stalls" );
+    msg_Raw( NULL, "     --input <name>=<address>  demux another multicast address, for outputs with /input=<name>" );
 #ifdef HAVE_DVB_SUPPORT
     msg_Raw( NULL, "  -5 --delsys           delivery system" );
     msg_Raw( NULL, "    DVBS|DVBS2|DVBC_ANNEX_A|DVBT|ATSC (default guessed)");
@@ -552,6 +860,8 @@ void usage()
     msg_Raw( NULL, "  -W --emm-passthrough  pass through EMM data (CA system data)" );
     msg_Raw( NULL, "  -Y --ecm-passthrough  pass through ECM data (CA program data)" );
     msg_Raw( NULL, "  -e --epg-passthrough  pass through DVB EIT schedule tables" );
+    msg_Raw( NULL, "     --epg-rate <kbps>  regenerate EIT schedule tables as a carousel capped to this bitrate" );
+    msg_Raw( NULL, "     --epg-days <days>  only carry this many days of EIT schedule in the carousel" );
     msg_Raw( NULL, "  -E --retention        maximum retention allowed between input and output (default: 40 ms)" );
     msg_Raw( NULL, "  -L --latency          maximum latency allowed between input and output (default: 100 ms)" );
     msg_Raw( NULL, "  -M --network-name     DVB network name to declare in the NIT" );
@@ -575,15 +885,78 @@ void usage()
     msg_Raw( NULL, "  -q --quiet            be quiet (less verbosity, repeat or use number for even quieter)" );
     msg_Raw( NULL, "  -Q --quit-timeout     when locked, quit after this delay (in ms), or after the first lock timeout" );
     msg_Raw( NULL, "  -r --remote-socket <remote socket>" );
+    msg_Raw( NULL, "     --remote-stream <remote socket>  stream socket for dvblastctl -s, without size limit" );
     msg_Raw( NULL, "     --sap              announce streams via SAP/SDP");
     msg_Raw( NULL, "     --sap-ip4 <ip4>    multicast IPv4 address for SAP announcements (default: %s)", SAP_DEFAULT_IP4_ADDR);
     msg_Raw( NULL, "     --sap-ip6 <ip6>    multicast IPv6 address for SAP announcements (default: %s)", SAP_DEFAULT_IP6_ADDR);
     msg_Raw( NULL, "     --sap-interval <secs> time interval between announcements per stream (default 1)");
     msg_Raw( NULL, "  -V --version          only display the version" );
     msg_Raw( NULL, "  -Z --mrtg-file <file> Log input packets and errors into mrtg-file" );
+    msg_Raw( NULL, "     --stats-file <file> publish counters in a shared-memory file, see dvblaststat" );
+    msg_Raw( NULL, "     --metrics <host:port|/path> serve Prometheus metrics (default port: %d)", DEFAULT_METRICS_PORT );
+    msg_Raw( NULL, "     --psi-cache <file> keep the last PAT/CAT/NIT/SDT/PMTs in <file> to start outputs at once" );
+    msg_Raw( NULL, "     --handoff <socket> take over the inputs and outputs of the instance on <socket>, then listen on it" );
     exit(1);
 }
 
+/*****************************************************************************
+ * ReadInputs : read the input, and the backup input if any, and return the
+ * packets of the active one
+ *****************************************************************************/
+static block_t *ReadInputs( mtime_t i_poll_timeout )
+{
+    block_t *p_primary, *p_backup;
+
+    if ( psz_backup_src == NULL )
+        return pf_Read( i_poll_timeout );
+
+    /* A stall must be noticed within the retention time, and only the
+     * active input may wait. */
+    if ( i_poll_timeout > i_retention_global )
+        i_poll_timeout = i_retention_global;
+    p_primary = pf_Read( b_on_backup ? 0 : i_poll_timeout );
+    p_backup = udp_Read( b_on_backup ? i_poll_timeout : 0 );
+    if ( !i_inputs_start )
+        i_inputs_start = i_wallclock;
+
+    if ( p_primary != NULL )
+    {
+        if ( i_primary_last + i_retention_global < i_wallclock )
+            i_primary_since = i_wallclock;
+        i_primary_last = i_wallclock;
+    }
+    if ( p_backup != NULL )
+        i_backup_last = i_wallclock;
+
+    /* The input may take a while to start, a frontend to lock. */
+    if ( !b_on_backup && i_primary_last + i_retention_global < i_wallclock
+          && i_backup_last + i_retention_global >= i_wallclock
+          && (i_primary_last
+               || i_inputs_start + INPUT_STARTUP_DELAY <= i_wallclock) )
+    {
+        msg_Warn( NULL, "input stalled, switching to backup input %s",
+                  psz_backup_src );
+        b_on_backup = true;
+        demux_SwitchInput( true );
+    }
+    else if ( b_on_backup
+               && i_primary_last + i_retention_global >= i_wallclock
+               && i_primary_since + INPUT_FAILBACK_DELAY <= i_wallclock )
+    {
+        msg_Warn( NULL, "input is back, leaving backup input" );
+        b_on_backup = false;
+        demux_SwitchInput( false );
+    }
+
+    if ( b_on_backup )
+    {
+        block_DeleteChain( p_primary );
+        return p_backup;
+    }
+    block_DeleteChain( p_backup );
+    return p_primary;
+}
+
 int main( int i_argc, char **pp_argv )
 {
     const char *psz_network_name = "DVBlast - http://www.videolan.org/projects/dvblast.html";
@@ -591,9 +964,10 @@ int main( int i_argc, char **pp_argv )
     size_t i_network_name_tmp_size;
     char *psz_dup_config = NULL;
     mtime_t i_poll_timeout = MAX_POLL_TIMEOUT;
+    bool b_handoff = false;
     struct sched_param param;
     int i_error;
-    int c;
+    int c, i;
     struct sigaction sa;
     sigset_t set;
 
@@ -602,6 +976,12 @@ int main( int i_argc, char **pp_argv )
     if ( i_argc == 1 )
         usage();
 
+    p_inputs = malloc( sizeof(input_t) );
+    p_inputs[0].psz_name = "main";
+    p_inputs[0].psz_src = NULL;
+    p_inputs[0].p_udp = NULL;
+    i_nb_inputs = 1;
+
     /*
      * The only short options left are: 346789
      * Use them wisely.
@@ -668,6 +1048,15 @@ int main( int i_argc, char **pp_argv )
         { "sap-ip4",         required_argument, NULL,  1001 },
         { "sap-ip6",         required_argument, NULL,  1002 },
         { "sap-interval",    required_argument, NULL,  1003 },
+        { "epg-rate",        required_argument, NULL,  1004 },
+        { "epg-days",        required_argument, NULL,  1005 },
+        { "backup-input",    required_argument, NULL,  1006 },
+        { "input",           required_argument, NULL,  1007 },
+        { "remote-stream",   required_argument, NULL,  1008 },
+        { "stats-file",      required_argument, NULL,  1009 },
+        { "metrics",         required_argument, NULL,  1010 },
+        { "psi-cache",       required_argument, NULL,  1011 },
+        { "handoff",         required_argument, NULL,  1012 },
         { 0, 0, 0, 0 }
     };
 
@@ -1039,6 +1428,58 @@ int main( int i_argc, char **pp_argv )
                 g_sap_interval = 1;
             break;
 
+        case 1004: // epg-rate
+            i_epg_rate_global = strtol( optarg, NULL, 0 ) * 1000;
+            break;
+
+        case 1005: // epg-days
+            i_epg_days_global = strtol( optarg, NULL, 0 );
+            break;
+
+        case 1006: // backup-input
+            psz_backup_src = optarg;
+            break;
+
+        case 1007: // input
+        {
+            char *psz_src = strchr( optarg, '=' );
+
+            if ( psz_src == NULL )
+                usage();
+            *psz_src++ = '\0';
+            if ( input_Find( optarg ) != -1 )
+            {
+                msg_Err( NULL, "duplicate input %s", optarg );
+                exit(1);
+            }
+            p_inputs = realloc( p_inputs, (i_nb_inputs + 1) * sizeof(input_t) );
+            p_inputs[i_nb_inputs].psz_name = optarg;
+            p_inputs[i_nb_inputs].psz_src = psz_src;
+            p_inputs[i_nb_inputs].p_udp = NULL;
+            i_nb_inputs++;
+            break;
+        }
+
+        case 1008: // remote-stream
+            psz_srv_stream_socket = optarg;
+            break;
+
+        case 1009: // stats-file
+            psz_stats_file = optarg;
+            break;
+
+        case 1010: // metrics
+            psz_metrics_addr = optarg;
+            break;
+
+        case 1011: // psi-cache
+            psz_psi_cache = optarg;
+            break;
+
+        case 1012: // handoff
+            psz_handoff_socket = optarg;
+            break;
+
         case 'h':
             usage();
             break;
@@ -1051,6 +1492,18 @@ int main( int i_argc, char **pp_argv )
     if ( optind < i_argc || pf_Open == NULL )
         usage();
 
+    if ( psz_backup_src != NULL )
+    {
+        /* The backup input uses the UDP module, which has a single
+         * instance. */
+        if ( pf_Open == udp_Open )
+        {
+            msg_Err( NULL, "--backup-input cannot be used with -D" );
+            exit(1);
+        }
+        psz_udp_src = psz_backup_src;
+    }
+
     if ( b_enable_syslog )
         msg_Connect( psz_syslog_ident ? psz_syslog_ident : pp_argv[0] );
 
@@ -1147,6 +1600,9 @@ int main( int i_argc, char **pp_argv )
 
     srand( time(NULL) * getpid() );
 
+    if ( psz_handoff_socket != NULL )
+        b_handoff = handoff_Open( psz_handoff_socket );
+
     demux_Open();
 
     // init the mrtg logfile
@@ -1166,15 +1622,27 @@ int main( int i_argc, char **pp_argv )
 
     config_ReadFile( psz_conf_file );
 
+    if ( b_handoff )
+        handoff_Restore();
+    if ( psz_psi_cache != NULL )
+        demux_OpenPSICache( psz_psi_cache, !b_handoff );
+
     if ( b_enable_sap )
         sap_Init();
 
     if ( psz_srv_socket != NULL )
         comm_Open();
+    if ( psz_srv_stream_socket != NULL )
+        comm_OpenStream();
+    if ( psz_stats_file != NULL )
+        stats_Open( psz_stats_file );
+    if ( psz_metrics_addr != NULL )
+        metrics_Open( psz_metrics_addr );
 
     for ( ; ; )
     {
         block_t *p_ts;
+        mtime_t i_loop_start = 0;
 
         if ( b_exit_now )
         {
@@ -1182,6 +1650,12 @@ int main( int i_argc, char **pp_argv )
             break;
         }
 
+        if ( psz_handoff_socket != NULL && handoff_Poll() )
+        {
+            msg_Info( NULL, "Handed over to a new instance." );
+            break;
+        }
+
         if ( b_conf_reload )
         {
             b_conf_reload = 0;
@@ -1205,18 +1679,42 @@ int main( int i_argc, char **pp_argv )
             exit(EXIT_SUCCESS);
         }
 
-        p_ts = pf_Read( i_poll_timeout );
+        p_ts = ReadInputs( i_poll_timeout );
+        if ( psz_metrics_addr != NULL )
+            i_loop_start = mdate();
         if ( p_ts != NULL )
         {
             mrtgAnalyse(p_ts);
-            demux_Run( p_ts );
+            demux_Run( 0, p_ts );
         }
+        for ( i = 1; i < i_nb_inputs; i++ )
+            while ( (p_ts = udp_ReadInput( p_inputs[i].p_udp )) != NULL )
+                demux_Run( i, p_ts );
+        comm_Poll();
+        stats_Update();
+        demux_SavePSI( false );
+
         i_poll_timeout = output_Send();
+        if ( psz_metrics_addr != NULL )
+        {
+            metrics_LoopDuration( mdate() - i_loop_start );
+            metrics_Poll();
+        }
         if ( i_poll_timeout == -1 || i_poll_timeout > MAX_POLL_TIMEOUT )
             i_poll_timeout = MAX_POLL_TIMEOUT;
+        /* Additional inputs are only read between reads of the main one. */
+        if ( i_nb_inputs > 1 && i_poll_timeout > INPUT_POLL_TIMEOUT )
+            i_poll_timeout = INPUT_POLL_TIMEOUT;
+        /* So are the answers on the comm stream. */
+        if ( (comm_Pending() || metrics_Pending())
+              && i_poll_timeout > INPUT_POLL_TIMEOUT )
+            i_poll_timeout = INPUT_POLL_TIMEOUT;
     }
 
+    demux_SavePSI( true );
     mrtgClose();
+    stats_Close();
+    metrics_Close();
     outputs_Close( i_nb_outputs );
     demux_Close();
     free( p_network_name );
@@ -1229,6 +1727,8 @@ int main( int i_argc, char **pp_argv )
 
     if ( psz_srv_socket && i_comm_fd > -1 )
         unlink( psz_srv_socket );
+    comm_CloseStream();
+    handoff_Close();
 
     return EXIT_SUCCESS;
 }
@@ -91,6 +91,17 @@ struct udprawpkt {
 #define OUTPUT_DVB           0x20
 #define OUTPUT_EPG           0x40
 #define OUTPUT_RAW           0x80
+#define OUTPUT_STATMUX       0x100
+#define OUTPUT_NOPAD         0x200
+#define OUTPUT_NONULL        0x400
+#define OUTPUT_ADAPTIVE      0x800
+#define OUTPUT_CC            0x1000
+
+/* Statistical remux classes, dropped first to last when over capacity */
+#define REMUX_EIT_SCHEDULE   0
+#define REMUX_SI             1
+#define REMUX_LOW            2
+#define REMUX_ESSENTIAL      3
 
 typedef int64_t mtime_t;
 
@@ -99,12 +110,34 @@ typedef struct block_t
     uint8_t p_ts[TS_SIZE];
     int i_refcount;
     mtime_t i_dts;
-    uint16_t tmp_pid;
+    bool b_discontinuity; /* the demux saw a CC error on this packet */
     struct block_t *p_next;
 } block_t;
 
 typedef struct packet_t packet_t;
 
+typedef struct pid_map_t
+{
+    uint16_t i_pid, i_newpid;
+} pid_map_t;
+
+typedef struct pid_cc_t
+{
+    uint16_t i_pid;
+    int8_t i_last_cc; /* last CC received */
+    uint8_t i_cc; /* last CC sent */
+} pid_cc_t;
+
+typedef struct udp_input_t udp_input_t;
+
+/* Inputs demuxed by the process, the main one (-a, -D or -A) first */
+typedef struct input_t
+{
+    const char *psz_name;
+    const char *psz_src; /* --input address, NULL for the main input */
+    udp_input_t *p_udp;
+} input_t;
+
 typedef struct output_config_t
 {
     /* identity */
@@ -122,15 +155,27 @@ typedef struct output_config_t
     char *psz_service_provider;
     uint8_t pi_ssrc[4];
     mtime_t i_output_latency, i_max_retention;
+    int i_cbr_rate; /* in bits/s, 0 for VBR */
+    uint16_t *pi_low_pids; /* dropped first by the statistical remux */
+    int i_nb_low_pids;
+    uint16_t *pi_low_sids;
+    int i_nb_low_sids;
     int i_ttl;
     uint8_t i_tos;
     int i_mtu;
     char *psz_srcaddr; /* raw packets */
     int i_srcport;
 
+    /* EIT schedule carousel */
+    int i_epg_rate; /* in bits/s, 0 to pass through */
+    int i_epg_days; /* 0 for no limit */
+
     /* demux config */
+    int i_input; /* index in p_inputs */
     int i_tsid;
-    uint16_t i_sid; /* 0 if raw mode */
+    uint16_t i_sid; /* 0 if raw mode, first service of an MPTS output */
+    uint16_t *pi_sids; /* services of an MPTS output */
+    int i_nb_sids; /* 0 unless the output carries several services */
     uint16_t *pi_pids;
     int i_nb_pids;
     uint16_t i_new_sid;
@@ -140,6 +185,14 @@ typedef struct output_config_t
     uint16_t pi_confpids[N_MAP_PIDS];
 } output_config_t;
 
+typedef struct output_service_t
+{
+    uint16_t i_sid;
+    uint16_t i_pmt_pid;
+    uint8_t *p_pmt_section;
+    uint8_t i_pmt_version, i_pmt_cc;
+} output_service_t;
+
 typedef struct output_t
 {
     output_config_t config;
@@ -150,8 +203,30 @@ typedef struct output_t
     uint16_t i_seqnum;
     mtime_t i_ref_timestamp;
     mtime_t i_ref_wallclock;
+    /* CBR timeline: date of the next datagram, plus a fraction of
+     * microsecond in units of 1/i_cbr_rate */
+    mtime_t i_cbr_next;
+    int64_t i_cbr_frac;
+    mtime_t i_cbr_last_warning;
+    /* Statistical remux bucket, in bits * 1000000 */
+    int64_t i_remux_credit;
+    mtime_t i_remux_dts;
+    /* Bytes not sent thanks to /nopad and /nonull */
+    uint64_t i_pad_saved, i_null_saved;
+    /* Sent TS packets and bytes, failed sends, and TS packets dropped by
+     * the statistical remux or for being too late on the /cbr timeline */
+    uint64_t i_packets_sent, i_bytes_sent;
+    uint32_t i_send_errors;
+    uint64_t i_packets_dropped;
+    /* Datagram statistics over OUTPUT_STATS_PERIOD, and the retention
+     * picked from them with /adaptive */
+    mtime_t i_stats_start, i_stats_latency;
+    unsigned int i_stats_datagrams, i_stats_blocks;
+    unsigned int i_fill_ratio; /* per mille */
+    mtime_t i_latency, i_retention;
 
     /* demux */
+    int i_index; /* slot in pp_outputs, used in per-PID output masks */
     int i_nb_errors;
     mtime_t i_last_error;
     uint8_t *p_pat_section;
@@ -160,16 +235,31 @@ typedef struct output_t
     uint8_t i_pmt_version, i_pmt_cc;
     uint8_t *p_nit_section;
     uint8_t i_nit_version, i_nit_cc;
-    uint8_t *p_sdt_section;
+    uint8_t **pp_sdt_sections;
+    int i_nb_sdt_sections;
     uint8_t i_sdt_version, i_sdt_cc;
+    /* MPTS: one PMT per service, in the order of config.pi_sids */
+    output_service_t *p_services;
     uint8_t *p_eit_epg_section;
     block_t *p_eit_ts_buffer;
     uint8_t i_eit_ts_buffer_offset, i_eit_cc;
+    /* EIT schedule carousel, as a chain of TS packets without CC */
+    block_t *p_eit_carousel, *p_eit_carousel_next;
+    unsigned int i_eit_carousel_version;
+    int64_t i_eit_carousel_credit; /* in bits */
     uint16_t i_tsid;
-    // Arrays used for mapping pids.
-    // newpids is indexed using the original pid
-    uint16_t pi_newpids[MAX_PIDS];
-    uint16_t pi_freepids[MAX_PIDS];   // used where multiple streams of the same type are used
+    // Remapped pids, sorted by original pid
+    pid_map_t *p_pid_map;
+    int i_nb_remapped_pids, i_max_remapped_pids;
+    // Regenerated continuity counters (/cc), sorted by original pid
+    pid_cc_t *p_pid_cc;
+    int i_nb_cc_pids, i_max_cc_pids;
+
+    /* Hash chains of output_Find() and output_FindLine(), and the bucket
+     * of the former, as the config may change before output_Close() */
+    struct output_t *p_index_next, *p_line_next;
+    unsigned int i_index_bucket;
+    char *psz_config_line; /* configuration line that set the output up */
 
     struct udprawpkt raw_pkt_header;
 } output_t;
@@ -181,6 +271,7 @@ typedef struct ts_pid_info {
     unsigned long i_cc_errors;          /* Countinuity counter errors */
     unsigned long i_transport_errors;   /* Transport errors */
     unsigned long i_bytes_per_sec;      /* How much bytes were process last second */
+    unsigned long i_dropped;            /* Packets dropped by statistical remux */
     uint8_t  i_scrambling;              /* Scrambling bits from the last ts packet */
     /* 0 = Not scrambled
        1 = Reserved for future use
@@ -188,12 +279,94 @@ typedef struct ts_pid_info {
        3 = Scrambled with odd key */
 } ts_pid_info_t;
 
+/* Compact per-PID statistics, for sparse queries */
+typedef struct ts_pid_entry_t {
+    uint16_t i_pid;
+    uint8_t  i_scrambling;
+    uint8_t  i_reserved;
+    uint32_t i_bytes_per_sec;
+    uint64_t i_packets;
+    uint32_t i_cc_errors;
+    uint32_t i_transport_errors;
+    uint32_t i_dropped;
+    uint32_t i_last_seen;               /* ms since the last packet */
+} ts_pid_entry_t;
+
+typedef struct ts_pids_sparse_t {
+    uint32_t i_generation;              /* To ask for changes since now */
+    uint32_t i_nb_pids;                 /* ts_pid_entry_t that follow */
+} ts_pids_sparse_t;
+
+#define PIDS_ACTIVE     0x1             /* PIDs which carried packets */
+#define PIDS_CHANGED    0x2             /* Changed since i_generation */
+#define PIDS_SID        0x4             /* Carried by the PMT of i_sid */
+
+/* Events pushed to the subscribers of the stream control socket */
+#define EVENT_TS_SYNC           0       /* i_pid: lost TS sync */
+#define EVENT_CC                1       /* i_value1: expected, i_value2: got */
+#define EVENT_TRANSPORT_ERROR   2
+#define EVENT_LOCK              3       /* i_value1: 1 acquired, 0 lost */
+#define EVENT_PMT               4       /* i_pid: PMT PID, i_value1: version */
+#define EVENT_CAM               5       /* i_value1: slot, i_value2: 1 ready */
+#define EVENT_KINDS             6
+#define EVENT_ANY_PID           0xffff  /* Event or filter without PID */
+
+typedef struct dvblast_event_t {
+    int64_t  i_date;                    /* Wallclock, in us */
+    uint8_t  i_kind;
+    uint8_t  i_reserved;
+    uint16_t i_pid;
+    uint16_t i_sid;                     /* 0 if unknown */
+    uint16_t i_reserved2;
+    uint32_t i_value1;
+    uint32_t i_value2;
+} dvblast_event_t;
+
+typedef struct dvblast_events_t {
+    uint32_t i_dropped;                 /* Lost since the previous batch */
+    uint32_t i_nb_events;               /* dvblast_event_t that follow */
+} dvblast_events_t;
+
+typedef struct output_info_t {
+    char     psz_displayname[64];       /* Truncated if needed */
+    uint16_t i_sid;
+    uint32_t i_nb_remapped_pids;
+    uint32_t i_memory;                  /* Total of the following, in bytes */
+    uint32_t i_struct_memory;           /* output_t and its configuration */
+    uint32_t i_queue_memory;            /* Queued packets, incl. blocks */
+    uint32_t i_psi_memory;              /* Generated tables and EIT buffers */
+    uint32_t i_remap_memory;            /* PID remap table */
+    uint64_t i_pad_saved;               /* Padding bytes not sent (/nopad) */
+    uint64_t i_null_saved;              /* Null packet bytes stripped (/nonull) */
+    uint32_t i_fill_ratio;              /* Per mille of TS packets per datagram */
+    uint32_t i_latency;                 /* Average datagram latency, in us */
+    uint32_t i_retention;               /* Current retention, in us */
+} output_info_t;
+
+/* Section pools, one per table type */
+#define SECTION_POOL_PAT    0
+#define SECTION_POOL_CAT    1
+#define SECTION_POOL_NIT    2
+#define SECTION_POOL_SDT    3
+#define SECTION_POOL_EIT    4
+#define SECTION_POOL_PMT    5   /* and any other PID */
+#define SECTION_POOLS       6
+
+typedef struct section_pool_info_t {
+    uint64_t i_allocs;          /* Slots obtained from malloc() */
+    uint64_t i_recycled;        /* Slots reused from the free list */
+    uint64_t i_released;        /* Slots given back to the free list */
+    uint32_t i_in_use;          /* Slots currently holding a section */
+    uint32_t i_free;            /* Slots waiting in the free list */
+} section_pool_info_t;
+
 extern int i_syslog;
 extern int i_verbose;
 extern output_t **pp_outputs;
 extern int i_nb_outputs;
 extern output_t output_dup;
 extern char *psz_srv_socket;
+extern char *psz_srv_stream_socket;
 extern int i_comm_fd;
 extern int i_adapter;
 extern int i_fenum;
@@ -232,6 +405,9 @@ extern volatile int b_conf_reload;
 extern volatile int b_exit_now;
 extern int i_comm_fd;
 extern char *psz_udp_src;
+extern char *psz_backup_src;
+extern input_t *p_inputs;
+extern int i_nb_inputs;
 extern int i_asi_adapter;
 extern const char *psz_native_charset;
 extern const char *psz_dvb_charset;
@@ -242,6 +418,9 @@ extern bool b_print_enabled;
 extern bool b_do_remap;
 extern uint16_t pi_newpids[N_MAP_PIDS];
 extern void init_pid_mapping( output_t * );
+uint16_t output_GetMappedPID( const output_t *p_output, uint16_t i_pid );
+bool output_IsMappedPIDUsed( const output_t *p_output, uint16_t i_newpid );
+void output_MapPID( output_t *p_output, uint16_t i_pid, uint16_t i_newpid );
 
 extern void (*pf_Open)( void );
 extern block_t * (*pf_Read)( mtime_t i_poll_timeout );
@@ -256,6 +435,9 @@ extern void (*pf_UnsetFilter)( int i_fd, uint16_t i_pid );
 void config_Init( output_config_t *p_config );
 void config_Free( output_config_t *p_config );
 bool config_ParseHost( output_config_t *p_config, char *psz_string );
+int input_Find( const char *psz_name );
+bool config_SetOutput( const char *psz_line, bool b_add, bool b_change );
+bool config_DeleteOutput( const char *psz_line );
 
 /* Connect/Disconnect from syslogd */
 void msg_Connect( const char *ident );
@@ -294,6 +476,8 @@ block_t * udp_Read( mtime_t i_poll_timeout );
 void udp_Reset( void );
 int udp_SetFilter( uint16_t i_pid );
 void udp_UnsetFilter( int i_fd, uint16_t i_pid );
+udp_input_t *udp_OpenInput( const char *psz_src );
+block_t *udp_ReadInput( udp_input_t *p_udp );
 
 void asi_Open( void );
 block_t * asi_Read( mtime_t i_poll_timeout );
@@ -310,12 +494,16 @@ void asi_deltacast_UnsetFilter( int i_fd, uint16_t i_pid );
 #endif
 
 void demux_Open( void );
-void demux_Run( block_t *p_ts );
+void demux_Run( int i_input, block_t *p_ts );
 void demux_Change( output_t *p_output, const output_config_t *p_config );
+void demux_Detach( output_t *p_output );
+void demux_SwitchInput( bool b_backup );
 void demux_ResendCAPMTs( void );
 bool demux_PIDIsSelected( uint16_t i_pid );
 char *demux_Iconv(void *_unused, const char *psz_encoding,
                   char *p_string, size_t i_length);
+void demux_OpenPSICache( const char *psz_file, bool b_preload );
+void demux_SavePSI( bool b_force );
 void demux_Close( void );
 
 uint8_t *demux_get_current_packed_PAT( unsigned int *pi_pack_size );
@@ -325,18 +513,33 @@ uint8_t *demux_get_current_packed_SDT( unsigned int *pi_pack_size );
 uint8_t *demux_get_packed_PMT( uint16_t service_id, unsigned int *pi_pack_size );
 void demux_get_PID_info( uint16_t i_pid, uint8_t *p_data );
 void demux_get_PIDS_info( uint8_t *p_data );
+size_t demux_get_PIDS_sparse( uint8_t i_flags, uint16_t i_sid,
+                              uint32_t i_generation, uint8_t *p_data,
+                              size_t i_max_size );
+void demux_get_section_pools_info( uint8_t *p_data );
 
 output_t *output_Create( const output_config_t *p_config );
 int output_Init( output_t *p_output, const output_config_t *p_config );
 void output_Close( output_t *p_output );
 void output_Put( output_t *p_output, block_t *p_block );
+bool output_Admit( output_t *p_output, int i_class, int i_nb_packets,
+                   mtime_t i_dts );
 mtime_t output_Send( void );
 output_t *output_Find( const output_config_t *p_config );
+output_t *output_FindLine( const char *psz_line );
+void output_SetConfigLine( output_t *p_output, const char *psz_line );
 void output_Change( output_t *p_output, const output_config_t *p_config );
 void outputs_Close( int i_num_outputs );
+size_t outputs_GetInfo( uint8_t *p_data, size_t i_max_size );
 
 void comm_Open( void );
 void comm_Read( void );
+void comm_OpenStream( void );
+void comm_Poll( void );
+bool comm_Pending( void );
+void comm_CloseStream( void );
+void comm_Event( uint8_t i_kind, uint16_t i_pid, uint16_t i_sid,
+                 uint32_t i_value1, uint32_t i_value2 );
 
 /*****************************************************************************
  * block_New
@@ -346,6 +549,7 @@ static inline block_t *block_New( void )
     block_t *p_block = malloc(sizeof(block_t));
     p_block->p_next = NULL;
     p_block->i_refcount = 1;
+    p_block->b_discontinuity = false;
     return p_block;
 }
 
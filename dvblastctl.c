@@ -37,6 +37,8 @@
 #include <sys/un.h>
 #include <errno.h>
 #include <getopt.h>
+#include <signal.h>
+#include <time.h>
 
 #include <iconv.h>
 
@@ -53,6 +55,7 @@ int i_verbose = 3;
 int i_syslog = 0;
 
 print_type_t i_print_type = PRINT_TEXT;
+bool b_json = false; /* -x json, for the commands which support it */
 mtime_t now;
 
 int i_fd = -1;
@@ -89,25 +92,44 @@ static void psi_print(void *_unused, const char *psz_format, ...)
     va_end(args);
 }
 
-__attribute__ ((format(printf, 1, 2)))
-void return_error( const char *psz_format, ... )
+static void print_error( const char *psz_format, va_list args )
 {
-    va_list args;
     char psz_fmt[1024];
 
-    clean_client_socket();
-
-    va_start( args, psz_format );
     if ( i_print_type == PRINT_XML )
         snprintf( psz_fmt, sizeof(psz_fmt) - 1, "<ERROR msg=\"%s\"/>\n", psz_format );
     else
         snprintf( psz_fmt, sizeof(psz_fmt) - 1, "ERROR: %s\n", psz_format );
     psz_fmt[sizeof(psz_fmt) - 1] = '\0';
     vfprintf( stderr, psz_fmt, args );
+}
+
+__attribute__ ((format(printf, 1, 2)))
+void return_error( const char *psz_format, ... )
+{
+    va_list args;
+
+    clean_client_socket();
+
+    va_start( args, psz_format );
+    print_error( psz_format, args );
     va_end(args);
     exit(255);
 }
 
+/* Reports a failed command, which only ends the process in single command
+ * mode. Returns the exit status of the command. */
+__attribute__ ((format(printf, 1, 2)))
+static int answer_error( const char *psz_format, ... )
+{
+    va_list args;
+
+    va_start( args, psz_format );
+    print_error( psz_format, args );
+    va_end(args);
+    return 255;
+}
+
 static char *iconv_append_null(const char *p_string, size_t i_length)
 {
     char *psz_string = malloc(i_length + 1);
@@ -177,24 +199,26 @@ void print_pid(uint16_t i_pid, ts_pid_info_t *p_info)
     if ( p_info->i_packets == 0 )
         return;
     if ( i_print_type == PRINT_TEXT )
-        printf("pid %d packn %lu ccerr %lu tserr %lu scramble %d Bps %lu seen %"PRId64"\n",
+        printf("pid %d packn %lu ccerr %lu tserr %lu scramble %d Bps %lu seen %"PRId64" dropped %lu\n",
             i_pid,
             p_info->i_packets,
             p_info->i_cc_errors,
             p_info->i_transport_errors,
             p_info->i_scrambling,
             p_info->i_bytes_per_sec,
-            now - p_info->i_last_packet_ts
+            now - p_info->i_last_packet_ts,
+            p_info->i_dropped
         );
     else
-        printf("<PID pid=\"%d\" packn=\"%lu\" ccerr=\"%lu\" tserr=\"%lu\" scramble=\"%d\" Bps=\"%lu\" seen=\"%"PRId64"\" />\n",
+        printf("<PID pid=\"%d\" packn=\"%lu\" ccerr=\"%lu\" tserr=\"%lu\" scramble=\"%d\" Bps=\"%lu\" seen=\"%"PRId64"\" dropped=\"%lu\" />\n",
             i_pid,
             p_info->i_packets,
             p_info->i_cc_errors,
             p_info->i_transport_errors,
             p_info->i_scrambling,
             p_info->i_bytes_per_sec,
-            now - p_info->i_last_packet_ts
+            now - p_info->i_last_packet_ts,
+            p_info->i_dropped
         );
 }
 
@@ -209,6 +233,223 @@ void print_pids( uint8_t *p_data )
     print_pids_footer();
 }
 
+void print_section_pools( uint8_t *p_data )
+{
+    static const char *ppsz_names[SECTION_POOLS] =
+        { "pat", "cat", "nit", "sdt", "eit", "pmt" };
+    section_pool_info_t *p_info = (section_pool_info_t *)p_data;
+    int i;
+
+    if ( i_print_type == PRINT_XML )
+        printf("<SECTION_POOLS>\n");
+    for ( i = 0; i < SECTION_POOLS; i++ )
+    {
+        if ( i_print_type == PRINT_TEXT )
+            printf("pool %s allocs %"PRIu64" recycled %"PRIu64" released %"PRIu64" inuse %u free %u\n",
+                ppsz_names[i],
+                p_info[i].i_allocs,
+                p_info[i].i_recycled,
+                p_info[i].i_released,
+                p_info[i].i_in_use,
+                p_info[i].i_free
+            );
+        else
+            printf("<POOL name=\"%s\" allocs=\"%"PRIu64"\" recycled=\"%"PRIu64"\" released=\"%"PRIu64"\" inuse=\"%u\" free=\"%u\" />\n",
+                ppsz_names[i],
+                p_info[i].i_allocs,
+                p_info[i].i_recycled,
+                p_info[i].i_released,
+                p_info[i].i_in_use,
+                p_info[i].i_free
+            );
+    }
+    if ( i_print_type == PRINT_XML )
+        printf("</SECTION_POOLS>\n");
+}
+
+void print_pids_sparse( uint8_t *p_data, size_t i_size )
+{
+    ts_pids_sparse_t *p_header = (ts_pids_sparse_t *)p_data;
+    ts_pid_entry_t *p_entry = (ts_pid_entry_t *)(p_header + 1);
+    uint32_t i;
+
+    if ( i_size < sizeof(ts_pids_sparse_t) ||
+         (i_size - sizeof(ts_pids_sparse_t)) / sizeof(ts_pid_entry_t)
+            < p_header->i_nb_pids )
+        return_error( "Bad PIDs answer" );
+
+    if ( b_json )
+        printf("{\"generation\":%u,\"pids\":[", p_header->i_generation);
+    else if ( i_print_type == PRINT_XML )
+        printf("<PIDS generation=\"%u\">\n", p_header->i_generation);
+    else
+        printf("generation %u\n", p_header->i_generation);
+
+    for ( i = 0; i < p_header->i_nb_pids; i++, p_entry++ )
+    {
+        if ( b_json )
+            printf("%s{\"pid\":%u,\"packn\":%"PRIu64",\"ccerr\":%u,\"tserr\":%u,\"scramble\":%u,\"Bps\":%u,\"seen\":%u,\"dropped\":%u}",
+                i ? "," : "",
+                p_entry->i_pid,
+                p_entry->i_packets,
+                p_entry->i_cc_errors,
+                p_entry->i_transport_errors,
+                p_entry->i_scrambling,
+                p_entry->i_bytes_per_sec,
+                p_entry->i_last_seen,
+                p_entry->i_dropped
+            );
+        else if ( i_print_type == PRINT_XML )
+            printf("<PID pid=\"%u\" packn=\"%"PRIu64"\" ccerr=\"%u\" tserr=\"%u\" scramble=\"%u\" Bps=\"%u\" seen=\"%u\" dropped=\"%u\" />\n",
+                p_entry->i_pid,
+                p_entry->i_packets,
+                p_entry->i_cc_errors,
+                p_entry->i_transport_errors,
+                p_entry->i_scrambling,
+                p_entry->i_bytes_per_sec,
+                p_entry->i_last_seen,
+                p_entry->i_dropped
+            );
+        else
+            printf("pid %u packn %"PRIu64" ccerr %u tserr %u scramble %u Bps %u seen %u dropped %u\n",
+                p_entry->i_pid,
+                p_entry->i_packets,
+                p_entry->i_cc_errors,
+                p_entry->i_transport_errors,
+                p_entry->i_scrambling,
+                p_entry->i_bytes_per_sec,
+                p_entry->i_last_seen,
+                p_entry->i_dropped
+            );
+    }
+
+    if ( b_json )
+        printf("]}\n");
+    else if ( i_print_type == PRINT_XML )
+        printf("</PIDS>\n");
+}
+
+void print_outputs( uint8_t *p_data, size_t i_size )
+{
+    output_info_t *p_info = (output_info_t *)p_data;
+    int i, i_nb_outputs = i_size / sizeof(output_info_t);
+
+    if ( i_print_type == PRINT_XML )
+        printf("<OUTPUTS>\n");
+    for ( i = 0; i < i_nb_outputs; i++, p_info++ )
+    {
+        if ( i_print_type == PRINT_TEXT )
+            printf("output %s sid %u remapped %u mem %u struct %u queue %u psi %u remap %u padsaved %"PRIu64" nullsaved %"PRIu64" fill %u.%u%% latency %u retention %u\n",
+                p_info->psz_displayname,
+                p_info->i_sid,
+                p_info->i_nb_remapped_pids,
+                p_info->i_memory,
+                p_info->i_struct_memory,
+                p_info->i_queue_memory,
+                p_info->i_psi_memory,
+                p_info->i_remap_memory,
+                p_info->i_pad_saved,
+                p_info->i_null_saved,
+                p_info->i_fill_ratio / 10, p_info->i_fill_ratio % 10,
+                p_info->i_latency,
+                p_info->i_retention
+            );
+        else
+            printf("<OUTPUT name=\"%s\" sid=\"%u\" remapped=\"%u\" mem=\"%u\" struct=\"%u\" queue=\"%u\" psi=\"%u\" remap=\"%u\" padsaved=\"%"PRIu64"\" nullsaved=\"%"PRIu64"\" fill=\"%u\" latency=\"%u\" retention=\"%u\" />\n",
+                p_info->psz_displayname,
+                p_info->i_sid,
+                p_info->i_nb_remapped_pids,
+                p_info->i_memory,
+                p_info->i_struct_memory,
+                p_info->i_queue_memory,
+                p_info->i_psi_memory,
+                p_info->i_remap_memory,
+                p_info->i_pad_saved,
+                p_info->i_null_saved,
+                p_info->i_fill_ratio,
+                p_info->i_latency,
+                p_info->i_retention
+            );
+    }
+    if ( i_print_type == PRINT_XML )
+        printf("</OUTPUTS>\n");
+}
+
+static char *ppsz_event_kinds[EVENT_KINDS] =
+    { "sync", "cc", "te", "lock", "pmt", "cam" };
+
+void print_events( uint8_t *p_data, size_t i_size )
+{
+    dvblast_events_t *p_header = (dvblast_events_t *)p_data;
+    dvblast_event_t *p_event = (dvblast_event_t *)(p_header + 1);
+    uint32_t i;
+
+    if ( i_size < sizeof(dvblast_events_t) ||
+         (i_size - sizeof(dvblast_events_t)) / sizeof(dvblast_event_t)
+            < p_header->i_nb_events )
+        return_error( "Bad events answer" );
+
+    if ( p_header->i_dropped )
+    {
+        if ( b_json )
+            printf("{\"event\":\"dropped\",\"count\":%u}\n",
+                   p_header->i_dropped);
+        else if ( i_print_type == PRINT_XML )
+            printf("<EVENT type=\"dropped\" count=\"%u\" />\n",
+                   p_header->i_dropped);
+        else
+            printf("dropped %u events\n", p_header->i_dropped);
+    }
+
+    for ( i = 0; i < p_header->i_nb_events; i++, p_event++ )
+    {
+        const char *psz_kind = p_event->i_kind < EVENT_KINDS ?
+                               ppsz_event_kinds[p_event->i_kind] : "unknown";
+        int i_pid = p_event->i_pid == EVENT_ANY_PID ? -1 : p_event->i_pid;
+
+        if ( b_json )
+            printf("{\"event\":\"%s\",\"date\":%"PRId64",\"pid\":%d,\"sid\":%u,\"value1\":%u,\"value2\":%u}\n",
+                psz_kind, p_event->i_date, i_pid, p_event->i_sid,
+                p_event->i_value1, p_event->i_value2);
+        else if ( i_print_type == PRINT_XML )
+            printf("<EVENT type=\"%s\" date=\"%"PRId64"\" pid=\"%d\" sid=\"%u\" value1=\"%u\" value2=\"%u\" />\n",
+                psz_kind, p_event->i_date, i_pid, p_event->i_sid,
+                p_event->i_value1, p_event->i_value2);
+        else
+            printf("%s date %"PRId64" pid %d sid %u value1 %u value2 %u\n",
+                psz_kind, p_event->i_date, i_pid, p_event->i_sid,
+                p_event->i_value1, p_event->i_value2);
+    }
+}
+
+/* Receives one message framed by its header from the stream socket, growing
+ * the buffer if needed. Returns its size, or -1. */
+static ssize_t stream_recv( uint8_t **pp_buffer )
+{
+    uint32_t i_packet_size = 0, i_received = 0;
+    ssize_t i_size;
+
+    do {
+        i_size = recv( i_fd, *pp_buffer + i_received,
+                       (i_packet_size ? i_packet_size : COMM_HEADER_SIZE)
+                        - i_received, 0 );
+        if ( i_size <= 0 )
+            return -1;
+        i_received += i_size;
+        if ( !i_packet_size && i_received == COMM_HEADER_SIZE )
+        {
+            memcpy( &i_packet_size, *pp_buffer + 4, sizeof(uint32_t) );
+            if ( i_packet_size < COMM_HEADER_SIZE
+                  || i_packet_size > COMM_STREAM_MAX_ANSWER )
+                return -1;
+            if ( i_packet_size > COMM_BUFFER_SIZE )
+                *pp_buffer = realloc( *pp_buffer, i_packet_size );
+        }
+    } while ( !i_packet_size || i_received < i_packet_size );
+
+    return i_received;
+}
+
 struct dvblastctl_option {
     char *      opt;
     int         nparams;
@@ -237,6 +478,17 @@ static const struct dvblastctl_option options[] =
     { "get_pmt",            1, CMD_GET_PMT }, /* arg: service_id (uint16_t) */
     { "get_pids",           0, CMD_GET_PIDS },
     { "get_pid",            1, CMD_GET_PID },  /* arg: pid (uint16_t) */
+    { "get_active_pids",    0, CMD_GET_PIDS_SPARSE },
+    { "get_changed_pids",   1, CMD_GET_PIDS_SPARSE }, /* arg: generation */
+    { "get_service_pids",   1, CMD_GET_PIDS_SPARSE }, /* arg: service_id */
+    { "get_section_pools",  0, CMD_GET_SECTION_POOLS },
+    { "get_outputs",        0, CMD_GET_OUTPUTS },
+
+    { "add_output",         1, CMD_ADD_OUTPUT },    /* arg: config line */
+    { "change_output",      1, CMD_CHANGE_OUTPUT }, /* arg: config line */
+    { "delete_output",      1, CMD_DELETE_OUTPUT }, /* arg: config line */
+
+    { "watch_events",       0, CMD_SUBSCRIBE_EVENTS }, /* args: kinds, pid, sid */
 
     { NULL, 0, 0 }
 };
@@ -244,13 +496,21 @@ static const struct dvblastctl_option options[] =
 void usage()
 {
     printf("DVBlastctl %s (%s)\n", VERSION, VERSION_EXTRA );
-    printf("Usage: dvblastctl -r <remote socket> [-x <text|xml>] [cmd]\n");
+    printf("Usage: dvblastctl -r <remote socket> [-s] [-x <text|xml|json>] [-w <secs>] [cmd]\n");
+    printf("       dvblastctl -r <remote socket> [-s] [-x <text|xml|json>] [-w <secs>] -b [\"cmd args\"...]\n");
     printf("Options:\n");
     printf("  -r --remote-socket <name>       Set socket name to <name>.\n" );
-    printf("  -x --print <text|xml>           Choose output format for info commands.\n" );
+    printf("  -x --print <text|xml|json>      Choose output format for info commands (json: pid queries only).\n" );
+    printf("  -s --stream                     The socket is a --remote-stream socket.\n" );
+    printf("  -b --batch                      Run each argument, or each line of stdin, as a\n" );
+    printf("                                  command over one connection, pipelined with -s.\n" );
+    printf("  -w --watch <secs>               Run the command(s) again every <secs> until interrupted.\n" );
     printf("Control commands:\n");
     printf("  reload                          Reload configuration.\n");
     printf("  shutdown                        Shutdown DVBlast.\n");
+    printf("  add_output <line>               Add the output of a config line.\n");
+    printf("  change_output <line>            Change an output from a config line.\n");
+    printf("  delete_output <line>            Delete the output of a config line.\n");
 #ifdef HAVE_DVB_SUPPORT
     printf("Status commands:\n");
     printf("  fe_status                       Read frontend status information.\n");
@@ -271,138 +531,77 @@ void usage()
     printf("  get_pmt <service_id>            Return last PMT table.\n");
     printf("  get_pids                        Return info about all pids.\n");
     printf("  get_pid <pid>                   Return info for chosen pid only.\n");
+    printf("  get_active_pids                 Return info about pids with traffic.\n");
+    printf("  get_changed_pids <generation>   Return info about pids changed since generation.\n");
+    printf("  get_service_pids <service_id>   Return info about the pids of a service.\n");
+    printf("  get_section_pools               Return PSI section pool counters.\n");
+    printf("  get_outputs                     Return info about all outputs.\n");
+    printf("Event commands (-s only):\n");
+    printf("  watch_events [kinds] [pid] [sid] Print events as they happen; kinds is a\n");
+    printf("                                  list of %s,%s,%s,%s,%s,%s or all.\n",
+           ppsz_event_kinds[0], ppsz_event_kinds[1], ppsz_event_kinds[2],
+           ppsz_event_kinds[3], ppsz_event_kinds[4], ppsz_event_kinds[5]);
     printf("\n");
     exit(1);
 }
 
-int main( int i_argc, char **ppsz_argv )
+/* A command and its request, built once and sent at each round of -w */
+typedef struct ctl_command_t
 {
-    char *client_socket_tmpl = "dvblastctl.clientsock.XXXXXX";
-    char *psz_srv_socket = NULL;
-    int i;
-    char *p_cmd, *p_arg1 = NULL, *p_arg2 = NULL;
-    ssize_t i_size;
-    struct sockaddr_un sun_client, sun_server;
-    uint8_t p_buffer[COMM_BUFFER_SIZE];
-    uint8_t *p_data = p_buffer + COMM_HEADER_SIZE;
-    uint16_t i_pid = 0;
-    struct dvblastctl_option opt = { 0, 0, 0 };
-
-    for ( ; ; )
-    {
-        int c;
-
-        static const struct option long_options[] =
-        {
-            {"remote-socket", required_argument, NULL, 'r'},
-            {"print", required_argument, NULL, 'x'},
-            {"help", no_argument, NULL, 'h'},
-            {0, 0, 0, 0}
-        };
-
-        if ( (c = getopt_long(i_argc, ppsz_argv, "r:x:h", long_options, NULL)) == -1 )
-            break;
-
-        switch ( c )
-        {
-        case 'r':
-            psz_srv_socket = optarg;
-            break;
-
-        case 'x':
-            if ( !strcmp(optarg, "text") )
-                i_print_type = PRINT_TEXT;
-            else if ( !strcmp(optarg, "xml") )
-                i_print_type = PRINT_XML;
-            else
-                msg_Warn( NULL, "unrecognized print type %s", optarg );
-            /* Make stdout line-buffered */
-            setvbuf(stdout, NULL, _IOLBF, 0);
-            break;
-
-        case 'h':
-        default:
-            usage();
-        }
-    }
-
-    /* Validate commands */
-#define usage_error(msg, ...) \
-        do { \
-            msg_Err( NULL, msg, ##__VA_ARGS__ ); \
-            usage(); \
-        } while(0)
-    p_cmd  = ppsz_argv[optind];
-    p_arg1 = ppsz_argv[optind + 1];
-    p_arg2 = ppsz_argv[optind + 2];
-
-    if ( !psz_srv_socket )
-        usage_error( "Remote socket is not set.\n" );
-
-    if ( !p_cmd )
-       usage_error( "Command is not set.\n" );
-
-    i = 0;
-    do {
-        if ( streq(ppsz_argv[optind], options[i].opt) )
-        {
-            opt = options[i];
-            break;
-        }
-    } while ( options[++i].opt );
-
-    if ( !opt.opt )
-        usage_error( "Unknown command: %s\n", p_cmd );
-
-    if ( opt.nparams == 1 && !p_arg1 )
-        usage_error( "%s option needs parameter.\n", opt.opt );
-
-    if ( opt.nparams == 2 && (!p_arg1 || !p_arg2) )
-        usage_error( "%s option needs two parameters.\n", opt.opt );
-#undef usage_error
-
-    /* Create client socket name */
-    char *tmpdir = getenv("TMPDIR");
-    snprintf( psz_client_socket, PATH_MAX - 1, "%s/%s",
-       tmpdir ? tmpdir : "/tmp", client_socket_tmpl );
-    psz_client_socket[PATH_MAX - 1] = '\0';
-
-    int tmp_fd = mkstemp(psz_client_socket);
-    if ( tmp_fd > -1 ) {
-        close(tmp_fd);
-        unlink(psz_client_socket);
-    } else {
-        return_error( "Cannot build UNIX socket %s (%s)", psz_client_socket, strerror(errno) );
-    }
+    const struct dvblastctl_option *p_opt;
+    char *psz_line;                     /* as typed, for batch results */
+    char *ppsz_args[3];
+    uint8_t *p_request;
+    ssize_t i_request_size;
+    uint16_t i_pid;
+} ctl_command_t;
+
+static bool b_stream = false;
+static bool b_batch = false;
+static volatile sig_atomic_t b_exit = 0;
+static struct sockaddr_un sun_server;
+
+static void sig_handler( int i_signal )
+{
+    b_exit = 1;
+}
 
-    if ( (i_fd = socket( AF_UNIX, SOCK_DGRAM, 0 )) < 0 )
-        return_error( "Cannot create UNIX socket (%s)", strerror(errno) );
+static const struct dvblastctl_option *find_option( char *psz_cmd )
+{
+    int i;
 
-    i = COMM_MAX_MSG_CHUNK;
-    setsockopt( i_fd, SOL_SOCKET, SO_RCVBUF, &i, sizeof(i) );
+    for ( i = 0; options[i].opt != NULL; i++ )
+        if ( streq(psz_cmd, options[i].opt) )
+            return &options[i];
+    return NULL;
+}
 
-    memset( &sun_client, 0, sizeof(sun_client) );
-    sun_client.sun_family = AF_UNIX;
-    strncpy( sun_client.sun_path, psz_client_socket,
-             sizeof(sun_client.sun_path) );
-    sun_client.sun_path[sizeof(sun_client.sun_path) - 1] = '\0';
+/*****************************************************************************
+ * build_request : from the command and its arguments
+ *****************************************************************************/
+static void build_request( ctl_command_t *p_command )
+{
+    const struct dvblastctl_option *p_opt = p_command->p_opt;
+    char *p_arg1 = p_command->ppsz_args[0];
+    char *p_arg2 = p_command->ppsz_args[1];
+    char *p_arg3 = p_command->ppsz_args[2];
+    uint8_t *p_buffer = malloc( COMM_BUFFER_SIZE );
+    uint8_t *p_data = p_buffer + COMM_HEADER_SIZE;
+    ssize_t i_size;
+    int i;
 
-    if ( bind( i_fd, (struct sockaddr *)&sun_client,
-               SUN_LEN(&sun_client) ) < 0 )
-        return_error( "Cannot bind (%s)", strerror(errno) );
+    if ( p_opt->nparams == 1 && !p_arg1 )
+        return_error( "%s option needs parameter.", p_opt->opt );
 
-    memset( &sun_server, 0, sizeof(sun_server) );
-    sun_server.sun_family = AF_UNIX;
-    strncpy( sun_server.sun_path, psz_srv_socket, sizeof(sun_server.sun_path) );
-    sun_server.sun_path[sizeof(sun_server.sun_path) - 1] = '\0';
+    if ( p_opt->nparams == 2 && (!p_arg1 || !p_arg2) )
+        return_error( "%s option needs two parameters.", p_opt->opt );
 
     p_buffer[0] = COMM_HEADER_MAGIC;
-    p_buffer[1] = opt.cmd;
+    p_buffer[1] = p_opt->cmd;
     memset( p_buffer + 2, 0, COMM_HEADER_SIZE - 2 );
     i_size = COMM_HEADER_SIZE;
 
-    /* Handle commands that send parameters */
-    switch ( opt.cmd )
+    switch ( p_opt->cmd )
     {
     case CMD_INVALID:
     case CMD_RELOAD:
@@ -414,6 +613,8 @@ int main( int i_argc, char **ppsz_argv )
     case CMD_GET_NIT:
     case CMD_GET_SDT:
     case CMD_GET_PIDS:
+    case CMD_GET_SECTION_POOLS:
+    case CMD_GET_OUTPUTS:
         /* These commands need no special handling because they have no parameters */
         break;
     case CMD_GET_PMT:
@@ -424,9 +625,79 @@ int main( int i_argc, char **ppsz_argv )
         p_data[1] = (uint8_t)(i_sid & 0xff);
         break;
     }
+    case CMD_ADD_OUTPUT:
+    case CMD_CHANGE_OUTPUT:
+    case CMD_DELETE_OUTPUT:
+    {
+        size_t i_len = strlen(p_arg1);
+        if ( i_len > COMM_BUFFER_SIZE - COMM_HEADER_SIZE )
+            return_error( "Configuration line is too long" );
+        memcpy( p_data, p_arg1, i_len );
+        i_size = COMM_HEADER_SIZE + i_len;
+        break;
+    }
+    case CMD_GET_PIDS_SPARSE:
+    {
+        struct cmd_pids_query query;
+
+        memset( &query, 0, sizeof(query) );
+        if ( streq(p_opt->opt, "get_active_pids") )
+            query.i_flags = PIDS_ACTIVE;
+        else if ( streq(p_opt->opt, "get_changed_pids") )
+        {
+            query.i_flags = PIDS_CHANGED;
+            query.i_generation = strtoul(p_arg1, NULL, 0);
+        }
+        else
+        {
+            query.i_flags = PIDS_SID;
+            query.i_sid = atoi(p_arg1);
+        }
+        memcpy( p_data, &query, sizeof(query) );
+        i_size = COMM_HEADER_SIZE + sizeof(query);
+        break;
+    }
+    case CMD_SUBSCRIBE_EVENTS:
+    {
+        struct cmd_subscribe subscribe;
+        char *psz_kinds = p_arg1 != NULL ? strdup(p_arg1) : NULL;
+        char *psz_kind, *psz_saveptr;
+
+        if ( !b_stream )
+            return_error( "Events are only sent on a --remote-stream socket (-s)" );
+
+        memset( &subscribe, 0, sizeof(subscribe) );
+        subscribe.i_pid = EVENT_ANY_PID;
+        if ( psz_kinds == NULL || streq(psz_kinds, "all") )
+            subscribe.i_kinds = (1 << EVENT_KINDS) - 1;
+        else
+        {
+            for ( psz_kind = strtok_r( psz_kinds, ",", &psz_saveptr );
+                  psz_kind != NULL;
+                  psz_kind = strtok_r( NULL, ",", &psz_saveptr ) )
+            {
+                for ( i = 0; i < EVENT_KINDS; i++ )
+                    if ( streq(psz_kind, ppsz_event_kinds[i]) )
+                        break;
+                if ( i == EVENT_KINDS )
+                    return_error( "Unknown event kind %s", psz_kind );
+                subscribe.i_kinds |= 1 << i;
+            }
+        }
+        free( psz_kinds );
+        if ( p_arg1 != NULL && p_arg2 != NULL && !streq(p_arg2, "any") )
+            subscribe.i_pid = atoi(p_arg2);
+        if ( p_arg1 != NULL && p_arg2 != NULL && p_arg3 != NULL )
+            subscribe.i_sid = atoi(p_arg3);
+
+        memcpy( p_data, &subscribe, sizeof(subscribe) );
+        i_size = COMM_HEADER_SIZE + sizeof(subscribe);
+        break;
+    }
     case CMD_GET_PID:
     {
-        i_pid = (uint16_t)atoi(p_arg1);
+        uint16_t i_pid = (uint16_t)atoi(p_arg1);
+        p_command->i_pid = i_pid;
         i_size = COMM_HEADER_SIZE + 2;
         p_data[0] = (uint8_t)((i_pid >> 8) & 0xff);
         p_data[1] = (uint8_t)(i_pid & 0xff);
@@ -482,37 +753,126 @@ int main( int i_argc, char **ppsz_argv )
 #endif
     default:
         /* This should not happen */
-        return_error( "Unhandled option (%d)", opt.cmd );
+        return_error( "Unhandled option (%d)", p_opt->cmd );
+    }
+
+
+    /* The stream endpoint needs the request size to frame it. */
+    if ( b_stream )
+    {
+        uint32_t i_packet_size = i_size;
+        memcpy( &p_buffer[4], &i_packet_size, sizeof(uint32_t) );
     }
+    p_command->p_request = p_buffer;
+    p_command->i_request_size = i_size;
+}
+
+/*****************************************************************************
+ * parse_command : one line of a batch, the last parameter takes the rest
+ * of the line so that config lines and MMI texts keep their spaces
+ *****************************************************************************/
+static bool parse_command( ctl_command_t *p_command, const char *psz_line )
+{
+    char *psz_cmd, *p;
+    int i;
 
-    /* Send command and receive answer */
-    if ( sendto( i_fd, p_buffer, i_size, 0, (struct sockaddr *)&sun_server,
-                 SUN_LEN(&sun_server) ) < 0 )
+    memset( p_command, 0, sizeof(ctl_command_t) );
+    p_command->psz_line = strdup( psz_line );
+    p = strdup( psz_line );
+    psz_cmd = strsep( &p, " \t" );
+    if ( (p_command->p_opt = find_option( psz_cmd )) == NULL )
+    {
+        msg_Err( NULL, "Unknown command: %s", psz_cmd );
+        return false;
+    }
+    if ( p_command->p_opt->cmd == CMD_SUBSCRIBE_EVENTS )
+    {
+        msg_Err( NULL, "%s can't be batched", psz_cmd );
+        return false;
+    }
+
+    for ( i = 0; i < p_command->p_opt->nparams && p != NULL; i++ )
+    {
+        p += strspn( p, " \t" );
+        if ( !*p )
+            break;
+        if ( i == p_command->p_opt->nparams - 1 )
+        {
+            p_command->ppsz_args[i] = p;
+            break;
+        }
+        p_command->ppsz_args[i] = strsep( &p, " \t" );
+    }
+
+    build_request( p_command );
+    return true;
+}
+
+/*****************************************************************************
+ * send_request, recv_answer
+ *****************************************************************************/
+static void send_request( ctl_command_t *p_command )
+{
+    if ( b_stream )
+    {
+        if ( send( i_fd, p_command->p_request, p_command->i_request_size, 0 )
+              != p_command->i_request_size )
+            return_error( "Cannot send comm socket (%s)", strerror(errno) );
+    }
+    else if ( sendto( i_fd, p_command->p_request, p_command->i_request_size,
+                      0, (struct sockaddr *)&sun_server,
+                      SUN_LEN(&sun_server) ) < 0 )
         return_error( "Cannot send comm socket (%s)", strerror(errno) );
+}
 
+static ssize_t recv_answer( uint8_t **pp_buffer )
+{
     uint32_t i_packet_size = 0, i_received = 0;
-    do {
-        i_size = recv( i_fd, p_buffer + i_received, COMM_MAX_MSG_CHUNK, 0 );
-        if ( i_size == -1 )
-            break;
-        if ( !i_packet_size ) {
-            uint32_t *p_packet_size = (uint32_t *)&p_buffer[4];
-            i_packet_size = *p_packet_size;
-            if ( i_packet_size > COMM_BUFFER_SIZE ) {
-                i_size = -1;
+    ssize_t i_size;
+
+    if ( b_stream )
+        i_size = stream_recv( pp_buffer );
+    else
+    {
+        do {
+            i_size = recv( i_fd, *pp_buffer + i_received, COMM_MAX_MSG_CHUNK, 0 );
+            if ( i_size == -1 )
                 break;
+            if ( !i_packet_size ) {
+                uint32_t *p_packet_size = (uint32_t *)&(*pp_buffer)[4];
+                i_packet_size = *p_packet_size;
+                if ( i_packet_size > COMM_BUFFER_SIZE ) {
+                    i_size = -1;
+                    break;
+                }
             }
-        }
-        i_received += i_size;
-    } while ( i_received < i_packet_size );
+            i_received += i_size;
+        } while ( i_received < i_packet_size );
+        if ( i_size >= 0 )
+            i_size = i_received;
+    }
 
-    clean_client_socket();
+    if ( b_exit )
+        return -1;
     if ( i_size < COMM_HEADER_SIZE )
         return_error( "Cannot recv from comm socket, size:%zd (%s)", i_size, strerror(errno) );
 
     /* Process answer */
-    if ( p_buffer[0] != COMM_HEADER_MAGIC )
-        return_error( "Wrong protocol version 0x%x", p_buffer[0] );
+    if ( (*pp_buffer)[0] != COMM_HEADER_MAGIC )
+        return_error( "Wrong protocol version 0x%x", (*pp_buffer)[0] );
+    return i_size;
+}
+
+/*****************************************************************************
+ * print_answer : prints the answer and returns the exit status of the command
+ *****************************************************************************/
+static int print_answer( ctl_command_t *p_command, uint8_t *p_buffer,
+                         ssize_t i_size )
+{
+    uint8_t *p_data = p_buffer + COMM_HEADER_SIZE;
+    ssize_t i_received = i_size;
+    uint16_t i_pid = p_command->i_pid;
+    int i;
 
     now = mdate();
 
@@ -523,19 +883,19 @@ int main( int i_argc, char **ppsz_argv )
         break;
 
     case RET_MMI_WAIT:
-        exit(252);
+        return 252;
         break;
 
     case RET_ERR:
-        return_error( "Request failed" );
+        return answer_error( "Request failed" );
         break;
 
     case RET_HUH:
-        return_error( "Internal error" );
+        return answer_error( "Internal error" );
         break;
 
     case RET_NODATA:
-        return_error( "No data" );
+        return answer_error( "No data" );
         break;
 
     case RET_PAT:
@@ -548,7 +908,7 @@ int main( int i_argc, char **ppsz_argv )
         uint8_t **pp_sections = psi_unpack_sections( p_flat_data, i_flat_data_size );
         if ( !pp_sections )
         {
-            return_error( "Error unpacking PSI" );
+            return answer_error( "Error unpacking PSI" );
             break;
         }
 
@@ -586,6 +946,24 @@ int main( int i_argc, char **ppsz_argv )
         break;
     }
 
+    case RET_PIDS_SPARSE:
+    {
+        print_pids_sparse( p_data, i_received - COMM_HEADER_SIZE );
+        break;
+    }
+
+    case RET_SECTION_POOLS:
+    {
+        print_section_pools( p_data );
+        break;
+    }
+
+    case RET_OUTPUTS:
+    {
+        print_outputs( p_data, i_received - COMM_HEADER_SIZE );
+        break;
+    }
+
 #ifdef HAVE_DVB_SUPPORT
     case RET_FRONTEND_STATUS:
     {
@@ -593,7 +971,7 @@ int main( int i_argc, char **ppsz_argv )
         struct ret_frontend_status *p_ret =
             (struct ret_frontend_status *)&p_buffer[COMM_HEADER_SIZE];
         if ( i_size != COMM_HEADER_SIZE + sizeof(struct ret_frontend_status) )
-            return_error( "Bad frontend status" );
+            return answer_error( "Bad frontend status" );
 
         if ( i_print_type == PRINT_XML )
             printf("<FRONTEND>\n");
@@ -731,7 +1109,7 @@ int main( int i_argc, char **ppsz_argv )
         if ( i_print_type == PRINT_XML )
             printf("</FRONTEND>\n" );
 
-        exit(ret);
+        return ret;
         break;
     }
 
@@ -740,7 +1118,7 @@ int main( int i_argc, char **ppsz_argv )
         struct ret_mmi_status *p_ret =
             (struct ret_mmi_status *)&p_buffer[COMM_HEADER_SIZE];
         if ( i_size != COMM_HEADER_SIZE + sizeof(struct ret_mmi_status) )
-            return_error( "Bad MMI status" );
+            return answer_error( "Bad MMI status" );
 
         printf("CA interface with %d %s, type:\n", p_ret->caps.slot_num,
                p_ret->caps.slot_num == 1 ? "slot" : "slots");
@@ -765,7 +1143,7 @@ int main( int i_argc, char **ppsz_argv )
         PRINT_DESC( DSS );
 #undef PRINT_DESC
 
-        exit( p_ret->caps.slot_num );
+        return p_ret->caps.slot_num;
         break;
     }
 
@@ -774,7 +1152,7 @@ int main( int i_argc, char **ppsz_argv )
         struct ret_mmi_slot_status *p_ret =
             (struct ret_mmi_slot_status *)&p_buffer[COMM_HEADER_SIZE];
         if ( i_size < COMM_HEADER_SIZE + sizeof(struct ret_mmi_slot_status) )
-            return_error( "Bad MMI slot status" );
+            return answer_error( "Bad MMI slot status" );
 
         printf("CA slot #%u: ", p_ret->sinfo.num);
 
@@ -790,7 +1168,7 @@ int main( int i_argc, char **ppsz_argv )
         if ( p_ret->sinfo.flags & CA_CI_MODULE_READY )
         {
             printf("module present and ready\n");
-            exit(0);
+            return 0;
         }
 
         if ( p_ret->sinfo.flags & CA_CI_MODULE_PRESENT )
@@ -798,7 +1176,7 @@ int main( int i_argc, char **ppsz_argv )
         else
             printf("module not present\n");
 
-        exit(1);
+        return 1;
         break;
     }
 
@@ -807,7 +1185,7 @@ int main( int i_argc, char **ppsz_argv )
         struct ret_mmi_recv *p_ret =
             (struct ret_mmi_recv *)&p_buffer[COMM_HEADER_SIZE];
         if ( i_size < COMM_HEADER_SIZE + sizeof(struct ret_mmi_recv) )
-            return_error( "Bad MMI recv" );
+            return answer_error( "Bad MMI recv" );
 
         en50221_UnserializeMMIObject( &p_ret->object, i_size
           - COMM_HEADER_SIZE - ((void *)&p_ret->object - (void *)p_ret) );
@@ -817,7 +1195,7 @@ int main( int i_argc, char **ppsz_argv )
         case EN50221_MMI_ENQ:
             printf("%s\n", p_ret->object.u.enq.psz_text);
             printf("(empty to cancel)\n");
-            exit(p_ret->object.u.enq.b_blind ? 253 : 254);
+            return p_ret->object.u.enq.b_blind ? 253 : 254;
             break;
 
         case EN50221_MMI_MENU:
@@ -828,7 +1206,7 @@ int main( int i_argc, char **ppsz_argv )
                 printf("%d - %s\n", i + 1,
                        p_ret->object.u.menu.ppsz_choices[i]);
             printf("%s\n", p_ret->object.u.menu.psz_bottom);
-            exit(p_ret->object.u.menu.i_choices);
+            return p_ret->object.u.menu.i_choices;
             break;
 
         case EN50221_MMI_LIST:
@@ -838,27 +1216,386 @@ int main( int i_argc, char **ppsz_argv )
                 printf("%s\n", p_ret->object.u.menu.ppsz_choices[i]);
             printf("%s\n", p_ret->object.u.menu.psz_bottom);
             printf("(0 to cancel)\n");
-            exit(0);
+            return 0;
             break;
 
         default:
-            return_error( "Unknown MMI object" );
+            return answer_error( "Unknown MMI object" );
             break;
         }
 
-        exit(255);
+        return 255;
         break;
     }
 #endif
 
     default:
-        return_error( "Unknown command answer: %u", c_answer );
+        return answer_error( "Unknown command answer: %u", c_answer );
+    }
+
+
+    return 0;
+}
+
+/*****************************************************************************
+ * Batch results
+ *****************************************************************************/
+static void print_escaped( const char *psz_string, bool b_json_string )
+{
+    for ( ; *psz_string; psz_string++ )
+    {
+        unsigned char c = *psz_string;
+
+        if ( b_json_string && (c == '"' || c == '\\') )
+            printf("\\%c", c);
+        else if ( b_json_string && c == '\n' )
+            printf("\\n");
+        else if ( b_json_string && c < 0x20 )
+            printf("\\u%04x", c);
+        else if ( !b_json_string && c == '"' )
+            printf("&quot;");
+        else if ( !b_json_string && c == '&' )
+            printf("&amp;");
+        else if ( !b_json_string && c == '<' )
+            printf("&lt;");
+        else if ( !b_json_string && c == '>' )
+            printf("&gt;");
+        else
+            putchar( c );
+    }
+}
+
+static void print_result( ctl_command_t *p_command, int i_index, int i_status,
+                          char *psz_output, size_t i_output_size )
+{
+    if ( b_json )
+    {
+        /* Only PID queries print JSON, the others are kept as text. */
+        bool b_raw = p_command->p_opt->cmd == CMD_GET_PIDS_SPARSE
+                      && i_output_size;
+
+        while ( i_output_size && psz_output[i_output_size - 1] == '\n' )
+            psz_output[--i_output_size] = '\0';
+        printf("%s{\"cmd\":\"", i_index ? "," : "");
+        print_escaped( p_command->psz_line, true );
+        printf("\",\"status\":%d,%s", i_status,
+               b_raw ? "\"result\":" : "\"output\":\"");
+        if ( b_raw )
+            printf("%s}", psz_output);
+        else
+        {
+            print_escaped( psz_output, true );
+            printf("\"}");
+        }
+    }
+    else if ( i_print_type == PRINT_XML )
+    {
+        printf("<COMMAND cmd=\"");
+        print_escaped( p_command->psz_line, false );
+        printf("\" status=\"%d\">\n%s</COMMAND>\n", i_status, psz_output);
+    }
+    else
+        printf("== %s (status %d)\n%s", p_command->psz_line, i_status,
+               psz_output);
+}
+
+/*****************************************************************************
+ * run_commands : sends the commands, keeping as many requests in flight as
+ * the request buffer of DVBlast holds on a stream socket, and prints the
+ * answers in order. Returns the highest exit status.
+ *****************************************************************************/
+static int run_commands( ctl_command_t *p_commands, int i_nb_commands,
+                         uint8_t **pp_buffer )
+{
+    int i_sent = 0, i_done = 0, i_status = 0;
+    size_t i_in_flight = 0;
+
+    if ( b_batch )
+    {
+        if ( b_json )
+            printf("[");
+        else if ( i_print_type == PRINT_XML )
+            printf("<BATCH>\n");
+    }
+
+    while ( i_done < i_nb_commands )
+    {
+        ctl_command_t *p_command = &p_commands[i_done];
+        ssize_t i_size;
+        int i_ret;
+
+        while ( i_sent < i_nb_commands
+                 && (i_sent == i_done
+                      || (b_stream && i_in_flight
+                           + p_commands[i_sent].i_request_size
+                           <= COMM_BUFFER_SIZE)) )
+        {
+            send_request( &p_commands[i_sent] );
+            i_in_flight += p_commands[i_sent++].i_request_size;
+        }
+
+        if ( (i_size = recv_answer( pp_buffer )) < 0 )
+            return i_status;
+        i_in_flight -= p_command->i_request_size;
+
+        if ( b_batch )
+        {
+            /* Results are collected to be printed with their status. */
+            FILE *p_stdout = stdout;
+            char *psz_output = NULL;
+            size_t i_output_size = 0;
+
+            stdout = open_memstream( &psz_output, &i_output_size );
+            i_ret = print_answer( p_command, *pp_buffer, i_size );
+            fclose( stdout );
+            stdout = p_stdout;
+            print_result( p_command, i_done, i_ret, psz_output,
+                          i_output_size );
+            free( psz_output );
+        }
+        else
+            i_ret = print_answer( p_command, *pp_buffer, i_size );
+
+        if ( i_ret > i_status )
+            i_status = i_ret;
+        i_done++;
+    }
+
+    if ( b_batch )
+    {
+        if ( b_json )
+            printf("]\n");
+        else if ( i_print_type == PRINT_XML )
+            printf("</BATCH>\n");
+    }
+    fflush( stdout );
+    return i_status;
+}
+
+int main( int i_argc, char **ppsz_argv )
+{
+    char *client_socket_tmpl = "dvblastctl.clientsock.XXXXXX";
+    char *psz_srv_socket = NULL;
+    int i, i_status;
+    char *p_cmd;
+    struct sockaddr_un sun_client;
+    uint8_t *p_buffer = malloc( COMM_BUFFER_SIZE );
+    ctl_command_t *p_commands = NULL;
+    int i_nb_commands = 0;
+    mtime_t i_watch = 0;
+
+    for ( ; ; )
+    {
+        int c;
+
+        static const struct option long_options[] =
+        {
+            {"remote-socket", required_argument, NULL, 'r'},
+            {"print", required_argument, NULL, 'x'},
+            {"stream", no_argument, NULL, 's'},
+            {"batch", no_argument, NULL, 'b'},
+            {"watch", required_argument, NULL, 'w'},
+            {"help", no_argument, NULL, 'h'},
+            {0, 0, 0, 0}
+        };
+
+        if ( (c = getopt_long(i_argc, ppsz_argv, "r:x:sbw:h", long_options, NULL)) == -1 )
+            break;
+
+        switch ( c )
+        {
+        case 'r':
+            psz_srv_socket = optarg;
+            break;
+
+        case 'x':
+            if ( !strcmp(optarg, "text") )
+                i_print_type = PRINT_TEXT;
+            else if ( !strcmp(optarg, "xml") )
+                i_print_type = PRINT_XML;
+            else if ( !strcmp(optarg, "json") )
+                b_json = true;
+            else
+                msg_Warn( NULL, "unrecognized print type %s", optarg );
+            /* Make stdout line-buffered */
+            setvbuf(stdout, NULL, _IOLBF, 0);
+            break;
+
+        case 's':
+            b_stream = true;
+            break;
+
+        case 'b':
+            b_batch = true;
+            break;
+
+        case 'w':
+            i_watch = strtod( optarg, NULL ) * 1000000;
+            break;
+
+        case 'h':
+        default:
+            usage();
+        }
     }
 
+    /* Validate commands */
+#define usage_error(msg, ...) \
+        do { \
+            msg_Err( NULL, msg, ##__VA_ARGS__ ); \
+            usage(); \
+        } while(0)
+    p_cmd  = ppsz_argv[optind];
+
+    if ( !psz_srv_socket )
+        usage_error( "Remote socket is not set.\n" );
+
+    if ( b_batch )
+    {
+        char *psz_line = NULL;
+        size_t i_line_size = 0;
+
+        /* Commands are the arguments, or the lines of stdin. */
+        for ( i = optind; i < i_argc || (optind == i_argc
+               && getline( &psz_line, &i_line_size, stdin ) != -1);
+              i++ )
+        {
+            char *psz_command = optind < i_argc ? ppsz_argv[i] : psz_line;
+
+            psz_command[strcspn( psz_command, "\r\n" )] = '\0';
+            psz_command += strspn( psz_command, " \t" );
+            if ( !*psz_command || *psz_command == '#' )
+                continue;
+
+            p_commands = realloc( p_commands,
+                                  (i_nb_commands + 1) * sizeof(ctl_command_t) );
+            if ( !parse_command( &p_commands[i_nb_commands], psz_command ) )
+                usage();
+            i_nb_commands++;
+        }
+        free( psz_line );
+
+        if ( !i_nb_commands )
+            usage_error( "Command is not set.\n" );
+    }
+    else
+    {
+        if ( !p_cmd )
+           usage_error( "Command is not set.\n" );
+
+        p_commands = calloc( 1, sizeof(ctl_command_t) );
+        i_nb_commands = 1;
+        p_commands->psz_line = p_cmd;
+        if ( (p_commands->p_opt = find_option( p_cmd )) == NULL )
+            usage_error( "Unknown command: %s\n", p_cmd );
+        for ( i = 0; i < 3 && optind + 1 + i < i_argc; i++ )
+            p_commands->ppsz_args[i] = ppsz_argv[optind + 1 + i];
+        if ( p_commands->p_opt->cmd == CMD_SUBSCRIBE_EVENTS && i_watch )
+            usage_error( "watch_events can't be used with --watch.\n" );
+        build_request( p_commands );
+    }
+#undef usage_error
+
+    memset( &sun_server, 0, sizeof(sun_server) );
+    sun_server.sun_family = AF_UNIX;
+    strncpy( sun_server.sun_path, psz_srv_socket, sizeof(sun_server.sun_path) );
+    sun_server.sun_path[sizeof(sun_server.sun_path) - 1] = '\0';
+
+    if ( b_stream )
+    {
+        if ( (i_fd = socket( AF_UNIX, SOCK_STREAM, 0 )) < 0 )
+            return_error( "Cannot create UNIX socket (%s)", strerror(errno) );
+        if ( connect( i_fd, (struct sockaddr *)&sun_server,
+                      SUN_LEN(&sun_server) ) < 0 )
+            return_error( "Cannot connect (%s)", strerror(errno) );
+    }
+    else
+    {
+        /* Create client socket name */
+        char *tmpdir = getenv("TMPDIR");
+        snprintf( psz_client_socket, PATH_MAX - 1, "%s/%s",
+           tmpdir ? tmpdir : "/tmp", client_socket_tmpl );
+        psz_client_socket[PATH_MAX - 1] = '\0';
+
+        int tmp_fd = mkstemp(psz_client_socket);
+        if ( tmp_fd > -1 ) {
+            close(tmp_fd);
+            unlink(psz_client_socket);
+        } else {
+            return_error( "Cannot build UNIX socket %s (%s)", psz_client_socket, strerror(errno) );
+        }
+
+        if ( (i_fd = socket( AF_UNIX, SOCK_DGRAM, 0 )) < 0 )
+            return_error( "Cannot create UNIX socket (%s)", strerror(errno) );
+
+        i = COMM_MAX_MSG_CHUNK;
+        setsockopt( i_fd, SOL_SOCKET, SO_RCVBUF, &i, sizeof(i) );
+
+        memset( &sun_client, 0, sizeof(sun_client) );
+        sun_client.sun_family = AF_UNIX;
+        strncpy( sun_client.sun_path, psz_client_socket,
+                 sizeof(sun_client.sun_path) );
+        sun_client.sun_path[sizeof(sun_client.sun_path) - 1] = '\0';
+
+        if ( bind( i_fd, (struct sockaddr *)&sun_client,
+                   SUN_LEN(&sun_client) ) < 0 )
+            return_error( "Cannot bind (%s)", strerror(errno) );
+    }
+
+    if ( p_commands->p_opt->cmd == CMD_SUBSCRIBE_EVENTS )
+    {
+        ssize_t i_size;
+
+        send_request( p_commands );
+        i_size = recv_answer( &p_buffer );
+        if ( p_buffer[1] != RET_OK )
+            return print_answer( p_commands, p_buffer, i_size );
+
+        /* Subscribed: print events until DVBlast goes away. */
+        setvbuf(stdout, NULL, _IOLBF, 0);
+        while ( (i_size = stream_recv( &p_buffer )) > 0 )
+        {
+            if ( p_buffer[0] != COMM_HEADER_MAGIC )
+                return_error( "Wrong protocol version 0x%x", p_buffer[0] );
+            if ( p_buffer[1] == RET_EVENTS )
+                print_events( p_buffer + COMM_HEADER_SIZE,
+                              i_size - COMM_HEADER_SIZE );
+        }
+        return_error( "Connection closed" );
+    }
+
+    if ( i_watch )
+    {
+        /* Interrupting the watch still removes the client socket. */
+        struct sigaction sa;
+
+        memset( &sa, 0, sizeof(sa) );
+        sa.sa_handler = sig_handler;
+        sigaction( SIGINT, &sa, NULL );
+        sigaction( SIGTERM, &sa, NULL );
+    }
+
+    for ( ; ; )
+    {
+        struct timespec delay = { i_watch / 1000000,
+                                  (i_watch % 1000000) * 1000 };
+
+        i_status = run_commands( p_commands, i_nb_commands, &p_buffer );
+        if ( !i_watch || b_exit )
+            break;
+        nanosleep( &delay, NULL );
+        if ( b_exit )
+            break;
+        if ( !b_batch && i_print_type == PRINT_TEXT && !b_json )
+            printf("\n");
+    }
+
+    clean_client_socket();
+
     if (iconv_handle != (iconv_t)-1) {
         iconv_close(iconv_handle);
         iconv_handle = (iconv_t)-1;
     }
 
-    return 0;
+    return i_status;
 }
@@ -0,0 +1,181 @@
+/*****************************************************************************
+ * dvblaststat.c: Prints the statistics file of a DVBlast instance
+ *****************************************************************************
+ * Copyright (C) 2026 VideoLAN
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+
+#include "dvblast.h"
+#include "stats.h"
+
+int i_verbose = 3;
+int i_syslog = 0;
+
+/*****************************************************************************
+ * ReadSegment : consistent copy of the segment, following its seqlock
+ *****************************************************************************/
+static bool ReadSegment( const stats_segment_t *p_shared,
+                         stats_segment_t *p_copy )
+{
+    int i_tries;
+
+    for ( i_tries = 0; i_tries < 1000; i_tries++ )
+    {
+        uint32_t i_seq = p_shared->i_seq;
+
+        if ( i_seq & 1 )
+        {
+            usleep( 1000 );
+            continue;
+        }
+        __sync_synchronize();
+        memcpy( p_copy, (const void *)p_shared, sizeof(stats_segment_t) );
+        __sync_synchronize();
+        if ( p_shared->i_seq == i_seq )
+            return true;
+    }
+
+    return false;
+}
+
+static void usage( void )
+{
+    printf("DVBlaststat %s (%s)\n", VERSION, VERSION_EXTRA );
+    printf("Usage: dvblaststat [-a] <stats file>\n");
+    printf("Options:\n");
+    printf("  -a                              Also print PIDs without traffic.\n");
+    exit(1);
+}
+
+int main( int i_argc, char **ppsz_argv )
+{
+    stats_segment_t *p_shared, *p_stats;
+    bool b_all = false;
+    uint32_t i;
+    int i_fd, c;
+
+    while ( (c = getopt( i_argc, ppsz_argv, "ah" )) != -1 )
+    {
+        switch ( c )
+        {
+        case 'a':
+            b_all = true;
+            break;
+        default:
+            usage();
+        }
+    }
+    if ( optind >= i_argc )
+        usage();
+
+    if ( (i_fd = open( ppsz_argv[optind], O_RDONLY )) < 0 )
+    {
+        msg_Err( NULL, "couldn't open %s (%s)", ppsz_argv[optind],
+                 strerror(errno) );
+        return 255;
+    }
+    p_shared = mmap( NULL, sizeof(stats_segment_t), PROT_READ, MAP_SHARED,
+                     i_fd, 0 );
+    close( i_fd );
+    if ( p_shared == MAP_FAILED )
+    {
+        msg_Err( NULL, "couldn't map %s (%s)", ppsz_argv[optind],
+                 strerror(errno) );
+        return 255;
+    }
+    if ( p_shared->i_magic != STATS_MAGIC
+          || p_shared->i_version != STATS_VERSION )
+    {
+        msg_Err( NULL, "%s is not a DVBlast stats file of version %d",
+                 ppsz_argv[optind], STATS_VERSION );
+        return 255;
+    }
+
+    p_stats = malloc( sizeof(stats_segment_t) );
+    if ( !ReadSegment( p_shared, p_stats ) )
+    {
+        msg_Err( NULL, "the stats file is being updated for too long" );
+        return 255;
+    }
+    munmap( p_shared, sizeof(stats_segment_t) );
+
+    printf("writer %u updated %"PRId64" ms ago\n", p_stats->i_writer_pid,
+           (mdate() - p_stats->i_update) / 1000);
+    printf("input packn %"PRIu64" ccerr %"PRIu64" tserr %"PRIu64" Bps %u seen %u pids %u backup %u\n",
+           p_stats->input.i_packets,
+           p_stats->input.i_cc_errors,
+           p_stats->input.i_transport_errors,
+           p_stats->input.i_bytes_per_sec,
+           p_stats->input.i_last_seen,
+           p_stats->input.i_nb_pids,
+           p_stats->input.b_backup);
+
+    for ( i = 0; i < MAX_PIDS; i++ )
+    {
+        ts_pid_entry_t *p_entry = &p_stats->pids[i];
+
+        if ( !b_all && !p_entry->i_packets )
+            continue;
+        printf("pid %u packn %"PRIu64" ccerr %u tserr %u scramble %u Bps %u seen %u dropped %u\n",
+               p_entry->i_pid,
+               p_entry->i_packets,
+               p_entry->i_cc_errors,
+               p_entry->i_transport_errors,
+               p_entry->i_scrambling,
+               p_entry->i_bytes_per_sec,
+               p_entry->i_last_seen,
+               p_entry->i_dropped);
+    }
+
+    for ( i = 0; i < p_stats->i_nb_services && i < STATS_MAX_SERVICES; i++ )
+    {
+        stats_service_t *p_service = &p_stats->services[i];
+
+        printf("service %u pmt %u pids %u packn %"PRIu64" ccerr %u tserr %u Bps %u scrambled %u\n",
+               p_service->i_sid,
+               p_service->i_pmt_pid,
+               p_service->i_nb_pids,
+               p_service->i_packets,
+               p_service->i_cc_errors,
+               p_service->i_transport_errors,
+               p_service->i_bytes_per_sec,
+               p_service->b_scrambled);
+    }
+
+    for ( i = 0; i < p_stats->i_nb_outputs && i < STATS_MAX_OUTPUTS; i++ )
+    {
+        stats_output_t *p_output = &p_stats->outputs[i];
+
+        p_output->psz_displayname[sizeof(p_output->psz_displayname) - 1] =
+            '\0';
+        printf("output %s sid %u queue %u packets %"PRIu64" bytes %"PRIu64" errors %u dropped %"PRIu64"\n",
+               p_output->psz_displayname,
+               p_output->i_sid,
+               p_output->i_queue_depth,
+               p_output->i_packets,
+               p_output->i_bytes,
+               p_output->i_send_errors,
+               p_output->i_dropped);
+    }
+
+    free( p_stats );
+    return 0;
+}
@@ -1035,6 +1035,8 @@ static void ApplicationInformationHandle( access_t * p_access, int i_session_id,
             psz_name[l] = '\0';
             msg_Info( p_access, "CAM: %s, %02X, %04X, %04X",
                       psz_name, i_type, i_manufacturer, i_code );
+            comm_Event( EVENT_CAM, EVENT_ANY_PID, 0,
+                        p_sessions[i_session_id - 1].i_slot, 1 );
             switch (i_print_type)
             {
             case PRINT_XML:
@@ -1879,6 +1881,7 @@ static void ResetSlot( int i_slot )
     ci_slot_t *p_slot = &p_slots[i_slot];
     int i_session_id;
 
+    comm_Event( EVENT_CAM, EVENT_ANY_PID, 0, i_slot, 0 );
     switch (i_print_type)
     {
     case PRINT_XML:
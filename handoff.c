@@ -0,0 +1,659 @@
+/*****************************************************************************
+ * handoff.c: Hands the inputs, outputs and state over to a new instance
+ *****************************************************************************
+ * Copyright (C) 2026 VideoLAN
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <errno.h>
+
+#include "dvblast.h"
+#include "handoff.h"
+
+/*****************************************************************************
+ * Local declarations
+ *****************************************************************************/
+/* The new instance connects to the socket of the running one, which sends
+ * one record per packet, then exits. File descriptors are attached to
+ * their record. */
+#define HANDOFF_RECORD_FD       0   /* key */
+#define HANDOFF_RECORD_OUTPUT   1   /* handoff_output_t, ..., display name */
+#define HANDOFF_RECORD_PSI      2   /* part of the PSI of input i_kind */
+#define HANDOFF_RECORD_END      3
+#define HANDOFF_MAX_RECORD      65536
+
+typedef struct handoff_record_t
+{
+    uint16_t i_type;
+    uint16_t i_kind;
+    uint32_t i_size;                    /* of the payload that follows */
+} handoff_record_t;
+
+typedef struct handoff_fd_t
+{
+    int i_kind;
+    int i_fd;
+    char *psz_key;
+} handoff_fd_t;
+
+typedef struct handoff_data_t
+{
+    int i_kind;
+    uint8_t *p_data;
+    size_t i_size;
+} handoff_data_t;
+
+static const char *psz_handoff_socket = NULL;
+static int i_listen_fd = -1;
+static int i_peer_fd = -1;
+static bool b_handed_over = false;
+static mtime_t i_next_check = 0;
+
+/* File descriptors of this instance, which would be handed over */
+static handoff_fd_t *p_fds = NULL;
+static int i_nb_fds = 0;
+
+/* State received from the previous instance, until handoff_Restore() */
+static handoff_fd_t *p_received_fds = NULL;
+static int i_nb_received_fds = 0;
+static handoff_data_t *p_received_psi = NULL;
+static int i_nb_received_psi = 0;
+static handoff_data_t *p_received_outputs = NULL;
+static int i_nb_received_outputs = 0;
+
+/*****************************************************************************
+ * Registry
+ *****************************************************************************/
+static void AddFd( handoff_fd_t **pp_fds, int *pi_nb_fds, int i_kind,
+                   const char *psz_key, int i_fd )
+{
+    handoff_fd_t *p_fd;
+
+    *pp_fds = realloc( *pp_fds, (*pi_nb_fds + 1) * sizeof(handoff_fd_t) );
+    p_fd = &(*pp_fds)[(*pi_nb_fds)++];
+    p_fd->i_kind = i_kind;
+    p_fd->i_fd = i_fd;
+    p_fd->psz_key = strdup( psz_key );
+}
+
+static void DeleteFd( handoff_fd_t *p_fds_array, int *pi_nb_fds, int i )
+{
+    free( p_fds_array[i].psz_key );
+    p_fds_array[i] = p_fds_array[--(*pi_nb_fds)];
+}
+
+static void AddData( handoff_data_t **pp_data, int *pi_nb_data, int i_kind,
+                     const uint8_t *p_data, size_t i_size )
+{
+    handoff_data_t *p_entry = NULL;
+    int i;
+
+    /* Records of the same kind are parts of the same data. */
+    for ( i = 0; i < *pi_nb_data; i++ )
+        if ( (*pp_data)[i].i_kind == i_kind )
+            p_entry = &(*pp_data)[i];
+
+    if ( p_entry == NULL )
+    {
+        *pp_data = realloc( *pp_data,
+                            (*pi_nb_data + 1) * sizeof(handoff_data_t) );
+        p_entry = &(*pp_data)[(*pi_nb_data)++];
+        p_entry->i_kind = i_kind;
+        p_entry->p_data = NULL;
+        p_entry->i_size = 0;
+    }
+
+    p_entry->p_data = realloc( p_entry->p_data, p_entry->i_size + i_size );
+    memcpy( p_entry->p_data + p_entry->i_size, p_data, i_size );
+    p_entry->i_size += i_size;
+}
+
+static void FreeReceived( void )
+{
+    int i;
+
+    for ( i = 0; i < i_nb_received_fds; i++ )
+    {
+        close( p_received_fds[i].i_fd );
+        free( p_received_fds[i].psz_key );
+    }
+    free( p_received_fds );
+    p_received_fds = NULL;
+    i_nb_received_fds = 0;
+
+    for ( i = 0; i < i_nb_received_psi; i++ )
+        free( p_received_psi[i].p_data );
+    free( p_received_psi );
+    p_received_psi = NULL;
+    i_nb_received_psi = 0;
+
+    for ( i = 0; i < i_nb_received_outputs; i++ )
+        free( p_received_outputs[i].p_data );
+    free( p_received_outputs );
+    p_received_outputs = NULL;
+    i_nb_received_outputs = 0;
+}
+
+/*****************************************************************************
+ * handoff_AddFd, handoff_RemoveFd : register the descriptors to hand over
+ *****************************************************************************/
+void handoff_AddFd( int i_kind, const char *psz_key, int i_fd )
+{
+    if ( psz_handoff_socket == NULL || i_fd < 0 )
+        return;
+    AddFd( &p_fds, &i_nb_fds, i_kind, psz_key, i_fd );
+}
+
+void handoff_RemoveFd( int i_fd )
+{
+    int i;
+
+    for ( i = 0; i < i_nb_fds; i++ )
+        if ( p_fds[i].i_fd == i_fd )
+        {
+            DeleteFd( p_fds, &i_nb_fds, i );
+            return;
+        }
+}
+
+/*****************************************************************************
+ * handoff_TakeFd : descriptor of the previous instance, or -1
+ *****************************************************************************/
+int handoff_TakeFd( int i_kind, const char *psz_key )
+{
+    int i, i_fd;
+
+    for ( i = 0; i < i_nb_received_fds; i++ )
+        if ( p_received_fds[i].i_kind == i_kind
+              && !strcmp( p_received_fds[i].psz_key, psz_key ) )
+        {
+            i_fd = p_received_fds[i].i_fd;
+            DeleteFd( p_received_fds, &i_nb_received_fds, i );
+            return i_fd;
+        }
+
+    return -1;
+}
+
+/*****************************************************************************
+ * SendRecord, Send : old instance
+ *****************************************************************************/
+static bool SendRecord( int i_fd, int i_type, int i_kind,
+                        const void *p_data, size_t i_size, int i_attached )
+{
+    handoff_record_t record;
+    struct iovec p_iov[2];
+    struct msghdr msg;
+    union
+    {
+        struct cmsghdr cmsg;
+        char p_buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    record.i_type = i_type;
+    record.i_kind = i_kind;
+    record.i_size = i_size;
+    p_iov[0].iov_base = &record;
+    p_iov[0].iov_len = sizeof(record);
+    p_iov[1].iov_base = (void *)p_data;
+    p_iov[1].iov_len = i_size;
+
+    memset( &msg, 0, sizeof(msg) );
+    msg.msg_iov = p_iov;
+    msg.msg_iovlen = 2;
+    if ( i_attached != -1 )
+    {
+        struct cmsghdr *p_cmsg;
+
+        memset( &control, 0, sizeof(control) );
+        msg.msg_control = control.p_buffer;
+        msg.msg_controllen = sizeof(control.p_buffer);
+        p_cmsg = CMSG_FIRSTHDR( &msg );
+        p_cmsg->cmsg_level = SOL_SOCKET;
+        p_cmsg->cmsg_type = SCM_RIGHTS;
+        p_cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy( CMSG_DATA(p_cmsg), &i_attached, sizeof(int) );
+    }
+
+    return sendmsg( i_fd, &msg, MSG_NOSIGNAL )
+            == (ssize_t)(sizeof(record) + i_size);
+}
+
+static bool SendOutput( int i_fd, output_t *p_output )
+{
+    const char *psz_name = p_output->config.psz_displayname;
+    handoff_output_t state;
+    handoff_service_t *p_services;
+    uint32_t i_nb_services = p_output->p_services != NULL ?
+                             p_output->config.i_nb_sids : 0;
+    size_t i_size = sizeof(state) + i_nb_services * sizeof(handoff_service_t)
+                     + p_output->i_nb_cc_pids * sizeof(pid_cc_t)
+                     + strlen( psz_name ) + 1;
+    uint8_t *p_data, *p;
+    uint32_t i;
+    bool b_ret;
+
+    memset( &state, 0, sizeof(state) );
+    state.i_ref_timestamp = p_output->i_ref_timestamp;
+    state.i_ref_wallclock = p_output->i_ref_wallclock;
+    state.i_seqnum = p_output->i_seqnum;
+    state.i_tsid = p_output->i_tsid;
+    state.i_pat_version = p_output->i_pat_version;
+    state.i_pat_cc = p_output->i_pat_cc;
+    state.i_pmt_version = p_output->i_pmt_version;
+    state.i_pmt_cc = p_output->i_pmt_cc;
+    state.i_nit_version = p_output->i_nit_version;
+    state.i_nit_cc = p_output->i_nit_cc;
+    state.i_sdt_version = p_output->i_sdt_version;
+    state.i_sdt_cc = p_output->i_sdt_cc;
+    state.i_eit_cc = p_output->i_eit_cc;
+    state.i_nb_services = i_nb_services;
+    state.i_nb_cc_pids = p_output->i_nb_cc_pids;
+
+    if ( i_size > HANDOFF_MAX_RECORD )
+    {
+        msg_Warn( NULL, "state of %s is too large to hand over", psz_name );
+        return true;
+    }
+
+    p = p_data = malloc( i_size );
+    memcpy( p, &state, sizeof(state) );
+    p += sizeof(state);
+    p_services = (handoff_service_t *)p;
+    for ( i = 0; i < i_nb_services; i++ )
+    {
+        p_services[i].i_sid = p_output->p_services[i].i_sid;
+        p_services[i].i_pmt_version = p_output->p_services[i].i_pmt_version;
+        p_services[i].i_pmt_cc = p_output->p_services[i].i_pmt_cc;
+    }
+    p += i_nb_services * sizeof(handoff_service_t);
+    memcpy( p, p_output->p_pid_cc, p_output->i_nb_cc_pids * sizeof(pid_cc_t) );
+    p += p_output->i_nb_cc_pids * sizeof(pid_cc_t);
+    strcpy( (char *)p, psz_name );
+
+    b_ret = SendRecord( i_fd, HANDOFF_RECORD_OUTPUT, 0, p_data, i_size, -1 );
+    free( p_data );
+    return b_ret;
+}
+
+static bool Send( int i_fd )
+{
+    int i;
+
+    for ( i = 0; i < i_nb_fds; i++ )
+        if ( !SendRecord( i_fd, HANDOFF_RECORD_FD, p_fds[i].i_kind,
+                          p_fds[i].psz_key, strlen( p_fds[i].psz_key ) + 1,
+                          p_fds[i].i_fd ) )
+            return false;
+
+    for ( i = 0; i < i_nb_inputs; i++ )
+    {
+        size_t i_size = 0, i_offset;
+        uint8_t *p_data = demux_PackPSI( i, &i_size );
+
+        for ( i_offset = 0; i_offset < i_size;
+              i_offset += HANDOFF_MAX_RECORD )
+        {
+            size_t i_chunk = i_size - i_offset;
+            if ( i_chunk > HANDOFF_MAX_RECORD )
+                i_chunk = HANDOFF_MAX_RECORD;
+            if ( !SendRecord( i_fd, HANDOFF_RECORD_PSI, i, p_data + i_offset,
+                              i_chunk, -1 ) )
+            {
+                free( p_data );
+                return false;
+            }
+        }
+        free( p_data );
+    }
+
+    for ( i = 0; i < i_nb_outputs; i++ )
+        if ( (pp_outputs[i]->config.i_config & OUTPUT_VALID)
+              && !SendOutput( i_fd, pp_outputs[i] ) )
+            return false;
+
+    return SendRecord( i_fd, HANDOFF_RECORD_END, 0, NULL, 0, -1 );
+}
+
+/*****************************************************************************
+ * Receive : new instance
+ *****************************************************************************/
+static bool Receive( int i_fd )
+{
+    uint8_t *p_buffer = malloc( sizeof(handoff_record_t)
+                                 + HANDOFF_MAX_RECORD );
+    bool b_end = false, b_error = false;
+
+    while ( !b_end && !b_error )
+    {
+        handoff_record_t record;
+        struct iovec iov;
+        struct msghdr msg;
+        struct cmsghdr *p_cmsg;
+        union
+        {
+            struct cmsghdr cmsg;
+            char p_buffer[CMSG_SPACE(sizeof(int))];
+        } control;
+        uint8_t *p_data = p_buffer + sizeof(record);
+        int i_attached = -1;
+        ssize_t i_ret;
+
+        iov.iov_base = p_buffer;
+        iov.iov_len = sizeof(record) + HANDOFF_MAX_RECORD;
+        memset( &msg, 0, sizeof(msg) );
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.p_buffer;
+        msg.msg_controllen = sizeof(control.p_buffer);
+
+        if ( (i_ret = recvmsg( i_fd, &msg, 0 )) <= 0 )
+        {
+            if ( i_ret < 0 )
+                msg_Warn( NULL, "couldn't receive handoff (%s)",
+                          strerror(errno) );
+            else
+                msg_Warn( NULL, "handoff interrupted by the previous instance" );
+            break;
+        }
+
+        for ( p_cmsg = CMSG_FIRSTHDR( &msg ); p_cmsg != NULL;
+              p_cmsg = CMSG_NXTHDR( &msg, p_cmsg ) )
+            if ( p_cmsg->cmsg_level == SOL_SOCKET
+                  && p_cmsg->cmsg_type == SCM_RIGHTS
+                  && p_cmsg->cmsg_len >= CMSG_LEN(sizeof(int)) )
+                memcpy( &i_attached, CMSG_DATA(p_cmsg), sizeof(int) );
+
+        memcpy( &record, p_buffer, sizeof(record) );
+        if ( i_ret < (ssize_t)sizeof(record)
+              || (msg.msg_flags & MSG_TRUNC)
+              || record.i_size != i_ret - sizeof(record) )
+        {
+            msg_Warn( NULL, "invalid handoff record" );
+            b_error = true;
+        }
+        else switch ( record.i_type )
+        {
+        case HANDOFF_RECORD_FD:
+            if ( i_attached == -1 || !record.i_size
+                  || p_data[record.i_size - 1] != '\0' )
+            {
+                msg_Warn( NULL, "invalid handoff descriptor" );
+                b_error = true;
+                break;
+            }
+            AddFd( &p_received_fds, &i_nb_received_fds, record.i_kind,
+                   (const char *)p_data, i_attached );
+            i_attached = -1;
+            break;
+
+        case HANDOFF_RECORD_OUTPUT:
+            AddData( &p_received_outputs, &i_nb_received_outputs,
+                     i_nb_received_outputs, p_data, record.i_size );
+            break;
+
+        case HANDOFF_RECORD_PSI:
+            AddData( &p_received_psi, &i_nb_received_psi, record.i_kind,
+                     p_data, record.i_size );
+            break;
+
+        case HANDOFF_RECORD_END:
+            b_end = true;
+            break;
+
+        default:
+            msg_Dbg( NULL, "ignoring handoff record %u", record.i_type );
+            break;
+        }
+
+        if ( i_attached != -1 )
+            close( i_attached );
+    }
+
+    free( p_buffer );
+    return b_end;
+}
+
+/*****************************************************************************
+ * Listen : for the next instance
+ *****************************************************************************/
+static void Listen( void )
+{
+    struct sockaddr_un sun_server;
+
+    unlink( psz_handoff_socket );
+
+    if ( (i_listen_fd = socket( AF_UNIX, SOCK_SEQPACKET, 0 )) == -1 )
+    {
+        msg_Err( NULL, "cannot create handoff socket (%s)", strerror(errno) );
+        return;
+    }
+
+    memset( &sun_server, 0, sizeof(sun_server) );
+    sun_server.sun_family = AF_UNIX;
+    strncpy( sun_server.sun_path, psz_handoff_socket,
+             sizeof(sun_server.sun_path) );
+    sun_server.sun_path[sizeof(sun_server.sun_path) - 1] = '\0';
+
+    if ( bind( i_listen_fd, (struct sockaddr *)&sun_server,
+               SUN_LEN(&sun_server) ) < 0
+          || listen( i_listen_fd, 1 ) < 0 )
+    {
+        msg_Err( NULL, "cannot bind handoff socket (%s)", strerror(errno) );
+        close( i_listen_fd );
+        i_listen_fd = -1;
+        return;
+    }
+
+    fcntl( i_listen_fd, F_SETFL,
+           fcntl( i_listen_fd, F_GETFL ) | O_NONBLOCK );
+}
+
+/*****************************************************************************
+ * handoff_Open : take over from the instance listening on psz_socket, if
+ * any, then listen for the next one
+ *****************************************************************************/
+bool handoff_Open( const char *psz_socket )
+{
+    struct sockaddr_un sun_server;
+    struct timeval tv;
+    bool b_handoff = false;
+    int i_fd;
+
+    psz_handoff_socket = psz_socket;
+
+    memset( &sun_server, 0, sizeof(sun_server) );
+    sun_server.sun_family = AF_UNIX;
+    strncpy( sun_server.sun_path, psz_socket, sizeof(sun_server.sun_path) );
+    sun_server.sun_path[sizeof(sun_server.sun_path) - 1] = '\0';
+
+    if ( (i_fd = socket( AF_UNIX, SOCK_SEQPACKET, 0 )) != -1
+          && connect( i_fd, (struct sockaddr *)&sun_server,
+                      SUN_LEN(&sun_server) ) == 0 )
+    {
+        msg_Info( NULL, "taking over from the instance on %s", psz_socket );
+        tv.tv_sec = HANDOFF_TIMEOUT / 1000000;
+        tv.tv_usec = HANDOFF_TIMEOUT % 1000000;
+        setsockopt( i_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv) );
+
+        if ( (b_handoff = Receive( i_fd )) )
+        {
+            uint8_t i_byte;
+            ssize_t i_ret;
+
+            /* The previous instance closes the connection as it exits,
+             * releasing the devices and sockets which are not shared. */
+            while ( (i_ret = recv( i_fd, &i_byte, 1, 0 )) > 0 );
+            if ( i_ret < 0 )
+                msg_Warn( NULL, "the previous instance is still running (%s)",
+                          strerror(errno) );
+            msg_Info( NULL, "received %d descriptors and %d outputs",
+                      i_nb_received_fds, i_nb_received_outputs );
+        }
+        else
+        {
+            msg_Warn( NULL, "starting afresh" );
+            FreeReceived();
+        }
+    }
+
+    if ( i_fd != -1 )
+        close( i_fd );
+
+    Listen();
+    return b_handoff;
+}
+
+/*****************************************************************************
+ * handoff_Restore : apply the received state, once the outputs are created
+ *****************************************************************************/
+void handoff_Restore( void )
+{
+    int i, j;
+
+    for ( i = 0; i < i_nb_received_psi; i++ )
+        if ( p_received_psi[i].i_kind < i_nb_inputs )
+            demux_UnpackPSI( p_received_psi[i].i_kind,
+                             p_received_psi[i].p_data,
+                             p_received_psi[i].i_size );
+
+    for ( i = 0; i < i_nb_received_outputs; i++ )
+    {
+        uint8_t *p_data = p_received_outputs[i].p_data;
+        size_t i_size = p_received_outputs[i].i_size;
+        handoff_output_t state;
+        const handoff_service_t *p_services;
+        const pid_cc_t *p_pid_cc;
+        const char *psz_name;
+        size_t i_header;
+
+        if ( i_size < sizeof(state) )
+            continue;
+        memcpy( &state, p_data, sizeof(state) );
+        i_header = sizeof(state)
+                    + state.i_nb_services * sizeof(handoff_service_t)
+                    + state.i_nb_cc_pids * sizeof(pid_cc_t);
+        if ( state.i_nb_services > i_size || state.i_nb_cc_pids > i_size
+              || i_header >= i_size || p_data[i_size - 1] != '\0' )
+        {
+            msg_Warn( NULL, "invalid handoff output" );
+            continue;
+        }
+        p_services = (const handoff_service_t *)(p_data + sizeof(state));
+        p_pid_cc = (const pid_cc_t *)(p_services + state.i_nb_services);
+        psz_name = (const char *)(p_data + i_header);
+
+        for ( j = 0; j < i_nb_outputs; j++ )
+        {
+            output_t *p_output = pp_outputs[j];
+
+            if ( (p_output->config.i_config & OUTPUT_VALID)
+                  && !strcmp( p_output->config.psz_displayname, psz_name ) )
+            {
+                demux_RestoreOutput( p_output, &state, p_services, p_pid_cc );
+                break;
+            }
+        }
+        if ( j == i_nb_outputs )
+            msg_Dbg( NULL, "output %s is no longer configured", psz_name );
+    }
+
+    for ( i = 0; i < i_nb_received_fds; i++ )
+        msg_Dbg( NULL, "closing unused handed over %s",
+                 p_received_fds[i].psz_key );
+    FreeReceived();
+}
+
+/*****************************************************************************
+ * handoff_Poll : hand over to a new instance if one connected, in which
+ * case the caller exits at once
+ *****************************************************************************/
+bool handoff_Poll( void )
+{
+    struct timeval tv;
+    int i_fd;
+
+    if ( i_listen_fd == -1 || i_wallclock < i_next_check )
+        return false;
+    i_next_check = i_wallclock + HANDOFF_PERIOD;
+
+    if ( (i_fd = accept( i_listen_fd, NULL, NULL )) < 0 )
+    {
+        if ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+            msg_Warn( NULL, "couldn't accept handoff (%s)", strerror(errno) );
+        return false;
+    }
+
+    msg_Info( NULL, "handing over to a new instance" );
+    outputs_Drain();
+
+    tv.tv_sec = HANDOFF_TIMEOUT / 1000000;
+    tv.tv_usec = HANDOFF_TIMEOUT % 1000000;
+    setsockopt( i_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv) );
+
+    if ( !Send( i_fd ) )
+    {
+        msg_Err( NULL, "couldn't hand over (%s), going on", strerror(errno) );
+        close( i_fd );
+        return false;
+    }
+
+    i_peer_fd = i_fd;
+    b_handed_over = true;
+    return true;
+}
+
+/*****************************************************************************
+ * handoff_Done : the descriptors are shared with a new instance
+ *****************************************************************************/
+bool handoff_Done( void )
+{
+    return b_handed_over;
+}
+
+/*****************************************************************************
+ * handoff_Close : must be the last, as it lets the new instance go on
+ *****************************************************************************/
+void handoff_Close( void )
+{
+    int i;
+
+    if ( i_listen_fd != -1 )
+    {
+        close( i_listen_fd );
+        /* The new instance already listens on the same path. */
+        if ( !b_handed_over )
+            unlink( psz_handoff_socket );
+        i_listen_fd = -1;
+    }
+
+    for ( i = 0; i < i_nb_fds; i++ )
+        free( p_fds[i].psz_key );
+    free( p_fds );
+    p_fds = NULL;
+    i_nb_fds = 0;
+    FreeReceived();
+
+    if ( i_peer_fd != -1 )
+    {
+        close( i_peer_fd );
+        i_peer_fd = -1;
+    }
+}
@@ -0,0 +1,62 @@
+/*****************************************************************************
+ * handoff.h: Hands the inputs, outputs and state over to a new instance
+ *****************************************************************************
+ * Copyright (C) 2026 VideoLAN
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ *****************************************************************************/
+
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+/* File descriptors are handed over with a kind and a key, which the new
+ * instance asks for where it would otherwise open them. */
+#define HANDOFF_FD_DEVICE   0   /* DVB frontend and DVR, by device path */
+#define HANDOFF_FD_FILTER   1   /* DVB demux filters, by PID */
+#define HANDOFF_FD_INPUT    2   /* UDP inputs, by address */
+#define HANDOFF_FD_OUTPUT   3   /* Output sockets, by display name */
+
+/* Output state which keeps receivers from seeing a discontinuity */
+typedef struct handoff_output_t
+{
+    int64_t  i_ref_timestamp, i_ref_wallclock;
+    uint16_t i_seqnum;
+    uint16_t i_tsid;
+    uint8_t  i_pat_version, i_pat_cc;
+    uint8_t  i_pmt_version, i_pmt_cc;
+    uint8_t  i_nit_version, i_nit_cc;
+    uint8_t  i_sdt_version, i_sdt_cc;
+    uint8_t  i_eit_cc;
+    uint8_t  i_reserved[3];
+    uint32_t i_nb_services;             /* handoff_service_t that follow */
+    uint32_t i_nb_cc_pids;              /* then pid_cc_t */
+} handoff_output_t;
+
+typedef struct handoff_service_t
+{
+    uint16_t i_sid;
+    uint8_t  i_pmt_version, i_pmt_cc;
+} handoff_service_t;
+
+bool handoff_Open( const char *psz_socket );
+void handoff_AddFd( int i_kind, const char *psz_key, int i_fd );
+void handoff_RemoveFd( int i_fd );
+int handoff_TakeFd( int i_kind, const char *psz_key );
+void handoff_Restore( void );
+bool handoff_Poll( void );
+bool handoff_Done( void );
+void handoff_Close( void );
+
+uint8_t *demux_PackPSI( int i_input, size_t *pi_size );
+void demux_UnpackPSI( int i_input, uint8_t *p_data, size_t i_size );
+void demux_RestoreOutput( output_t *p_output,
+                          const handoff_output_t *p_state,
+                          const handoff_service_t *p_services,
+                          const pid_cc_t *p_pid_cc );
+void outputs_Drain( void );
+
+#endif
@@ -0,0 +1,511 @@
+/*****************************************************************************
+ * metrics.c: Prometheus metrics endpoint
+ *****************************************************************************
+ * Copyright (C) 2026 VideoLAN
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+
+#include "dvblast.h"
+#include "en50221.h"
+#include "comm.h"
+#include "stats.h"
+#include "metrics.h"
+
+/*****************************************************************************
+ * Local declarations
+ *****************************************************************************/
+/* Scrapes are answered in the HTTP/1.0 way: the request is read up to the
+ * empty line, the answer is written as the socket accepts it, then the
+ * connection is closed. */
+typedef struct metrics_client_t
+{
+    int i_fd;
+    char p_request[1024];
+    size_t i_request_size;
+    bool b_answering;
+    size_t i_answer_sent;
+} metrics_client_t;
+
+static int i_metrics_fd = -1;
+static char *psz_metrics_path = NULL;
+static metrics_client_t **pp_clients = NULL;
+static int i_nb_clients = 0;
+
+/* The answer, rendered at most every STATS_PERIOD and shared by scrapers.
+ * Clients being answered keep it alive. */
+static char *p_answer = NULL;
+static size_t i_answer_size = 0, i_answer_max = 0;
+static mtime_t i_answer_date = 0;
+static stats_segment_t *p_snapshot = NULL;
+
+static const mtime_t pi_loop_buckets[METRICS_LOOP_BUCKETS] =
+    { 100, 500, 1000, 5000, 10000, 50000, 100000, 500000 };
+static uint64_t pi_loop_counts[METRICS_LOOP_BUCKETS + 1];
+static uint64_t i_loop_count = 0;
+static mtime_t i_loop_sum = 0;
+
+static const char *ppsz_pool_names[SECTION_POOLS] =
+    { "pat", "cat", "nit", "sdt", "eit", "pmt" };
+
+/*****************************************************************************
+ * metrics_Open : listen on a TCP host:port, or on a UNIX socket path
+ *****************************************************************************/
+void metrics_Open( const char *psz_address )
+{
+    struct sockaddr_storage addr;
+    socklen_t i_addr_len;
+    int i_family, i_one = 1;
+
+    memset( &addr, 0, sizeof(addr) );
+    if ( psz_address[0] == '/' )
+    {
+        struct sockaddr_un *p_sun = (struct sockaddr_un *)&addr;
+
+        i_family = AF_UNIX;
+        p_sun->sun_family = AF_UNIX;
+        strncpy( p_sun->sun_path, psz_address, sizeof(p_sun->sun_path) - 1 );
+        i_addr_len = SUN_LEN(p_sun);
+        psz_metrics_path = strdup( psz_address );
+        unlink( psz_address );
+    }
+    else
+    {
+        char *psz_string = strdup( psz_address );
+        struct addrinfo *p_ai = ParseNodeService( psz_string, NULL,
+                                                  DEFAULT_METRICS_PORT );
+
+        free( psz_string );
+        if ( p_ai == NULL )
+        {
+            msg_Err( NULL, "invalid metrics address %s", psz_address );
+            return;
+        }
+        i_family = p_ai->ai_family;
+        i_addr_len = p_ai->ai_addrlen;
+        memcpy( &addr, p_ai->ai_addr, i_addr_len );
+        freeaddrinfo( p_ai );
+    }
+
+    if ( (i_metrics_fd = socket( i_family, SOCK_STREAM, 0 )) < 0 )
+    {
+        msg_Err( NULL, "cannot create metrics socket (%s)", strerror(errno) );
+        return;
+    }
+    if ( i_family != AF_UNIX )
+        setsockopt( i_metrics_fd, SOL_SOCKET, SO_REUSEADDR, &i_one,
+                    sizeof(i_one) );
+
+    if ( bind( i_metrics_fd, (struct sockaddr *)&addr, i_addr_len ) < 0
+          || listen( i_metrics_fd, 8 ) < 0
+          || fcntl( i_metrics_fd, F_SETFL, O_NONBLOCK ) < 0 )
+    {
+        msg_Err( NULL, "cannot bind metrics socket %s (%s)", psz_address,
+                 strerror(errno) );
+        close( i_metrics_fd );
+        i_metrics_fd = -1;
+        return;
+    }
+
+    p_snapshot = malloc( sizeof(stats_segment_t) );
+}
+
+/*****************************************************************************
+ * metrics_LoopDuration : account an iteration of the main loop
+ *****************************************************************************/
+void metrics_LoopDuration( mtime_t i_duration )
+{
+    int i;
+
+    for ( i = 0; i < METRICS_LOOP_BUCKETS; i++ )
+        if ( i_duration <= pi_loop_buckets[i] )
+            break;
+    pi_loop_counts[i]++;
+    i_loop_count++;
+    i_loop_sum += i_duration;
+}
+
+/*****************************************************************************
+ * Rendering
+ *****************************************************************************/
+__attribute__ ((format(printf, 1, 2)))
+static void Append( const char *psz_format, ... )
+{
+    va_list args;
+    int i_len;
+
+    for ( ; ; )
+    {
+        va_start( args, psz_format );
+        i_len = vsnprintf( p_answer + i_answer_size,
+                           i_answer_max - i_answer_size, psz_format, args );
+        va_end( args );
+        if ( i_len < 0 )
+            return;
+        if ( i_answer_size + i_len < i_answer_max )
+            break;
+        i_answer_max = (i_answer_max + i_len) * 2;
+        p_answer = realloc( p_answer, i_answer_max );
+    }
+    i_answer_size += i_len;
+}
+
+/* Names of a metric family, once per family */
+static void Family( const char *psz_name, const char *psz_type,
+                    const char *psz_help )
+{
+    Append( "# HELP dvblast_%s %s\n# TYPE dvblast_%s %s\n",
+            psz_name, psz_help, psz_name, psz_type );
+}
+
+#ifdef HAVE_DVB_SUPPORT
+static void RenderFrontend( void )
+{
+    uint8_t p_buffer[sizeof(struct ret_frontend_status)];
+    struct ret_frontend_status *p_ret = (struct ret_frontend_status *)p_buffer;
+    ssize_t i_size;
+
+    if ( !i_frequency
+          || dvb_FrontendStatus( p_buffer, &i_size ) != RET_FRONTEND_STATUS )
+        return;
+
+    Family( "frontend_lock", "gauge", "Whether the frontend is locked" );
+    Append( "dvblast_frontend_lock %d\n",
+            !!(p_ret->i_status & FE_HAS_LOCK) );
+    Family( "frontend_signal", "gauge", "Whether the frontend has a signal" );
+    Append( "dvblast_frontend_signal %d\n",
+            !!(p_ret->i_status & FE_HAS_SIGNAL) );
+    if ( !(p_ret->i_status & FE_HAS_LOCK) )
+        return;
+    Family( "frontend_signal_strength", "gauge",
+            "Signal strength reported by the driver" );
+    Append( "dvblast_frontend_signal_strength %u\n", p_ret->i_strength );
+    Family( "frontend_snr", "gauge", "SNR reported by the driver" );
+    Append( "dvblast_frontend_snr %u\n", p_ret->i_snr );
+    Family( "frontend_ber", "gauge", "Bit error rate reported by the driver" );
+    Append( "dvblast_frontend_ber %u\n", p_ret->i_ber );
+}
+#endif
+
+/* Renders a per-PID, per-service, per-output or per-pool family. Metric
+ * names are string literals; only the label is formatted, by label. */
+#define RENDER_FAMILY( name, type, help, count, label, fmt, value )         \
+    do {                                                                    \
+        Family( name, type, help );                                         \
+        for ( i = 0; i < (count); i++ )                                     \
+        {                                                                   \
+            label;                                                          \
+            Append( "dvblast_" name "{%s} " fmt "\n", psz_label, value );   \
+        }                                                                   \
+    } while (0)
+
+static void Render( void )
+{
+    section_pool_info_t p_pools[SECTION_POOLS];
+    ts_pid_entry_t *pp_pids[MAX_PIDS];
+    char psz_label[128];
+    int i, i_nb_pids = 0;
+
+    demux_GetStats( p_snapshot );
+    outputs_GetStats( p_snapshot );
+    demux_get_section_pools_info( (uint8_t *)p_pools );
+    for ( i = 0; i < MAX_PIDS; i++ )
+        if ( p_snapshot->pids[i].i_packets )
+            pp_pids[i_nb_pids++] = &p_snapshot->pids[i];
+
+    i_answer_size = 0;
+    Append( "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Connection: close\r\n\r\n" );
+
+#ifdef HAVE_DVB_SUPPORT
+    RenderFrontend();
+#endif
+
+    Family( "input_packets_total", "counter", "TS packets received" );
+    Append( "dvblast_input_packets_total %"PRIu64"\n",
+            p_snapshot->input.i_packets );
+    Family( "input_cc_errors_total", "counter", "Continuity errors" );
+    Append( "dvblast_input_cc_errors_total %"PRIu64"\n",
+            p_snapshot->input.i_cc_errors );
+    Family( "input_transport_errors_total", "counter", "Transport errors" );
+    Append( "dvblast_input_transport_errors_total %"PRIu64"\n",
+            p_snapshot->input.i_transport_errors );
+    Family( "input_bytes_per_second", "gauge", "Input bitrate" );
+    Append( "dvblast_input_bytes_per_second %u\n",
+            p_snapshot->input.i_bytes_per_sec );
+    Family( "input_backup", "gauge", "Whether the backup input is used" );
+    Append( "dvblast_input_backup %u\n", p_snapshot->input.b_backup );
+
+#define PID_LABEL snprintf( psz_label, sizeof(psz_label), "pid=\"%u\"", \
+                            pp_pids[i]->i_pid )
+    RENDER_FAMILY( "pid_packets_total", "counter", "TS packets per PID",
+                   i_nb_pids, PID_LABEL, "%"PRIu64, pp_pids[i]->i_packets );
+    RENDER_FAMILY( "pid_cc_errors_total", "counter", "Continuity errors per PID",
+                   i_nb_pids, PID_LABEL, "%u", pp_pids[i]->i_cc_errors );
+    RENDER_FAMILY( "pid_transport_errors_total", "counter",
+                   "Transport errors per PID", i_nb_pids, PID_LABEL, "%u",
+                   pp_pids[i]->i_transport_errors );
+    RENDER_FAMILY( "pid_bytes_per_second", "gauge", "Bitrate per PID",
+                   i_nb_pids, PID_LABEL, "%u", pp_pids[i]->i_bytes_per_sec );
+    RENDER_FAMILY( "pid_dropped_total", "counter",
+                   "TS packets dropped by the statistical remux per PID",
+                   i_nb_pids, PID_LABEL, "%u", pp_pids[i]->i_dropped );
+#undef PID_LABEL
+
+#define SERVICE_LABEL snprintf( psz_label, sizeof(psz_label), "sid=\"%u\"", \
+                                p_snapshot->services[i].i_sid )
+    RENDER_FAMILY( "service_bytes_per_second", "gauge", "Bitrate per service",
+                   (int)p_snapshot->i_nb_services, SERVICE_LABEL, "%u",
+                   p_snapshot->services[i].i_bytes_per_sec );
+    RENDER_FAMILY( "service_cc_errors_total", "counter",
+                   "Continuity errors per service",
+                   (int)p_snapshot->i_nb_services, SERVICE_LABEL, "%u",
+                   p_snapshot->services[i].i_cc_errors );
+    RENDER_FAMILY( "service_transport_errors_total", "counter",
+                   "Transport errors per service",
+                   (int)p_snapshot->i_nb_services, SERVICE_LABEL, "%u",
+                   p_snapshot->services[i].i_transport_errors );
+    RENDER_FAMILY( "service_scrambled", "gauge",
+                   "Whether a PID of the service is scrambled",
+                   (int)p_snapshot->i_nb_services, SERVICE_LABEL, "%u",
+                   p_snapshot->services[i].b_scrambled );
+#undef SERVICE_LABEL
+
+#define OUTPUT_LABEL snprintf( psz_label, sizeof(psz_label),              \
+                               "output=\"%s\"",                           \
+                               p_snapshot->outputs[i].psz_displayname )
+    RENDER_FAMILY( "output_bytes_total", "counter", "Bytes sent per output",
+                   (int)p_snapshot->i_nb_outputs, OUTPUT_LABEL, "%"PRIu64,
+                   p_snapshot->outputs[i].i_bytes );
+    RENDER_FAMILY( "output_dropped_bytes_total", "counter",
+                   "Bytes dropped by the statistical remux or a too low CBR per output",
+                   (int)p_snapshot->i_nb_outputs, OUTPUT_LABEL, "%"PRIu64,
+                   p_snapshot->outputs[i].i_dropped * TS_SIZE );
+    RENDER_FAMILY( "output_send_errors_total", "counter",
+                   "Failed sends per output",
+                   (int)p_snapshot->i_nb_outputs, OUTPUT_LABEL, "%u",
+                   p_snapshot->outputs[i].i_send_errors );
+    RENDER_FAMILY( "output_queue_depth", "gauge",
+                   "Datagrams waiting to be sent per output",
+                   (int)p_snapshot->i_nb_outputs, OUTPUT_LABEL, "%u",
+                   p_snapshot->outputs[i].i_queue_depth );
+#undef OUTPUT_LABEL
+
+    Family( "loop_duration_seconds", "histogram",
+            "Duration of the main loop iterations, without waiting" );
+    {
+        uint64_t i_cumulated = 0;
+
+        for ( i = 0; i < METRICS_LOOP_BUCKETS; i++ )
+        {
+            i_cumulated += pi_loop_counts[i];
+            Append( "dvblast_loop_duration_seconds_bucket{le=\"%g\"} %"PRIu64"\n",
+                    pi_loop_buckets[i] / 1000000., i_cumulated );
+        }
+        Append( "dvblast_loop_duration_seconds_bucket{le=\"+Inf\"} %"PRIu64"\n",
+                i_loop_count );
+        Append( "dvblast_loop_duration_seconds_sum %g\n",
+                i_loop_sum / 1000000. );
+        Append( "dvblast_loop_duration_seconds_count %"PRIu64"\n",
+                i_loop_count );
+    }
+
+#define POOL_LABEL snprintf( psz_label, sizeof(psz_label), "pool=\"%s\"", \
+                             ppsz_pool_names[i] )
+    RENDER_FAMILY( "section_pool_allocs_total", "counter",
+                   "Section slots obtained from malloc", SECTION_POOLS,
+                   POOL_LABEL, "%"PRIu64, p_pools[i].i_allocs );
+    RENDER_FAMILY( "section_pool_recycled_total", "counter",
+                   "Section slots reused from the free list", SECTION_POOLS,
+                   POOL_LABEL, "%"PRIu64, p_pools[i].i_recycled );
+    RENDER_FAMILY( "section_pool_in_use", "gauge",
+                   "Section slots holding a section", SECTION_POOLS,
+                   POOL_LABEL, "%u", p_pools[i].i_in_use );
+    RENDER_FAMILY( "section_pool_free", "gauge",
+                   "Section slots in the free list", SECTION_POOLS,
+                   POOL_LABEL, "%u", p_pools[i].i_free );
+#undef POOL_LABEL
+
+    i_answer_date = i_wallclock;
+}
+
+#undef RENDER_FAMILY
+
+/*****************************************************************************
+ * Clients
+ *****************************************************************************/
+static void CloseClient( int i )
+{
+    close( pp_clients[i]->i_fd );
+    free( pp_clients[i] );
+    pp_clients[i] = pp_clients[--i_nb_clients];
+}
+
+static bool Answering( void )
+{
+    int i;
+
+    for ( i = 0; i < i_nb_clients; i++ )
+        if ( pp_clients[i]->b_answering )
+            return true;
+    return false;
+}
+
+/* Returns false if the client must be closed. */
+static bool ReadClient( metrics_client_t *p_client )
+{
+    ssize_t i_size;
+
+    if ( p_client->b_answering )
+    {
+        char p_discard[256];
+        i_size = recv( p_client->i_fd, p_discard, sizeof(p_discard),
+                       MSG_DONTWAIT );
+        return i_size != 0;
+    }
+
+    i_size = recv( p_client->i_fd, p_client->p_request + p_client->i_request_size,
+                   sizeof(p_client->p_request) - 1 - p_client->i_request_size,
+                   MSG_DONTWAIT );
+    if ( i_size == 0 || (i_size < 0 && errno != EAGAIN && errno != EINTR) )
+        return false;
+    if ( i_size < 0 )
+        return true;
+    p_client->i_request_size += i_size;
+    p_client->p_request[p_client->i_request_size] = '\0';
+
+    if ( strstr( p_client->p_request, "\r\n\r\n" ) == NULL
+          && strstr( p_client->p_request, "\n\n" ) == NULL )
+        /* Give up on requests that don't fit. */
+        return p_client->i_request_size < sizeof(p_client->p_request) - 1;
+
+    /* Whatever the path, answer the metrics. The answer being sent to other
+     * clients can't be changed under their feet. */
+    if ( i_answer_date + STATS_PERIOD <= i_wallclock && !Answering() )
+        Render();
+    p_client->b_answering = true;
+    p_client->i_answer_sent = 0;
+    return true;
+}
+
+static bool WriteClient( metrics_client_t *p_client )
+{
+    ssize_t i_sent = send( p_client->i_fd, p_answer + p_client->i_answer_sent,
+                           i_answer_size - p_client->i_answer_sent,
+                           MSG_DONTWAIT | MSG_NOSIGNAL );
+
+    if ( i_sent < 0 )
+        return errno == EAGAIN || errno == EINTR;
+    p_client->i_answer_sent += i_sent;
+    return p_client->i_answer_sent < i_answer_size;
+}
+
+/*****************************************************************************
+ * metrics_Poll : serve scrapes without blocking, from the main loop
+ *****************************************************************************/
+void metrics_Poll( void )
+{
+    struct pollfd pfd[METRICS_MAX_CLIENTS + 1];
+    int i, i_fd;
+
+    if ( i_metrics_fd == -1 )
+        return;
+
+    pfd[0].fd = i_metrics_fd;
+    pfd[0].events = POLLIN;
+    for ( i = 0; i < i_nb_clients; i++ )
+    {
+        pfd[i + 1].fd = pp_clients[i]->i_fd;
+        pfd[i + 1].events = pp_clients[i]->b_answering ? POLLOUT : POLLIN;
+    }
+
+    if ( poll( pfd, i_nb_clients + 1, 0 ) <= 0 )
+        return;
+
+    /* Backwards, as CloseClient() moves the last client. */
+    for ( i = i_nb_clients - 1; i >= 0; i-- )
+    {
+        bool b_ok = true;
+
+        if ( pfd[i + 1].revents & (POLLIN | POLLHUP | POLLERR) )
+            b_ok = ReadClient( pp_clients[i] );
+        if ( b_ok && (pfd[i + 1].revents & POLLOUT) )
+            b_ok = WriteClient( pp_clients[i] );
+        if ( !b_ok )
+            CloseClient( i );
+    }
+
+    if ( (pfd[0].revents & POLLIN)
+          && (i_fd = accept( i_metrics_fd, NULL, NULL )) >= 0 )
+    {
+        metrics_client_t *p_client;
+
+        if ( i_nb_clients == METRICS_MAX_CLIENTS )
+        {
+            close( i_fd );
+            return;
+        }
+        p_client = malloc( sizeof(metrics_client_t) );
+        p_client->i_fd = i_fd;
+        p_client->i_request_size = 0;
+        p_client->b_answering = false;
+        pp_clients = realloc( pp_clients,
+                              (i_nb_clients + 1) * sizeof(metrics_client_t *) );
+        pp_clients[i_nb_clients++] = p_client;
+    }
+}
+
+/*****************************************************************************
+ * metrics_Pending : whether an answer is still being written
+ *****************************************************************************/
+bool metrics_Pending( void )
+{
+    return Answering();
+}
+
+/*****************************************************************************
+ * metrics_Close
+ *****************************************************************************/
+void metrics_Close( void )
+{
+    if ( i_metrics_fd == -1 )
+        return;
+
+    while ( i_nb_clients )
+        CloseClient( i_nb_clients - 1 );
+    free( pp_clients );
+    pp_clients = NULL;
+    close( i_metrics_fd );
+    i_metrics_fd = -1;
+    if ( psz_metrics_path != NULL )
+    {
+        unlink( psz_metrics_path );
+        free( psz_metrics_path );
+        psz_metrics_path = NULL;
+    }
+    free( p_answer );
+    p_answer = NULL;
+    free( p_snapshot );
+    p_snapshot = NULL;
+}
@@ -0,0 +1,26 @@
+/*****************************************************************************
+ * metrics.h: Prometheus metrics endpoint
+ *****************************************************************************
+ * Copyright (C) 2026 VideoLAN
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ *****************************************************************************/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+/* Upper bounds of the main loop duration histogram, in us */
+#define METRICS_LOOP_BUCKETS 8
+#define METRICS_MAX_CLIENTS 16
+
+void metrics_Open( const char *psz_address );
+void metrics_Poll( void );
+bool metrics_Pending( void );
+void metrics_LoopDuration( mtime_t i_duration );
+void metrics_Close( void );
+
+#endif
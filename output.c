@@ -36,6 +36,8 @@
 #include <errno.h>
 
 #include "dvblast.h"
+#include "stats.h"
+#include "handoff.h"
 
 #include <bitstream/mpeg/ts.h>
 #include <bitstream/ietf/rtp.h>
@@ -53,6 +55,12 @@ struct packet_t
     block_t *p_blocks; /* actually an array of pointers */
 };
 
+/* Outputs by address (output_Find) and by configuration line
+ * (output_FindLine), so that reloading a large configuration is linear */
+#define OUTPUT_INDEX_SIZE 1024
+static output_t *pp_output_index[OUTPUT_INDEX_SIZE];
+static output_t *pp_line_index[OUTPUT_INDEX_SIZE];
+
 static uint8_t p_pad_ts[TS_SIZE] = {
     0x47, 0x1f, 0xff, 0x10, 0xff, 0xff, 0xff, 0xff,
     0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
@@ -116,6 +124,57 @@ static void RawFillHeaders(struct udprawpkt *dgram,
     //iph->check = csum((unsigned short *)iph, sizeof(struct iphdr));
 }
 
+/*****************************************************************************
+ * output_HashBytes : FNV-1a, for the output indexes
+ *****************************************************************************/
+static unsigned int output_HashBytes( unsigned int i_hash, const void *p_data,
+                                      size_t i_size )
+{
+    const uint8_t *p = p_data;
+
+    while ( i_size-- )
+        i_hash = (i_hash ^ *p++) * 16777619;
+    return i_hash;
+}
+
+/* Hashes the fields compared by output_Find() */
+static unsigned int output_HashConfig( const output_config_t *p_config )
+{
+    socklen_t i_sockaddr_len = (p_config->i_family == AF_INET) ?
+                               sizeof(struct sockaddr_in) :
+                               sizeof(struct sockaddr_in6);
+    unsigned int i_hash = 2166136261u;
+    bool b_raw = !!(p_config->i_config & OUTPUT_RAW);
+
+    i_hash = output_HashBytes( i_hash, &p_config->i_family,
+                               sizeof(p_config->i_family) );
+    i_hash = output_HashBytes( i_hash, &p_config->connect_addr,
+                               i_sockaddr_len );
+    i_hash = output_HashBytes( i_hash, &p_config->bind_addr, i_sockaddr_len );
+    if ( p_config->i_family == AF_INET6 )
+        i_hash = output_HashBytes( i_hash, &p_config->i_if_index_v6,
+                                   sizeof(p_config->i_if_index_v6) );
+    i_hash = output_HashBytes( i_hash, &b_raw, sizeof(b_raw) );
+    return i_hash % OUTPUT_INDEX_SIZE;
+}
+
+static unsigned int output_HashLine( const char *psz_line )
+{
+    return output_HashBytes( 2166136261u, psz_line, strlen(psz_line) )
+            % OUTPUT_INDEX_SIZE;
+}
+
+/* Removes p_output from the chain starting at *pp_chain */
+static void output_Unlink( output_t **pp_chain, output_t *p_output,
+                           bool b_line )
+{
+    while ( *pp_chain != NULL && *pp_chain != p_output )
+        pp_chain = b_line ? &(*pp_chain)->p_line_next
+                          : &(*pp_chain)->p_index_next;
+    if ( *pp_chain != NULL )
+        *pp_chain = b_line ? p_output->p_line_next : p_output->p_index_next;
+}
+
 /*****************************************************************************
  * output_Create : create and insert the output_t structure
  *****************************************************************************/
@@ -144,17 +203,156 @@ output_t *output_Create( const output_config_t *p_config )
     if ( output_Init( p_output, p_config ) < 0 )
         return NULL;
 
+    p_output->i_index = i;
+    i = p_output->i_index_bucket = output_HashConfig( &p_output->config );
+    p_output->p_index_next = pp_output_index[i];
+    pp_output_index[i] = p_output;
+    return p_output;
+}
+
+/*****************************************************************************
+ * output_FindLine : find the output set up by an identical configuration
+ * line
+ *****************************************************************************/
+output_t *output_FindLine( const char *psz_line )
+{
+    output_t *p_output = pp_line_index[output_HashLine( psz_line )];
+
+    while ( p_output != NULL && strcmp( p_output->psz_config_line, psz_line ) )
+        p_output = p_output->p_line_next;
     return p_output;
 }
 
+/*****************************************************************************
+ * output_SetConfigLine : remember the configuration line of an output
+ *****************************************************************************/
+void output_SetConfigLine( output_t *p_output, const char *psz_line )
+{
+    unsigned int i_hash;
+
+    if ( p_output->psz_config_line != NULL )
+    {
+        output_Unlink( &pp_line_index[output_HashLine(
+                           p_output->psz_config_line )], p_output, true );
+        free( p_output->psz_config_line );
+        p_output->psz_config_line = NULL;
+    }
+    if ( psz_line == NULL )
+        return;
+
+    p_output->psz_config_line = strdup( psz_line );
+    i_hash = output_HashLine( psz_line );
+    p_output->p_line_next = pp_line_index[i_hash];
+    pp_line_index[i_hash] = p_output;
+}
+
 /* Init the mapped pids to unused */
 void init_pid_mapping( output_t *p_output )
 {
-    unsigned int i;
-    for ( i = 0; i < MAX_PIDS; i++ ) {
-        p_output->pi_newpids[i]  = UNUSED_PID;
-        p_output->pi_freepids[i] = UNUSED_PID;
+    p_output->i_nb_remapped_pids = 0;
+}
+
+/* Returns the new pid of i_pid, or UNUSED_PID if it isn't remapped */
+uint16_t output_GetMappedPID( const output_t *p_output, uint16_t i_pid )
+{
+    int i_min = 0, i_max = p_output->i_nb_remapped_pids - 1;
+
+    while ( i_min <= i_max )
+    {
+        int i_mid = (i_min + i_max) / 2;
+        const pid_map_t *p_map = &p_output->p_pid_map[i_mid];
+
+        if ( p_map->i_pid == i_pid )
+            return p_map->i_newpid;
+        if ( p_map->i_pid < i_pid )
+            i_min = i_mid + 1;
+        else
+            i_max = i_mid - 1;
     }
+    return UNUSED_PID;
+}
+
+/* Tells whether another pid is already remapped to i_newpid */
+bool output_IsMappedPIDUsed( const output_t *p_output, uint16_t i_newpid )
+{
+    int i;
+
+    for ( i = 0; i < p_output->i_nb_remapped_pids; i++ )
+        if ( p_output->p_pid_map[i].i_newpid == i_newpid )
+            return true;
+    return false;
+}
+
+void output_MapPID( output_t *p_output, uint16_t i_pid, uint16_t i_newpid )
+{
+    int i;
+
+    for ( i = 0; i < p_output->i_nb_remapped_pids; i++ )
+        if ( p_output->p_pid_map[i].i_pid >= i_pid )
+            break;
+
+    if ( i == p_output->i_nb_remapped_pids
+          || p_output->p_pid_map[i].i_pid != i_pid )
+    {
+        if ( p_output->i_nb_remapped_pids == p_output->i_max_remapped_pids )
+        {
+            p_output->i_max_remapped_pids += 8;
+            p_output->p_pid_map = realloc( p_output->p_pid_map,
+                    p_output->i_max_remapped_pids * sizeof(pid_map_t) );
+        }
+        memmove( &p_output->p_pid_map[i + 1], &p_output->p_pid_map[i],
+                 (p_output->i_nb_remapped_pids - i) * sizeof(pid_map_t) );
+        p_output->p_pid_map[i].i_pid = i_pid;
+        p_output->i_nb_remapped_pids++;
+    }
+    p_output->p_pid_map[i].i_newpid = i_newpid;
+}
+
+/*****************************************************************************
+ * output_RewriteCC : regenerate the continuity counter of a packet, so that
+ * packets dropped by DVBlast do not appear as discontinuities
+ *****************************************************************************/
+static uint8_t output_RewriteCC( output_t *p_output, const block_t *p_block )
+{
+    const uint8_t *p_ts = p_block->p_ts;
+    uint16_t i_pid = ts_get_pid( p_ts );
+    uint8_t i_cc = ts_get_cc( p_ts );
+    pid_cc_t *p_cc;
+    int i;
+
+    for ( i = 0; i < p_output->i_nb_cc_pids; i++ )
+        if ( p_output->p_pid_cc[i].i_pid >= i_pid )
+            break;
+
+    if ( i == p_output->i_nb_cc_pids || p_output->p_pid_cc[i].i_pid != i_pid )
+    {
+        if ( p_output->i_nb_cc_pids == p_output->i_max_cc_pids )
+        {
+            p_output->i_max_cc_pids += 8;
+            p_output->p_pid_cc = realloc( p_output->p_pid_cc,
+                    p_output->i_max_cc_pids * sizeof(pid_cc_t) );
+        }
+        memmove( &p_output->p_pid_cc[i + 1], &p_output->p_pid_cc[i],
+                 (p_output->i_nb_cc_pids - i) * sizeof(pid_cc_t) );
+        p_output->p_pid_cc[i].i_pid = i_pid;
+        p_output->p_pid_cc[i].i_last_cc = -1;
+        p_output->i_nb_cc_pids++;
+    }
+    p_cc = &p_output->p_pid_cc[i];
+
+    if ( p_cc->i_last_cc == -1 )
+        p_cc->i_cc = i_cc;
+    else if ( !ts_has_payload( p_ts )
+               || ts_check_duplicate( i_cc, p_cc->i_last_cc ) )
+        ; /* the counter does not move */
+    else if ( p_block->b_discontinuity )
+        /* The input really lost packets: keep the same gap. */
+        p_cc->i_cc = (p_cc->i_cc + i_cc - p_cc->i_last_cc) & 0xf;
+    else
+        p_cc->i_cc = (p_cc->i_cc + 1) & 0xf;
+    p_cc->i_last_cc = i_cc;
+
+    return p_cc->i_cc;
 }
 
 /*****************************************************************************
@@ -184,7 +382,9 @@ int output_Init( output_t *p_output, const output_config_t *p_config )
     p_output->p_pat_section = NULL;
     p_output->p_pmt_section = NULL;
     p_output->p_nit_section = NULL;
-    p_output->p_sdt_section = NULL;
+    p_output->pp_sdt_sections = NULL;
+    p_output->i_nb_sdt_sections = 0;
+    p_output->p_services = NULL;
     p_output->p_eit_epg_section = NULL;
     p_output->p_eit_ts_buffer = NULL;
     if ( b_random_tsid )
@@ -201,10 +401,15 @@ int output_Init( output_t *p_output, const output_config_t *p_config )
             sizeof(struct sockaddr_storage) );
     p_output->config.i_if_index_v6 = p_config->i_if_index_v6;
 
+    /* A socket handed over by the previous instance is connected again to
+     * the same address below. */
+    p_output->i_handle = handoff_TakeFd( HANDOFF_FD_OUTPUT,
+                                         p_config->psz_displayname );
     if ( (p_config->i_config & OUTPUT_RAW) ) {
         p_output->config.i_config |= OUTPUT_RAW;
-        p_output->i_handle = socket( AF_INET, SOCK_RAW, IPPROTO_RAW );
-    } else {
+        if ( p_output->i_handle < 0 )
+            p_output->i_handle = socket( AF_INET, SOCK_RAW, IPPROTO_RAW );
+    } else if ( p_output->i_handle < 0 ) {
         p_output->i_handle = socket( p_config->i_family, SOCK_DGRAM, IPPROTO_UDP );
     }
     if ( p_output->i_handle < 0 )
@@ -271,6 +476,8 @@ int output_Init( output_t *p_output, const output_config_t *p_config )
         return -errno;
     }
 
+    handoff_AddFd( HANDOFF_FD_OUTPUT, p_config->psz_displayname,
+                   p_output->i_handle );
     p_output->config.i_config |= OUTPUT_VALID;
 
     return 0;
@@ -282,10 +489,10 @@ int output_Init( output_t *p_output, const output_config_t *p_config )
 void output_Close( output_t *p_output )
 {
     packet_t *p_packet = p_output->p_packets;
+    int i;
+
     while ( p_packet != NULL )
     {
-        int i;
-
         for ( i = 0; i < p_packet->i_depth; i++ )
         {
             p_packet->pp_blocks[i]->i_refcount--;
@@ -301,11 +508,26 @@ void output_Close( output_t *p_output )
     free( p_output->p_pat_section );
     free( p_output->p_pmt_section );
     free( p_output->p_nit_section );
-    free( p_output->p_sdt_section );
+    for ( i = 0; i < p_output->i_nb_sdt_sections; i++ )
+        free( p_output->pp_sdt_sections[i] );
+    free( p_output->pp_sdt_sections );
     free( p_output->p_eit_epg_section );
     free( p_output->p_eit_ts_buffer );
+    block_DeleteChain( p_output->p_eit_carousel );
+    p_output->p_eit_carousel = p_output->p_eit_carousel_next = NULL;
+    free( p_output->p_pid_map );
+    p_output->p_pid_map = NULL;
+    p_output->i_nb_remapped_pids = p_output->i_max_remapped_pids = 0;
+    free( p_output->p_pid_cc );
+    p_output->p_pid_cc = NULL;
+    p_output->i_nb_cc_pids = p_output->i_max_cc_pids = 0;
+    demux_Detach( p_output );
+    output_Unlink( &pp_output_index[p_output->i_index_bucket], p_output,
+                   false );
+    output_SetConfigLine( p_output, NULL );
     p_output->config.i_config &= ~OUTPUT_VALID;
 
+    handoff_RemoveFd( p_output->i_handle );
     close( p_output->i_handle );
 
     config_Free( &p_output->config );
@@ -323,14 +545,77 @@ static int output_BlockCount( output_t *p_output )
 }
 
 /*****************************************************************************
- * output_Flush
+ * output_RestampPCR : move a PCR by i_delta, in 27 MHz units
  *****************************************************************************/
-static void output_Flush( output_t *p_output )
+static void output_RestampPCR( uint8_t *p_ts, int64_t i_delta )
+{
+    const int64_t i_wrap = (INT64_C(1) << 33) * 300;
+    int64_t i_pcr = tsaf_get_pcr( p_ts ) * 300 + tsaf_get_pcrext( p_ts );
+
+    i_pcr = (i_pcr + i_delta) % i_wrap;
+    if ( i_pcr < 0 )
+        i_pcr += i_wrap;
+    tsaf_set_pcr( p_ts, i_pcr / 300 );
+    tsaf_set_pcrext( p_ts, i_pcr % 300 );
+}
+
+/*****************************************************************************
+ * output_UpdateStats : account for a datagram, and with /adaptive pick the
+ * retention that fills datagrams within the latency budget
+ *****************************************************************************/
+static void output_UpdateStats( output_t *p_output, packet_t *p_packet )
 {
-    packet_t *p_packet = p_output->p_packets;
     int i_block_cnt = output_BlockCount( p_output );
-    struct iovec p_iov[i_block_cnt + 2];
+    mtime_t i_period = i_wallclock - p_output->i_stats_start;
+
+    p_output->i_stats_datagrams++;
+    if ( p_packet != NULL )
+    {
+        p_output->i_stats_blocks += p_packet->i_depth;
+        p_output->i_stats_latency += i_wallclock - p_packet->i_dts;
+    }
+
+    if ( i_period < OUTPUT_STATS_PERIOD )
+        return;
+
+    if ( p_output->i_stats_start )
+    {
+        p_output->i_fill_ratio = (uint64_t)p_output->i_stats_blocks * 1000
+                / ((uint64_t)p_output->i_stats_datagrams * i_block_cnt);
+        p_output->i_latency = p_output->i_stats_latency
+                               / p_output->i_stats_datagrams;
+
+        if ( p_output->config.i_config & OUTPUT_ADAPTIVE )
+        {
+            /* Half of the output latency is left to absorb jitter. */
+            mtime_t i_budget = p_output->config.i_output_latency / 2;
+            mtime_t i_fill_time = i_budget;
+
+            if ( p_output->i_stats_blocks )
+                i_fill_time = (mtime_t)i_block_cnt * i_period
+                                / p_output->i_stats_blocks;
+            p_output->i_retention = i_fill_time < i_budget ?
+                                    i_fill_time : i_budget;
+        }
+    }
+
+    p_output->i_stats_start = i_wallclock;
+    p_output->i_stats_datagrams = p_output->i_stats_blocks = 0;
+    p_output->i_stats_latency = 0;
+}
+
+/*****************************************************************************
+ * output_Flush : send p_packet, or only padding if it is NULL ; in CBR mode
+ * i_cbr_date is the position of the datagram on the output timeline
+ *****************************************************************************/
+static void output_Flush( output_t *p_output, packet_t *p_packet,
+                          mtime_t i_cbr_date )
+{
+    int i_block_cnt = output_BlockCount( p_output );
+    int i_depth = p_packet != NULL ? p_packet->i_depth : 0;
+    struct iovec p_iov[2 * i_block_cnt + 2];
     uint8_t p_rtp_hdr[RTP_HEADER_SIZE];
+    uint8_t p_ts_hdr[i_block_cnt][TS_HEADER_SIZE_PCR];
     int i_iov = 0, i_payload_len, i_block;
 
     if ( (p_output->config.i_config & OUTPUT_RAW) )
@@ -350,38 +635,83 @@ static void output_Flush( output_t *p_output )
         rtp_set_seqnum( p_rtp_hdr, p_output->i_seqnum++ );
         rtp_set_timestamp( p_rtp_hdr,
                            p_output->i_ref_timestamp
-                            + (p_packet->i_dts - p_output->i_ref_wallclock)
-                               * 9 / 100 );
+                            + ((p_output->config.i_cbr_rate ?
+                                 i_cbr_date - p_output->config.i_output_latency :
+                                 p_packet->i_dts)
+                                - p_output->i_ref_wallclock) * 9 / 100 );
         rtp_set_ssrc( p_rtp_hdr, p_output->config.pi_ssrc );
 
         i_iov++;
     }
 
-    for ( i_block = 0; i_block < p_packet->i_depth; i_block++ )
+    for ( i_block = 0; i_block < i_depth; i_block++ )
     {
-        /* Do pid mapping here if needed.
-         * save the original pid in the block.
-         * set the pid to the new pid
-         * later we re-instate the old pid for the next output
-         */
-        if ( b_do_remap || p_output->config.b_do_remap ) {
-            block_t *p_block = p_packet->pp_blocks[i_block];
-            uint16_t i_pid = ts_get_pid( p_block->p_ts );
-            p_block->tmp_pid = UNUSED_PID;
-            if ( p_output->pi_newpids[i_pid] != UNUSED_PID )
+        block_t *p_block = p_packet->pp_blocks[i_block];
+        uint8_t *p_ts = p_block->p_ts;
+        uint16_t i_newpid = UNUSED_PID;
+        bool b_adaptation = ts_has_adaptation( p_ts )
+                             && ts_get_adaptation( p_ts );
+        bool b_pcr = p_output->config.i_cbr_rate && b_adaptation
+                      && tsaf_has_pcr( p_ts );
+        bool b_cc = (p_output->config.i_config & OUTPUT_CC)
+                     && ts_get_pid( p_ts ) != PADDING_PID;
+        /* The discontinuity indicator is in the adaptation field flags. */
+        int i_hdr_size = b_pcr ? TS_HEADER_SIZE_PCR :
+                         b_cc && b_adaptation ? TS_HEADER_SIZE + 2 :
+                         TS_HEADER_SIZE;
+
+        if ( p_output->i_nb_remapped_pids )
+            i_newpid = output_GetMappedPID( p_output, ts_get_pid( p_ts ) );
+
+        /* Blocks are shared between outputs, so remapped packets,
+         * restamped PCRs and regenerated CCs get their TS header rewritten
+         * in a private copy, followed by the payload. */
+        if ( i_newpid != UNUSED_PID || b_pcr || b_cc )
+        {
+            memcpy( p_ts_hdr[i_block], p_ts, i_hdr_size );
+            if ( i_newpid != UNUSED_PID )
+                ts_set_pid( p_ts_hdr[i_block], i_newpid );
+            if ( b_cc )
             {
-                uint16_t i_newpid = p_output->pi_newpids[i_pid];
-                /* Need to map this pid to the new pid */
-                ts_set_pid( p_block->p_ts, i_newpid );
-                p_block->tmp_pid = i_pid;
+                ts_set_cc( p_ts_hdr[i_block],
+                           output_RewriteCC( p_output, p_block ) );
+                if ( p_block->b_discontinuity && b_adaptation )
+                    tsaf_set_discontinuity( p_ts_hdr[i_block] );
             }
+            if ( b_pcr )
+            {
+                /* The PCR is moved from its nominal output date to its
+                 * position on the constant rate timeline. */
+                int64_t i_position = i_cbr_date * 27
+                    + (p_output->i_cbr_frac
+                        + (int64_t)i_block * TS_SIZE * 8 * 1000000)
+                       * 27 / p_output->config.i_cbr_rate;
+                output_RestampPCR( p_ts_hdr[i_block], i_position
+                    - (p_block->i_dts + p_output->config.i_output_latency)
+                       * 27 );
+            }
+            p_iov[i_iov].iov_base = p_ts_hdr[i_block];
+            p_iov[i_iov].iov_len = i_hdr_size;
+            i_iov++;
+            p_iov[i_iov].iov_base = p_ts + i_hdr_size;
+            p_iov[i_iov].iov_len = TS_SIZE - i_hdr_size;
+        }
+        else
+        {
+            p_iov[i_iov].iov_base = p_ts;
+            p_iov[i_iov].iov_len = TS_SIZE;
         }
-
-        p_iov[i_iov].iov_base = p_packet->pp_blocks[i_block]->p_ts;
-        p_iov[i_iov].iov_len = TS_SIZE;
         i_iov++;
     }
 
+    /* The constant rate timeline needs full datagrams. */
+    if ( (p_output->config.i_config & OUTPUT_NOPAD)
+          && !p_output->config.i_cbr_rate && i_depth )
+    {
+        p_output->i_pad_saved += (i_block_cnt - i_block) * TS_SIZE;
+        i_block = i_block_cnt;
+    }
+
     for ( ; i_block < i_block_cnt; i_block++ )
     {
         p_iov[i_iov].iov_base = p_pad_ts;
@@ -399,25 +729,30 @@ static void output_Flush( output_t *p_output )
         p_output->raw_pkt_header.udph.len = htons(sizeof(struct udpheader) + i_payload_len);
     }
 
-    if ( writev( p_output->i_handle, p_iov, i_iov ) < 0 )
+    ssize_t i_written = writev( p_output->i_handle, p_iov, i_iov );
+    if ( i_written < 0 )
     {
         msg_Err( NULL, "couldn't writev to %s (%s)",
                  p_output->config.psz_displayname, strerror(errno) );
+        p_output->i_send_errors++;
+    }
+    else
+    {
+        p_output->i_packets_sent += i_depth;
+        p_output->i_bytes_sent += i_written;
     }
     /* Update the wallclock because writev() can take some time. */
     i_wallclock = mdate();
+    output_UpdateStats( p_output, p_packet );
+
+    if ( p_packet == NULL )
+        return;
 
     for ( i_block = 0; i_block < p_packet->i_depth; i_block++ )
     {
         p_packet->pp_blocks[i_block]->i_refcount--;
         if ( !p_packet->pp_blocks[i_block]->i_refcount )
             block_Delete( p_packet->pp_blocks[i_block] );
-        else if ( b_do_remap || p_output->config.b_do_remap ) {
-            /* still referenced so re-instate the orignial pid if remapped */
-            block_t * p_block = p_packet->pp_blocks[i_block];
-            if (p_block->tmp_pid != UNUSED_PID)
-                ts_set_pid( p_block->p_ts, p_block->tmp_pid );
-        }
     }
     p_output->p_packets = p_packet->p_next;
     free( p_packet );
@@ -437,7 +772,7 @@ void output_Put( output_t *p_output, block_t *p_block )
 
     if ( p_output->p_last_packet != NULL
           && p_output->p_last_packet->i_depth < i_block_cnt
-          && p_output->p_last_packet->i_dts + p_output->config.i_max_retention
+          && p_output->p_last_packet->i_dts + p_output->i_retention
               > p_block->i_dts )
     {
         p_packet = p_output->p_last_packet;
@@ -466,6 +801,113 @@ void output_Put( output_t *p_output, block_t *p_block )
     p_packet->i_depth++;
 }
 
+/*****************************************************************************
+ * output_Admit : statistical remux, tells whether i_nb_packets of the given
+ * class fit in the output bitrate ; the lower the class, the fuller the
+ * bucket must be
+ *****************************************************************************/
+bool output_Admit( output_t *p_output, int i_class, int i_nb_packets,
+                   mtime_t i_dts )
+{
+    int64_t i_depth = (int64_t)p_output->config.i_cbr_rate
+                        * p_output->config.i_output_latency;
+    int64_t i_cost = (int64_t)i_nb_packets * TS_SIZE * 8 * 1000000;
+
+    if ( !(p_output->config.i_config & OUTPUT_STATMUX) )
+        return true;
+
+    if ( !p_output->i_remux_dts )
+        p_output->i_remux_credit = i_depth;
+    else if ( i_dts > p_output->i_remux_dts )
+        p_output->i_remux_credit += (int64_t)p_output->config.i_cbr_rate
+                                     * (i_dts - p_output->i_remux_dts);
+    if ( i_dts > p_output->i_remux_dts )
+        p_output->i_remux_dts = i_dts;
+    if ( p_output->i_remux_credit > i_depth )
+        p_output->i_remux_credit = i_depth;
+
+    if ( i_class != REMUX_ESSENTIAL && p_output->i_remux_credit - i_cost
+           < i_depth * (REMUX_ESSENTIAL - i_class) / 4 )
+        return false;
+
+    /* Essential packets always go, the CBR timeline will complain. */
+    p_output->i_remux_credit -= i_cost;
+    if ( p_output->i_remux_credit < -i_depth )
+        p_output->i_remux_credit = -i_depth;
+    return true;
+}
+
+/*****************************************************************************
+ * output_DropPacket : remove the first queued datagram without sending it
+ *****************************************************************************/
+static void output_DropPacket( output_t *p_output )
+{
+    packet_t *p_packet = p_output->p_packets;
+    int i;
+
+    for ( i = 0; i < p_packet->i_depth; i++ )
+    {
+        p_packet->pp_blocks[i]->i_refcount--;
+        if ( !p_packet->pp_blocks[i]->i_refcount )
+            block_Delete( p_packet->pp_blocks[i] );
+    }
+    p_output->i_packets_dropped += p_packet->i_depth;
+    p_output->p_packets = p_packet->p_next;
+    free( p_packet );
+    if ( p_output->p_packets == NULL )
+        p_output->p_last_packet = NULL;
+}
+
+/*****************************************************************************
+ * output_SendCBR : send the datagrams due on the constant rate timeline
+ *****************************************************************************/
+static void output_SendCBR( output_t *p_output )
+{
+    int64_t i_bits = (int64_t)output_BlockCount( p_output ) * TS_SIZE * 8;
+
+    if ( p_output->i_cbr_next + p_output->config.i_output_latency
+           < i_wallclock )
+    {
+        if ( p_output->i_cbr_next )
+            msg_Warn( NULL, "%s: CBR timeline is late, resynchronizing",
+                      p_output->config.psz_displayname );
+        p_output->i_cbr_next = i_wallclock;
+        p_output->i_cbr_frac = 0;
+    }
+
+    while ( p_output->i_cbr_next <= i_wallclock )
+    {
+        packet_t *p_packet;
+
+        /* When the rate is too low, datagrams late by more than the latency
+         * are dropped, so that the queue doesn't grow without bound. */
+        while ( (p_packet = p_output->p_packets) != NULL
+                 && p_packet->i_dts + 2 * p_output->config.i_output_latency
+                     < p_output->i_cbr_next )
+        {
+            if ( p_output->i_cbr_last_warning + ERROR_REPORT_PERIOD
+                   < i_wallclock )
+            {
+                msg_Warn( NULL, "%s: CBR rate too low for the stream, dropping",
+                          p_output->config.psz_displayname );
+                p_output->i_cbr_last_warning = i_wallclock;
+            }
+            output_DropPacket( p_output );
+        }
+
+        if ( p_packet != NULL && p_packet->i_dts
+               + p_output->config.i_output_latency > p_output->i_cbr_next )
+            p_packet = NULL; /* not due yet, stuff */
+
+        output_Flush( p_output, p_packet, p_output->i_cbr_next );
+
+        p_output->i_cbr_frac += i_bits * 1000000;
+        p_output->i_cbr_next += p_output->i_cbr_frac
+                                 / p_output->config.i_cbr_rate;
+        p_output->i_cbr_frac %= p_output->config.i_cbr_rate;
+    }
+}
+
 /*****************************************************************************
  * output_Send : called from main to flush the queues when needed
  *****************************************************************************/
@@ -479,7 +921,7 @@ mtime_t output_Send( void )
         while ( output_dup.p_packets != NULL
                  && output_dup.p_packets->i_dts
                      + output_dup.config.i_output_latency <= i_wallclock )
-            output_Flush( &output_dup );
+            output_Flush( &output_dup, output_dup.p_packets, 0 );
 
         if ( output_dup.p_packets != NULL )
             i_earliest_dts = output_dup.p_packets->i_dts;
@@ -491,10 +933,19 @@ mtime_t output_Send( void )
         if ( !( p_output->config.i_config & OUTPUT_VALID ) )
             continue;
 
+        if ( p_output->config.i_cbr_rate )
+        {
+            output_SendCBR( p_output );
+            if ( p_output->i_cbr_next < i_earliest_dts
+                  || i_earliest_dts == -1 )
+                i_earliest_dts = p_output->i_cbr_next;
+            continue;
+        }
+
         while ( p_output->p_packets != NULL
                  && p_output->p_packets->i_dts
                      + p_output->config.i_output_latency <= i_wallclock )
-            output_Flush( p_output );
+            output_Flush( p_output, p_output->p_packets, 0 );
 
         if ( p_output->p_packets != NULL
               && (p_output->p_packets->i_dts
@@ -515,12 +966,11 @@ output_t *output_Find( const output_config_t *p_config )
     socklen_t i_sockaddr_len = (p_config->i_family == AF_INET) ?
                                sizeof(struct sockaddr_in) :
                                sizeof(struct sockaddr_in6);
-    int i;
+    output_t *p_output;
 
-    for ( i = 0; i < i_nb_outputs; i++ )
+    for ( p_output = pp_output_index[output_HashConfig( p_config )];
+          p_output != NULL; p_output = p_output->p_index_next )
     {
-        output_t *p_output = pp_outputs[i];
-
         if ( !(p_output->config.i_config & OUTPUT_VALID) ) continue;
 
         if ( p_config->i_family != p_output->config.i_family ||
@@ -553,6 +1003,46 @@ void output_Change( output_t *p_output, const output_config_t *p_config )
     memcpy( p_output->config.pi_ssrc, p_config->pi_ssrc, 4 * sizeof(uint8_t) );
     p_output->config.i_output_latency = p_config->i_output_latency;
     p_output->config.i_max_retention = p_config->i_max_retention;
+    if ( !(p_config->i_config & OUTPUT_CC) )
+    {
+        /* Start from the input counters if /cc is enabled again. */
+        free( p_output->p_pid_cc );
+        p_output->p_pid_cc = NULL;
+        p_output->i_nb_cc_pids = p_output->i_max_cc_pids = 0;
+    }
+    if ( !(p_config->i_config & OUTPUT_ADAPTIVE)
+          || !(p_output->config.i_config & OUTPUT_ADAPTIVE) )
+        p_output->i_retention = p_config->i_max_retention;
+
+    if ( p_output->config.i_cbr_rate != p_config->i_cbr_rate )
+    {
+        /* Start a new timeline on the next output_Send(). */
+        p_output->config.i_cbr_rate = p_config->i_cbr_rate;
+        p_output->i_cbr_next = p_output->i_cbr_frac = 0;
+        p_output->i_remux_dts = 0;
+    }
+
+    free( p_output->config.pi_low_pids );
+    p_output->config.pi_low_pids = NULL;
+    p_output->config.i_nb_low_pids = p_config->i_nb_low_pids;
+    if ( p_config->i_nb_low_pids )
+    {
+        p_output->config.pi_low_pids =
+            malloc( p_config->i_nb_low_pids * sizeof(uint16_t) );
+        memcpy( p_output->config.pi_low_pids, p_config->pi_low_pids,
+                p_config->i_nb_low_pids * sizeof(uint16_t) );
+    }
+
+    free( p_output->config.pi_low_sids );
+    p_output->config.pi_low_sids = NULL;
+    p_output->config.i_nb_low_sids = p_config->i_nb_low_sids;
+    if ( p_config->i_nb_low_sids )
+    {
+        p_output->config.pi_low_sids =
+            malloc( p_config->i_nb_low_sids * sizeof(uint16_t) );
+        memcpy( p_output->config.pi_low_sids, p_config->pi_low_sids,
+                p_config->i_nb_low_sids * sizeof(uint16_t) );
+    }
 
     if ( p_output->config.i_ttl != p_config->i_ttl )
     {
@@ -616,6 +1106,26 @@ void output_Change( output_t *p_output, const output_config_t *p_config )
     }
 }
 
+/*****************************************************************************
+ * outputs_Drain : send the queued packets at once, before the outputs are
+ * handed over
+ *****************************************************************************/
+void outputs_Drain( void )
+{
+    int i;
+
+    for ( i = 0; i < i_nb_outputs; i++ )
+    {
+        output_t *p_output = pp_outputs[i];
+
+        if ( !(p_output->config.i_config & OUTPUT_VALID) )
+            continue;
+        while ( p_output->p_packets != NULL )
+            output_Flush( p_output, p_output->p_packets,
+                          p_output->i_cbr_next );
+    }
+}
+
 /*****************************************************************************
  * outputs_Close : Close all outputs and free allocated memory
  *****************************************************************************/
@@ -632,7 +1142,7 @@ void outputs_Close( int i_num_outputs )
             msg_Dbg( NULL, "removing %s", p_output->config.psz_displayname );
 
             if ( p_output->p_packets )
-                output_Flush( p_output );
+                output_Flush( p_output, p_output->p_packets, 0 );
             output_Close( p_output );
         }
 
@@ -641,3 +1151,128 @@ void outputs_Close( int i_num_outputs )
 
     free( pp_outputs );
 }
+
+/*****************************************************************************
+ * output_MemoryUsage : estimate the memory held by an output
+ *****************************************************************************/
+static void output_MemoryUsage( const output_t *p_output,
+                                output_info_t *p_info )
+{
+    const int i_section_size = PSI_PRIVATE_MAX_SIZE + PSI_HEADER_SIZE;
+    const packet_t *p_packet;
+    const block_t *p_block;
+    int i;
+
+    p_info->i_struct_memory = sizeof(output_t)
+        + (p_output->config.i_nb_pids + p_output->config.i_nb_low_pids
+            + p_output->config.i_nb_low_sids) * sizeof(uint16_t)
+        + p_output->config.i_nb_sids
+           * (sizeof(uint16_t) + sizeof(output_service_t));
+
+    /* Blocks may be shared with other outputs, count them anyway. */
+    p_info->i_queue_memory = 0;
+    for ( p_packet = p_output->p_packets; p_packet != NULL;
+          p_packet = p_packet->p_next )
+        p_info->i_queue_memory += sizeof(packet_t)
+            + (output_BlockCount( (output_t *)p_output ) - 1)
+               * sizeof(block_t *)
+            + p_packet->i_depth * sizeof(block_t);
+
+    p_info->i_psi_memory = 0;
+    if ( p_output->p_pat_section != NULL )
+        p_info->i_psi_memory += i_section_size;
+    if ( p_output->p_pmt_section != NULL )
+        p_info->i_psi_memory += i_section_size;
+    if ( p_output->p_nit_section != NULL )
+        p_info->i_psi_memory += i_section_size;
+    p_info->i_psi_memory += p_output->i_nb_sdt_sections
+                             * (i_section_size + sizeof(uint8_t *));
+    for ( i = 0; i < p_output->config.i_nb_sids; i++ )
+        if ( p_output->p_services[i].p_pmt_section != NULL )
+            p_info->i_psi_memory += i_section_size;
+    if ( p_output->p_eit_epg_section != NULL )
+        p_info->i_psi_memory += i_section_size;
+    if ( p_output->p_eit_ts_buffer != NULL )
+        p_info->i_psi_memory += sizeof(block_t);
+    for ( p_block = p_output->p_eit_carousel; p_block != NULL;
+          p_block = p_block->p_next )
+        p_info->i_psi_memory += sizeof(block_t);
+
+    p_info->i_remap_memory = p_output->i_max_remapped_pids * sizeof(pid_map_t)
+                            + p_output->i_max_cc_pids * sizeof(pid_cc_t);
+
+    p_info->i_memory = p_info->i_struct_memory + p_info->i_queue_memory
+                        + p_info->i_psi_memory + p_info->i_remap_memory;
+}
+
+/*****************************************************************************
+ * outputs_GetStats : per-output counters of the stats file
+ *****************************************************************************/
+void outputs_GetStats( stats_segment_t *p_stats )
+{
+    stats_output_t *p_info = p_stats->outputs;
+    int i;
+
+    p_stats->i_nb_outputs = 0;
+    for ( i = 0; i < i_nb_outputs
+                  && p_stats->i_nb_outputs < STATS_MAX_OUTPUTS; i++ )
+    {
+        output_t *p_output = pp_outputs[i];
+        packet_t *p_packet;
+
+        if ( !(p_output->config.i_config & OUTPUT_VALID) )
+            continue;
+
+        memset( p_info, 0, sizeof(stats_output_t) );
+        strncpy( p_info->psz_displayname, p_output->config.psz_displayname,
+                 sizeof(p_info->psz_displayname) - 1 );
+        p_info->i_sid = p_output->config.i_sid;
+        for ( p_packet = p_output->p_packets; p_packet != NULL;
+              p_packet = p_packet->p_next )
+            p_info->i_queue_depth++;
+        p_info->i_send_errors = p_output->i_send_errors;
+        p_info->i_packets = p_output->i_packets_sent;
+        p_info->i_bytes = p_output->i_bytes_sent;
+        p_info->i_dropped = p_output->i_packets_dropped;
+
+        p_info++;
+        p_stats->i_nb_outputs++;
+    }
+}
+
+/*****************************************************************************
+ * outputs_GetInfo : fill p_data with an output_info_t per valid output
+ *****************************************************************************/
+size_t outputs_GetInfo( uint8_t *p_data, size_t i_max_size )
+{
+    output_info_t *p_info = (output_info_t *)p_data;
+    size_t i_size = 0;
+    int i;
+
+    for ( i = 0; i < i_nb_outputs; i++ )
+    {
+        output_t *p_output = pp_outputs[i];
+
+        if ( !(p_output->config.i_config & OUTPUT_VALID) )
+            continue;
+        if ( i_size + sizeof(output_info_t) > i_max_size )
+            break;
+
+        memset( p_info, 0, sizeof(output_info_t) );
+        strncpy( p_info->psz_displayname, p_output->config.psz_displayname,
+                 sizeof(p_info->psz_displayname) - 1 );
+        p_info->i_sid = p_output->config.i_sid;
+        p_info->i_nb_remapped_pids = p_output->i_nb_remapped_pids;
+        p_info->i_pad_saved = p_output->i_pad_saved;
+        p_info->i_null_saved = p_output->i_null_saved;
+        p_info->i_fill_ratio = p_output->i_fill_ratio;
+        p_info->i_latency = p_output->i_latency;
+        p_info->i_retention = p_output->i_retention;
+        output_MemoryUsage( p_output, p_info );
+
+        p_info++;
+        i_size += sizeof(output_info_t);
+    }
+
+    return i_size;
+}
@@ -254,7 +254,8 @@ void sap_Announce(void)
 
     /* Parsing SDT */
     int j = 0, k = 0;
-    uint8_t *p_sdt = p_output->p_sdt_section;
+    uint8_t *p_sdt = p_output->i_nb_sdt_sections ?
+                     p_output->pp_sdt_sections[0] : NULL;
     if ( p_sdt )
     {
         uint8_t *sdtn;
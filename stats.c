@@ -0,0 +1,107 @@
+/*****************************************************************************
+ * stats.c: Publishes statistics in a shared-memory file
+ *****************************************************************************
+ * Copyright (C) 2026 VideoLAN
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+
+#include "dvblast.h"
+#include "stats.h"
+
+/*****************************************************************************
+ * Local declarations
+ *****************************************************************************/
+static stats_segment_t *p_stats = NULL;
+static mtime_t i_last_update = 0;
+
+/*****************************************************************************
+ * stats_Open : create and map the statistics file
+ *****************************************************************************/
+void stats_Open( const char *psz_file )
+{
+    int i_fd = open( psz_file, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    void *p_map;
+
+    if ( i_fd < 0 )
+    {
+        msg_Err( NULL, "couldn't open stats file %s (%s)", psz_file,
+                 strerror(errno) );
+        return;
+    }
+
+    if ( ftruncate( i_fd, sizeof(stats_segment_t) ) < 0 )
+    {
+        msg_Err( NULL, "couldn't size stats file %s (%s)", psz_file,
+                 strerror(errno) );
+        close( i_fd );
+        return;
+    }
+
+    p_map = mmap( NULL, sizeof(stats_segment_t), PROT_READ | PROT_WRITE,
+                  MAP_SHARED, i_fd, 0 );
+    close( i_fd );
+    if ( p_map == MAP_FAILED )
+    {
+        msg_Err( NULL, "couldn't map stats file %s (%s)", psz_file,
+                 strerror(errno) );
+        return;
+    }
+
+    p_stats = p_map;
+    p_stats->i_version = STATS_VERSION;
+    p_stats->i_writer_pid = getpid();
+    p_stats->i_seq = 0;
+    __sync_synchronize();
+    p_stats->i_magic = STATS_MAGIC;
+}
+
+/*****************************************************************************
+ * stats_Update : refresh the file, at most every STATS_PERIOD
+ *****************************************************************************/
+void stats_Update( void )
+{
+    if ( p_stats == NULL || i_wallclock < i_last_update + STATS_PERIOD )
+        return;
+    i_last_update = i_wallclock;
+
+    p_stats->i_seq++;
+    __sync_synchronize();
+
+    p_stats->i_update = i_wallclock;
+    demux_GetStats( p_stats );
+    outputs_GetStats( p_stats );
+
+    __sync_synchronize();
+    p_stats->i_seq++;
+}
+
+/*****************************************************************************
+ * stats_Close
+ *****************************************************************************/
+void stats_Close( void )
+{
+    if ( p_stats == NULL )
+        return;
+
+    /* Tell readers the counters are no longer updated. */
+    p_stats->i_writer_pid = 0;
+    munmap( p_stats, sizeof(stats_segment_t) );
+    p_stats = NULL;
+}
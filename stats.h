@@ -0,0 +1,82 @@
+/*****************************************************************************
+ * stats.h: Layout of the shared-memory statistics file
+ *****************************************************************************
+ * Copyright (C) 2026 VideoLAN
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ *****************************************************************************/
+
+#ifndef STATS_H
+#define STATS_H
+
+/* The file is rewritten in place every STATS_PERIOD. i_seq is odd while
+ * the writer is updating it: readers copy the segment, and start again if
+ * i_seq was odd or changed in the meantime. Readers must check i_magic and
+ * i_version, as the layout only grows by bumping STATS_VERSION. */
+#define STATS_MAGIC 0x53425644 /* "DVBS" */
+#define STATS_VERSION 2
+#define STATS_MAX_SERVICES 1024
+#define STATS_MAX_OUTPUTS 4096
+
+typedef struct stats_input_t {
+    uint64_t i_packets;
+    uint64_t i_cc_errors;
+    uint64_t i_transport_errors;
+    uint32_t i_bytes_per_sec;
+    uint32_t i_last_seen;               /* ms since the last packet */
+    uint32_t i_nb_pids;                 /* PIDs which carried packets */
+    uint8_t  b_backup;                  /* Reading the --backup-input */
+    uint8_t  i_reserved[3];
+} stats_input_t;
+
+typedef struct stats_service_t {
+    uint16_t i_sid;
+    uint16_t i_pmt_pid;
+    uint16_t i_nb_pids;                 /* PMT, PCR and ES PIDs */
+    uint8_t  b_scrambled;               /* One of its PIDs is scrambled */
+    uint8_t  i_reserved;
+    uint32_t i_bytes_per_sec;
+    uint32_t i_cc_errors;
+    uint32_t i_transport_errors;
+    uint32_t i_reserved2;
+    uint64_t i_packets;
+} stats_service_t;
+
+typedef struct stats_output_t {
+    char     psz_displayname[64];       /* Truncated if needed */
+    uint16_t i_sid;
+    uint16_t i_reserved;
+    uint32_t i_queue_depth;             /* Datagrams waiting to be sent */
+    uint32_t i_send_errors;
+    uint32_t i_reserved2;
+    uint64_t i_packets;                 /* TS packets sent */
+    uint64_t i_bytes;                   /* Datagram payload bytes sent */
+    uint64_t i_dropped;                 /* by /statmux or a too low /cbr */
+} stats_output_t;
+
+typedef struct stats_segment_t {
+    uint32_t i_magic;
+    uint32_t i_version;
+    volatile uint32_t i_seq;
+    uint32_t i_writer_pid;
+    int64_t  i_update;                  /* Date of the last update, in us */
+    uint32_t i_nb_services;
+    uint32_t i_nb_outputs;
+    stats_input_t input;
+    ts_pid_entry_t pids[MAX_PIDS];
+    stats_service_t services[STATS_MAX_SERVICES];
+    stats_output_t outputs[STATS_MAX_OUTPUTS];
+} stats_segment_t;
+
+void stats_Open( const char *psz_file );
+void stats_Update( void );
+void stats_Close( void );
+
+void demux_GetStats( stats_segment_t *p_stats );
+void outputs_GetStats( stats_segment_t *p_stats );
+
+#endif
@@ -42,24 +42,32 @@
 #include <bitstream/ietf/rtp.h>
 
 #include "dvblast.h"
+#include "handoff.h"
 
 /*****************************************************************************
  * Local declarations
  *****************************************************************************/
 #define UDP_LOCK_TIMEOUT 5000000 /* 5 s */
 
-static int i_handle;
-static bool b_udp = false;
-static int i_block_cnt;
-static uint8_t pi_ssrc[4] = { 0, 0, 0, 0 };
-static uint16_t i_seqnum = 0;
-static mtime_t i_last_packet = 0;
+struct udp_input_t
+{
+    int i_handle;
+    bool b_udp;
+    int i_block_cnt;
+    uint8_t pi_ssrc[4];
+    uint16_t i_seqnum;
+    mtime_t i_last_packet;
+};
+
+/* Input opened by udp_Open(), for -D and --backup-input */
+static udp_input_t *p_udp_main = NULL;
 
 /*****************************************************************************
- * udp_Open
+ * udp_OpenInput : open a UDP or RTP input from a -D address
  *****************************************************************************/
-void udp_Open( void )
+udp_input_t *udp_OpenInput( const char *psz_src )
 {
+    udp_input_t *p_udp = malloc( sizeof(udp_input_t) );
     int i_family;
     struct addrinfo *p_connect_ai = NULL, *p_bind_ai;
     int i_if_index = 0;
@@ -67,10 +75,12 @@ void udp_Open( void )
     int i_mtu = 0;
     char *psz_ifname = NULL;
 
-    char *psz_bind, *psz_string = strdup( psz_udp_src );
+    char *psz_bind, *psz_string = strdup( psz_src );
     char *psz_save = psz_string;
     int i = 1;
 
+    memset( p_udp, 0, sizeof(udp_input_t) );
+
     /* Parse configuration. */
 
     if ( (psz_bind = strchr( psz_string, '@' )) != NULL )
@@ -104,7 +114,7 @@ void udp_Open( void )
 #define ARG_OPTION( option ) (psz_string + strlen(option))
 
         if ( IS_OPTION("udp") )
-            b_udp = true;
+            p_udp->b_udp = true;
         else if ( IS_OPTION("mtu=") )
             i_mtu = strtol( ARG_OPTION("mtu="), NULL, 0 );
         else if ( IS_OPTION("ifindex=") )
@@ -126,29 +136,41 @@ void udp_Open( void )
 
     if ( !i_mtu )
         i_mtu = i_family == AF_INET6 ? DEFAULT_IPV6_MTU : DEFAULT_IPV4_MTU;
-    i_block_cnt = (i_mtu - (b_udp ? 0 : RTP_HEADER_SIZE)) / TS_SIZE;
+    p_udp->i_block_cnt = (i_mtu - (p_udp->b_udp ? 0 : RTP_HEADER_SIZE))
+                          / TS_SIZE;
 
 
     /* Do stuff. */
 
-    if ( (i_handle = socket( i_family, SOCK_DGRAM, IPPROTO_UDP )) < 0 )
+    /* The socket of the previous instance is already bound and joined. */
+    if ( (p_udp->i_handle = handoff_TakeFd( HANDOFF_FD_INPUT,
+                                            psz_src )) != -1 )
+    {
+        msg_Dbg( NULL, "taking over socket bound to %s", psz_src );
+        goto done;
+    }
+
+    if ( (p_udp->i_handle = socket( i_family, SOCK_DGRAM, IPPROTO_UDP )) < 0 )
     {
         msg_Err( NULL, "couldn't create socket (%s)", strerror(errno) );
         exit(EXIT_FAILURE);
     }
 
-    setsockopt( i_handle, SOL_SOCKET, SO_REUSEADDR, (void *) &i, sizeof( i ) );
+    setsockopt( p_udp->i_handle, SOL_SOCKET, SO_REUSEADDR, (void *) &i,
+                sizeof( i ) );
 
     /* Increase the receive buffer size to 1/2MB (8Mb/s during 1/2s) to avoid
      * packet loss caused by scheduling problems */
     i = 0x80000;
 
-    setsockopt( i_handle, SOL_SOCKET, SO_RCVBUF, (void *) &i, sizeof( i ) );
+    setsockopt( p_udp->i_handle, SOL_SOCKET, SO_RCVBUF, (void *) &i,
+                sizeof( i ) );
 
-    if ( bind( i_handle, p_bind_ai->ai_addr, p_bind_ai->ai_addrlen ) < 0 )
+    if ( bind( p_udp->i_handle, p_bind_ai->ai_addr,
+               p_bind_ai->ai_addrlen ) < 0 )
     {
         msg_Err( NULL, "couldn't bind (%s)", strerror(errno) );
-        close( i_handle );
+        close( p_udp->i_handle );
         exit(EXIT_FAILURE);
     }
 
@@ -160,7 +182,7 @@ void udp_Open( void )
         else
             i_port = ((struct sockaddr_in *)p_connect_ai->ai_addr)->sin_port;
 
-        if ( i_port != 0 && connect( i_handle, p_connect_ai->ai_addr,
+        if ( i_port != 0 && connect( p_udp->i_handle, p_connect_ai->ai_addr,
                                      p_connect_ai->ai_addrlen ) < 0 )
             msg_Warn( NULL, "couldn't connect socket (%s)", strerror(errno) );
     }
@@ -178,7 +200,7 @@ void udp_Open( void )
             if ( i_if_addr != INADDR_ANY )
                 msg_Warn( NULL, "ignoring ifaddr option in IPv6" );
 
-            if ( setsockopt( i_handle, IPPROTO_IPV6, IPV6_ADD_MEMBERSHIP,
+            if ( setsockopt( p_udp->i_handle, IPPROTO_IPV6, IPV6_ADD_MEMBERSHIP,
                              (char *)&imr, sizeof(struct ipv6_mreq) ) < 0 )
                 msg_Warn( NULL, "couldn't join multicast group (%s)",
                           strerror(errno) );
@@ -204,7 +226,8 @@ void udp_Open( void )
                 if ( i_if_index )
                     msg_Warn( NULL, "ignoring ifindex option in SSM" );
 
-                if ( setsockopt( i_handle, IPPROTO_IP, IP_ADD_SOURCE_MEMBERSHIP,
+                if ( setsockopt( p_udp->i_handle, IPPROTO_IP,
+                                 IP_ADD_SOURCE_MEMBERSHIP,
                             (char *)&imr, sizeof(struct ip_mreq_source) ) < 0 )
                     msg_Warn( NULL, "couldn't join multicast group (%s)",
                               strerror(errno) );
@@ -220,7 +243,7 @@ void udp_Open( void )
                 imr.imr_ifindex = i_if_index;
 #endif
 
-                if ( setsockopt( i_handle, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                if ( setsockopt( p_udp->i_handle, IPPROTO_IP, IP_ADD_MEMBERSHIP,
                                  (char *)&imr, sizeof(struct ip_mreqn) ) < 0 )
                     msg_Warn( NULL, "couldn't join multicast group (%s)",
                               strerror(errno) );
@@ -232,14 +255,14 @@ void udp_Open( void )
                 imr.imr_multiaddr = p_addr->sin_addr;
                 imr.imr_interface.s_addr = i_if_addr;
 
-                if ( setsockopt( i_handle, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                if ( setsockopt( p_udp->i_handle, IPPROTO_IP, IP_ADD_MEMBERSHIP,
                                  (char *)&imr, sizeof(struct ip_mreq) ) == -1 )
                     msg_Warn( NULL, "couldn't join multicast group (%s)",
                               strerror(errno) );
             }
 #ifdef SO_BINDTODEVICE
             if (psz_ifname) {
-                if ( setsockopt( i_handle, SOL_SOCKET, SO_BINDTODEVICE,
+                if ( setsockopt( p_udp->i_handle, SOL_SOCKET, SO_BINDTODEVICE,
                                  psz_ifname, strlen(psz_ifname)+1 ) < 0 ) {
                     msg_Err( NULL, "couldn't bind to device %s (%s)",
                              psz_ifname, strerror(errno) );
@@ -251,25 +274,39 @@ void udp_Open( void )
         }
     }
 
+    msg_Dbg( NULL, "binding socket to %s", psz_src );
+
+done:
+    handoff_AddFd( HANDOFF_FD_INPUT, psz_src, p_udp->i_handle );
+    free( psz_ifname );
     freeaddrinfo( p_bind_ai );
     if ( p_connect_ai != NULL )
         freeaddrinfo( p_connect_ai );
     free( psz_save );
+    return p_udp;
+}
 
-    msg_Dbg( NULL, "binding socket to %s", psz_udp_src );
+/*****************************************************************************
+ * udp_Open
+ *****************************************************************************/
+void udp_Open( void )
+{
+    p_udp_main = udp_OpenInput( psz_udp_src );
 }
 
 /*****************************************************************************
- * udp_Read
+ * ReadInput : read packets from a UDP input, and serve the control socket
+ * if b_comm is set
  *****************************************************************************/
-block_t *udp_Read( mtime_t i_poll_timeout )
+static block_t *ReadInput( udp_input_t *p_udp, mtime_t i_poll_timeout,
+                           bool b_comm )
 {
     struct pollfd pfd[2];
     int i_ret, i_nb_fd = 1;
 
-    pfd[0].fd = i_handle;
+    pfd[0].fd = p_udp->i_handle;
     pfd[0].events = POLLIN;
-    if ( i_comm_fd != -1 )
+    if ( b_comm && i_comm_fd != -1 )
     {
         pfd[1].fd = i_comm_fd;
         pfd[1].events = POLLIN;
@@ -290,13 +327,13 @@ block_t *udp_Read( mtime_t i_poll_timeout )
 
     if ( pfd[0].revents )
     {
-        struct iovec p_iov[i_block_cnt + 1];
+        struct iovec p_iov[p_udp->i_block_cnt + 1];
         block_t *p_ts, **pp_current = &p_ts;
         int i_iov, i_block;
         ssize_t i_len;
         uint8_t p_rtp_hdr[RTP_HEADER_SIZE];
 
-        if ( !i_last_packet )
+        if ( !p_udp->i_last_packet )
         {
             switch (i_print_type) {
             case PRINT_XML:
@@ -306,9 +343,9 @@ block_t *udp_Read( mtime_t i_poll_timeout )
                 printf("frontend has acquired lock\n" );
             }
         }
-        i_last_packet = i_wallclock;
+        p_udp->i_last_packet = i_wallclock;
 
-        if ( !b_udp )
+        if ( !p_udp->b_udp )
         {
             /* FIXME : this is wrong if RTP header > 12 bytes */
             p_iov[0].iov_base = p_rtp_hdr;
@@ -318,7 +355,7 @@ block_t *udp_Read( mtime_t i_poll_timeout )
         else
             i_iov = 0;
 
-        for ( i_block = 0; i_block < i_block_cnt; i_block++ )
+        for ( i_block = 0; i_block < p_udp->i_block_cnt; i_block++ )
         {
             *pp_current = block_New();
             p_iov[i_iov].iov_base = (*pp_current)->p_ts;
@@ -328,13 +365,13 @@ block_t *udp_Read( mtime_t i_poll_timeout )
         }
         pp_current = &p_ts;
 
-        if ( (i_len = readv( i_handle, p_iov, i_iov )) < 0 )
+        if ( (i_len = readv( p_udp->i_handle, p_iov, i_iov )) < 0 )
         {
             msg_Err( NULL, "couldn't read from network (%s)", strerror(errno) );
             goto err;
         }
 
-        if ( !b_udp )
+        if ( !p_udp->b_udp )
         {
             uint8_t pi_new_ssrc[4];
 
@@ -343,9 +380,9 @@ block_t *udp_Read( mtime_t i_poll_timeout )
             if ( rtp_get_type(p_rtp_hdr) != RTP_TYPE_TS )
                 msg_Warn( NULL, "non-TS RTP packet received" );
             rtp_get_ssrc(p_rtp_hdr, pi_new_ssrc);
-            if ( !memcmp( pi_ssrc, pi_new_ssrc, 4 * sizeof(uint8_t) ) )
+            if ( !memcmp( p_udp->pi_ssrc, pi_new_ssrc, 4 * sizeof(uint8_t) ) )
             {
-                if ( rtp_get_seqnum(p_rtp_hdr) != i_seqnum )
+                if ( rtp_get_seqnum(p_rtp_hdr) != p_udp->i_seqnum )
                     msg_Warn( NULL, "RTP discontinuity" );
             }
             else
@@ -353,7 +390,7 @@ block_t *udp_Read( mtime_t i_poll_timeout )
                 struct in_addr addr;
                 memcpy( &addr.s_addr, pi_new_ssrc, 4 * sizeof(uint8_t) );
                 msg_Dbg( NULL, "new RTP source: %s", inet_ntoa( addr ) );
-                memcpy( pi_ssrc, pi_new_ssrc, 4 * sizeof(uint8_t) );
+                memcpy( p_udp->pi_ssrc, pi_new_ssrc, 4 * sizeof(uint8_t) );
                 switch (i_print_type) {
                 case PRINT_XML:
                     printf("<STATUS type=\"source\" source=\"%s\"/>\n",
@@ -363,7 +400,7 @@ block_t *udp_Read( mtime_t i_poll_timeout )
                     printf("new RTP source: %s\n", inet_ntoa( addr ) );
                 }
             }
-            i_seqnum = rtp_get_seqnum(p_rtp_hdr) + 1;
+            p_udp->i_seqnum = rtp_get_seqnum(p_rtp_hdr) + 1;
 
             i_len -= RTP_HEADER_SIZE;
         }
@@ -383,7 +420,8 @@ err:
 
         return p_ts;
     }
-    else if ( i_last_packet && i_last_packet + UDP_LOCK_TIMEOUT < i_wallclock )
+    else if ( p_udp->i_last_packet
+               && p_udp->i_last_packet + UDP_LOCK_TIMEOUT < i_wallclock )
     {
         switch (i_print_type) {
         case PRINT_XML:
@@ -392,15 +430,31 @@ err:
         default:
             printf("frontend has lost lock\n" );
         }
-        i_last_packet = 0;
+        p_udp->i_last_packet = 0;
     }
 
-    if ( i_comm_fd != -1 && pfd[1].revents )
+    if ( i_nb_fd > 1 && pfd[1].revents )
         comm_Read();
 
     return NULL;
 }
 
+/*****************************************************************************
+ * udp_Read
+ *****************************************************************************/
+block_t *udp_Read( mtime_t i_poll_timeout )
+{
+    return ReadInput( p_udp_main, i_poll_timeout, true );
+}
+
+/*****************************************************************************
+ * udp_ReadInput : read packets from an additional input, without waiting
+ *****************************************************************************/
+block_t *udp_ReadInput( udp_input_t *p_udp )
+{
+    return ReadInput( p_udp, 0, false );
+}
+
 /* From now on these are just stubs */
 
 /*****************************************************************************